@@ -0,0 +1,175 @@
+/**
+ * @file   genfile.cpp
+ * @brief  Generate synthetic files for the benchmarks.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+/// Bytes written to the file at a time.
+#define GEN_CHUNK (1 << 20)
+
+/// Fast pseudo-random numbers, the same every run so results are comparable.
+class Random
+{
+	public:
+		Random()
+			:	state(0x9E3779B97F4A7C15ULL)
+		{
+		}
+
+		uint64_t next()
+		{
+			// xorshift64*
+			this->state ^= this->state >> 12;
+			this->state ^= this->state << 25;
+			this->state ^= this->state >> 27;
+			return this->state * 0x2545F4914F6CDD1DULL;
+		}
+
+	protected:
+		uint64_t state;
+};
+
+static const char *words[] = {
+	"the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog", "file",
+	"offset", "byte", "line", "view", "cache", "block", "data", "stream",
+	"read", "write", "error", "value", "record", "index", "search", "page",
+};
+static const int numWords = sizeof(words) / sizeof(words[0]);
+
+/// Lines of words, 20 to 120 characters long.
+static void fillText(Random& rnd, std::string& out, size_t want)
+{
+	while (out.length() < want) {
+		size_t lineLen = 20 + rnd.next() % 100;
+		size_t start = out.length();
+		while (out.length() - start < lineLen) {
+			if (out.length() > start) out += ' ';
+			out += words[rnd.next() % numWords];
+		}
+		out += '\n';
+	}
+	return;
+}
+
+/// JSON records all on one line, with only a newline at the very end.
+static void fillJson(Random& rnd, std::string& out, size_t want,
+	unsigned long *id)
+{
+	char buf[128];
+	while (out.length() < want) {
+		uint64_t r = rnd.next();
+		snprintf(buf, sizeof(buf), "%s{\"id\":%lu,\"name\":\"%s %s\",\"value\":%u}",
+			*id ? "," : "[", *id, words[r % numWords], words[(r >> 8) % numWords],
+			(unsigned int)(r >> 32));
+		out += buf;
+		(*id)++;
+	}
+	return;
+}
+
+/// Parse a size such as "10G" or "256M".
+static uint64_t parseSize(const char *s)
+{
+	char *end;
+	uint64_t size = strtoull(s, &end, 10);
+	switch (*end) {
+		case 'K': case 'k': size <<= 10; break;
+		case 'M': case 'm': size <<= 20; break;
+		case 'G': case 'g': size <<= 30; break;
+		default: break;
+	}
+	return size;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 4) {
+		fprintf(stderr, "Usage: genfile text|binary|json|packed9 <size> <output>\n"
+			"Size may end in K, M or G.\n");
+		return 1;
+	}
+	std::string type = argv[1];
+	uint64_t size = parseSize(argv[2]);
+	if ((type != "text") && (type != "binary") && (type != "json")
+		&& (type != "packed9")
+	) {
+		fprintf(stderr, "Unknown file type \"%s\"\n", argv[1]);
+		return 1;
+	}
+
+	FILE *f = fopen(argv[3], "wb");
+	if (!f) {
+		perror(argv[3]);
+		return 1;
+	}
+
+	Random rnd;
+	std::string text;
+	std::vector<uint8_t> chunk(GEN_CHUNK);
+	unsigned long id = 0;   // next JSON record
+	uint32_t nextValue = 0; // next 9-bit value
+	uint64_t acc = 0;       // 9-bit values not yet written
+	int accBits = 0;        // number of bits in acc
+	uint64_t written = 0;
+	while (written < size) {
+		size_t len = (size - written < GEN_CHUNK) ? size - written : GEN_CHUNK;
+		const uint8_t *data = &chunk[0];
+		if (type == "text") {
+			fillText(rnd, text, GEN_CHUNK);
+			data = (const uint8_t *)text.data();
+		} else if (type == "json") {
+			fillJson(rnd, text, GEN_CHUNK, &id);
+			if (written + len >= size) text[len - 1] = '\n';
+			data = (const uint8_t *)text.data();
+		} else if (type == "binary") {
+			for (size_t i = 0; i < GEN_CHUNK; i += 8) {
+				uint64_t r = rnd.next();
+				memcpy(&chunk[i], &r, 8);
+			}
+		} else {
+			// A counter, nine bits at a time, packed little-endian
+			for (size_t i = 0; i < GEN_CHUNK; i++) {
+				while (accBits < 8) {
+					acc |= (uint64_t)(nextValue++ & 0x1FF) << accBits;
+					accBits += 9;
+				}
+				chunk[i] = (uint8_t)acc;
+				acc >>= 8;
+				accBits -= 8;
+			}
+		}
+		if (fwrite(data, len, 1, f) != 1) {
+			perror(argv[3]);
+			fclose(f);
+			return 1;
+		}
+		written += len;
+		if (!text.empty()) text.erase(0, len);
+	}
+	if (fclose(f) != 0) {
+		perror(argv[3]);
+		return 1;
+	}
+	return 0;
+}
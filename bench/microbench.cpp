@@ -0,0 +1,369 @@
+/**
+ * @file   microbench.cpp
+ * @brief  Time the inner loops of the views and consoles on their own.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <camoto/stream_string.hpp>
+#include <config.h>
+#include "cfg.hpp"
+
+#ifdef HAVE_NCURSESW
+#include "NCursesConsole.hpp"
+#endif
+
+#include "HeadlessConsole.hpp"
+#include "HexView.hpp"
+#include "TextView.hpp"
+#include "MmapStream.hpp"
+#include "CellDecoder.hpp"
+#include "Stats.hpp"
+
+/// Minimum time to spend on each measurement, in seconds.
+#define MIN_TIME 0.25
+
+/// Size of the generated text file for the eight-bit cacheLines() runs.
+#define TEXT_SIZE (64 << 20)
+
+/// Size of the generated text file for the bitstream cacheLines() runs.
+#define TEXT_SIZE_BITS (4 << 20)
+
+/// Size of the random data for the cell decoding runs.
+#define DECODE_SIZE (1 << 20)
+
+// Normally in main.cpp, the views read the colours from here
+Config cfg;
+
+/// Fast pseudo-random numbers, the same every run so results are comparable.
+class Random
+{
+	public:
+		Random()
+			:	state(0x9E3779B97F4A7C15ULL)
+		{
+		}
+
+		uint64_t next()
+		{
+			// xorshift64*
+			this->state ^= this->state >> 12;
+			this->state ^= this->state << 25;
+			this->state ^= this->state >> 27;
+			return this->state * 0x2545F4914F6CDD1DULL;
+		}
+
+	protected:
+		uint64_t state;
+};
+
+/// Gives the benchmarks access to TextView::cacheLines().
+class BenchTextView: public TextView
+{
+	public:
+		BenchTextView(std::shared_ptr<camoto::stream::inout> data,
+			IConsole *pConsole)
+			:	TextView("bench", data, pConsole)
+		{
+		}
+
+		/// Find every line in the file from scratch.
+		/**
+		 * @return Number of lines found.
+		 */
+		unsigned long findLines(int width)
+		{
+			this->linePos.clear();
+			this->cacheComplete = false;
+			this->cacheLines(1 << 30, width);
+			return this->linePos.size();
+		}
+};
+
+/// Keeps results from being optimised away.
+static volatile unsigned int sink;
+
+/// Call a function repeatedly until enough time has passed to trust the result.
+/**
+ * @return Average time taken by one call, in nanoseconds.
+ */
+static double measure(const std::function<void()>& fn)
+{
+	fn(); // warm up, and fault in any pages
+	unsigned long reps = 1;
+	for (;;) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (unsigned long i = 0; i < reps; i++) fn();
+		double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - start).count();
+		if (ns >= MIN_TIME * 1e9) return ns / reps;
+		reps *= 2;
+	}
+}
+
+/// Print one result line.
+/**
+ * @param cells
+ *   Number of cells handled by one call.
+ *
+ * @param bytes
+ *   Number of bytes of file data handled by one call, or 0 if not relevant.
+ */
+static void report(const char *kernel, const std::string& what, double ns,
+	double cells, double bytes)
+{
+	printf("%-12s %-28s %9.2f ns/cell", kernel, what.c_str(), ns / cells);
+	if (bytes > 0) printf(" %8.3f GB/s", bytes / ns);
+	printf("\n");
+	fflush(stdout);
+	return;
+}
+
+/// Write a file of text lines, returning its name.
+static std::string makeTextFile(const std::string& dir, size_t size,
+	size_t minLine, size_t maxLine)
+{
+	std::string filename = dir + "/ll-microbench.XXXXXX";
+	int fd = mkstemp(&filename[0]);
+	if (fd < 0) {
+		perror(filename.c_str());
+		exit(1);
+	}
+	static const char letters[] = "abcdefghijklmnopqrstuvwxyz     ";
+	Random rnd;
+	std::string text;
+	text.reserve(size);
+	while (text.length() < size) {
+		size_t len = minLine + rnd.next() % (maxLine - minLine + 1);
+		for (size_t i = 0; i < len; i++) {
+			text += letters[rnd.next() % (sizeof(letters) - 1)];
+		}
+		text += '\n';
+	}
+	text.resize(size);
+	if (write(fd, text.data(), text.length()) != (ssize_t)text.length()) {
+		perror(filename.c_str());
+		exit(1);
+	}
+	close(fd);
+	return filename;
+}
+
+/// Time TextView::cacheLines() finding every line in a file.
+static void benchCacheLines(const std::string& dir, IConsole *console)
+{
+	struct {
+		const char *name;
+		size_t size;
+		size_t minLine, maxLine;
+		int bitWidth;
+	} cases[] = {
+		{"short lines, 8-bit", TEXT_SIZE, 20, 120, 8},
+		{"long lines, 8-bit", TEXT_SIZE, 1000, 10000, 8},
+		{"short lines, 7-bit", TEXT_SIZE_BITS, 20, 120, 7},
+		{"short lines, 8-bit, bit 1", TEXT_SIZE_BITS, 20, 120, 8},
+		{"short lines, 9-bit", TEXT_SIZE_BITS, 20, 120, 9},
+	};
+	for (unsigned int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		std::string filename = makeTextFile(dir, cases[i].size, cases[i].minLine,
+			cases[i].maxLine);
+		{
+			auto data = std::make_shared<MmapStream>(filename);
+			BenchTextView view(data, console);
+			view.setBitWidth(cases[i].bitWidth);
+			if (i == 3) {
+				// Off a byte boundary, so the bulk reader can't be used
+				view.setIntraByteOffset(1);
+			}
+			double cells = (cases[i].size * 8.0) / cases[i].bitWidth;
+			double ns = measure([&]() { sink += view.findLines(80); });
+			report("cacheLines", cases[i].name, ns, cells, cases[i].size);
+		}
+		unlink(filename.c_str());
+	}
+	return;
+}
+
+/// Time HexView::redrawLines() drawing a full screen at different cell sizes.
+static void benchHexView(HeadlessConsole& console)
+{
+	Random rnd;
+	std::string content(1 << 16, '\0');
+	for (size_t i = 0; i < content.length(); i++) content[i] = rnd.next();
+	auto data = std::make_shared<camoto::stream::string>(content);
+
+	int width, height;
+	console.getContentDims(&width, &height);
+	static const int bitWidths[] = {1, 4, 7, 8, 9, 12, 16, 32};
+	for (unsigned int i = 0; i < sizeof(bitWidths) / sizeof(bitWidths[0]); i++) {
+		HexView view("bench", data, &console);
+		view.setBitWidth(bitWidths[i]);
+		unsigned long before = ::stats.bitstreamReads;
+		view.redrawLines(0, height);
+		double cells = ::stats.bitstreamReads - before;
+		double ns = measure([&]() { view.redrawLines(0, height); });
+		report("redrawLines", std::to_string(bitWidths[i]) + "-bit cells", ns,
+			cells, cells * bitWidths[i] / 8);
+	}
+	return;
+}
+
+/// Time reading cells out of memory, through the bitstream and CellDecoder.
+static void benchDecode()
+{
+	Random rnd;
+	std::string content(DECODE_SIZE, '\0');
+	for (size_t i = 0; i < content.length(); i++) content[i] = rnd.next();
+	const uint8_t *bytes = (const uint8_t *)content.data();
+	auto data = std::make_shared<camoto::stream::string>(content);
+
+	for (int w = 1; w <= 32; w++) {
+		// Leave room for the last cell to read a few bytes past its start
+		unsigned long cells = (DECODE_SIZE - 8) * 8UL / w;
+
+		camoto::bitstream file(data, camoto::bitstream::littleEndian);
+		double ns = measure([&]() {
+			file.seek(0, camoto::stream::start);
+			unsigned int c, total = 0;
+			for (unsigned long n = 0; n < cells; n++) {
+				file.read(w, &c);
+				total += c;
+			}
+			sink += total;
+		});
+		report("bitstream", std::to_string(w) + "-bit cells", ns, cells,
+			cells * w / 8.0);
+
+		CellDecoder decoder(w, camoto::bitstream::littleEndian);
+		ns = measure([&]() {
+			unsigned int total = 0;
+			unsigned long bit = 0;
+			for (unsigned long n = 0; n < cells; n++, bit += w) {
+				total += decoder.get(bytes + (bit >> 3), bit & 7);
+			}
+			sink += total;
+		});
+		report("CellDecoder", std::to_string(w) + "-bit cells", ns, cells,
+			cells * w / 8.0);
+	}
+	return;
+}
+
+/// Fill the content area with one of two screens of text, alternately.
+/**
+ * Every cell changes each time, so the whole screen has to be redrawn.
+ *
+ * @return Number of cells written.
+ */
+static unsigned long fillScreen(IConsole& console, int width, int height,
+	int frame)
+{
+	static const AttrRuns runs = {{10, ATTR_HIGHLIGHT}, {70, ATTR_CONTENT}};
+	std::string line(width, '\0');
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			// Include code page 437 graphics, which need converting
+			line[x] = (char)(((frame & 1) ? 0x20 : 0xB0) + (x + y) % 0x40);
+		}
+		console.gotoxy(0, y);
+		console.putstr(line, runs);
+	}
+	return (unsigned long)width * height;
+}
+
+/// Time putstr() into the grid, and drawing the grid on a terminal.
+static void benchConsoles(HeadlessConsole& headless)
+{
+	int width, height;
+	headless.getContentDims(&width, &height);
+	int frame = 0;
+	unsigned long cells = fillScreen(headless, width, height, frame);
+	double ns = measure([&]() { fillScreen(headless, width, height, ++frame); });
+	report("putstr", "BaseConsole grid", ns, cells, 0);
+
+#ifdef HAVE_NCURSESW
+	// Send the terminal output nowhere, the cost of converting it is what's
+	// being measured here.
+	fflush(stdout);
+	int savedStdout = dup(STDOUT_FILENO);
+	int null = open("/dev/null", O_WRONLY);
+	if ((savedStdout < 0) || (null < 0)) {
+		perror("/dev/null");
+		return;
+	}
+	if (!getenv("TERM")) setenv("TERM", "xterm", 1);
+	dup2(null, STDOUT_FILENO);
+	close(null);
+	double nsPut, nsDraw;
+	{
+		NCursesConsole curses;
+		curses.getContentDims(&width, &height);
+		cells = fillScreen(curses, width, height, frame);
+		nsPut = measure([&]() { fillScreen(curses, width, height, ++frame); });
+		nsDraw = measure([&]() {
+			fillScreen(curses, width, height, ++frame);
+			curses.update();
+		});
+	}
+	fflush(stdout);
+	dup2(savedStdout, STDOUT_FILENO);
+	close(savedStdout);
+	report("putstr", "NCursesConsole grid", nsPut, cells, 0);
+	report("putstr", "NCursesConsole + update()", nsDraw, cells, 0);
+#endif
+	return;
+}
+
+int main(int iArgC, char *cArgV[])
+{
+	if ((iArgC > 2) || ((iArgC == 2) && (cArgV[1][0] == '-'))) {
+		fprintf(stderr, "Usage: microbench [<directory for temporary files>]\n");
+		return 1;
+	}
+	std::string dir;
+	if (iArgC == 2) dir = cArgV[1];
+	else if (getenv("TMPDIR")) dir = getenv("TMPDIR");
+	else dir = "/tmp";
+
+	::cfg.clrStatusBar.iFG = 15;
+	::cfg.clrStatusBar.iBG = 4;
+	::cfg.clrContent.iFG = 15;
+	::cfg.clrContent.iBG = 1;
+	::cfg.clrHighlight.iFG = 10;
+	::cfg.clrHighlight.iBG = 0;
+	::cfg.view = View_Text;
+
+	std::istringstream script;
+	std::ostringstream frames;
+	HeadlessConsole console(80, 25, script, frames);
+
+	benchCacheLines(dir, &console);
+	benchHexView(console);
+	benchDecode();
+	benchConsoles(console);
+	return 0;
+}
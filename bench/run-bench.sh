@@ -0,0 +1,96 @@
+#!/bin/sh
+#
+# Replay key scripts against the generated files through the headless console,
+# and report how long each kind of key took.
+#
+# Usage: run-bench.sh <path to ll> <directory holding the generated files>
+#
+# Keys are written one per line, so each is timed on its own.  A repeat count
+# (e.g. PageDown*1000) would have them all arrive at once as typeahead, and
+# only the last one would include drawing the screen.
+
+LL="$1"
+DIR="$2"
+TMP="${TMPDIR:-/tmp}/ll-bench.$$"
+trap 'rm -f "$TMP.keys" "$TMP.out"' EXIT
+
+# repeat <count> <key>
+repeat() {
+	i=0
+	while [ $i -lt "$1" ]; do
+		echo "$2"
+		i=$((i + 1))
+	done
+}
+
+# run <file>, with the key script on stdin
+run() {
+	cat > "$TMP.keys"
+	if ! "$LL" --console=headless --keys="$TMP.keys" --frames=/dev/null \
+		"$DIR/$1" 2> "$TMP.out"
+	then
+		echo "$1: ll failed" >&2
+		cat "$TMP.out" >&2
+		exit 1
+	fi
+	# "time <name>: keys N, p50 X us, p99 X us, max X us, total X us, read N bytes"
+	sed -n 's/^time //p' "$TMP.out" | awk -F ', ' -v file="$1" '{
+		split($1, head, ": keys ")
+		split($2, p50, " "); split($3, p99, " "); split($4, max, " ")
+		split($5, total, " "); split($6, bytes, " ")
+		secs = total[2] / 1000000
+		printf "%-16s %-18s %6d %10.1f %10.1f %10.1f %9.0f %9.1f\n",
+			file, head[1], head[2], p50[2], p99[2], max[2],
+			(secs > 0) ? head[2] / secs : 0,
+			(secs > 0) ? bytes[2] / 1048576 / secs : 0
+	}'
+}
+
+printf "%-16s %-18s %6s %10s %10s %10s %9s %9s\n" \
+	"File" "Keys" "Count" "p50 us" "p99 us" "Max us" "Keys/s" "MB/s"
+
+{
+	echo "section PageDown"
+	repeat 1000 PageDown
+	echo "section End"
+	echo End
+	echo "section Home"
+	echo Home
+	echo "section Alt+h"
+	repeat 20 Alt+h
+} | run bench-text.txt
+
+{
+	echo "section Alt+h"
+	echo Alt+h
+	echo "section hex PageDown"
+	repeat 1000 PageDown
+	echo "section hex End"
+	echo End
+	echo "section hex Home"
+	echo Home
+	echo "section bit width"
+	repeat 24 B
+	repeat 24 b
+} | run bench-binary.bin
+
+{
+	echo "section PageDown"
+	repeat 1000 PageDown
+	echo "section End"
+	echo End
+	echo "section Home"
+	echo Home
+} | run bench-long.json
+
+{
+	echo "section setup"
+	echo Alt+h
+	echo B
+	echo "section 9-bit PageDown"
+	repeat 1000 PageDown
+	echo "section 9-bit End"
+	echo End
+	echo "section 9-bit Home"
+	echo Home
+} | run bench-9bit.bin
@@ -18,10 +18,44 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
 #include "BaseConsole.hpp"
 
+#define min(x, y) (((x) < (y)) ? (x) : (y))
+#define max(x, y) (((x) > (y)) ? (x) : (y))
+
+/// Set or clear bits start to end-1 in a row of the dirty bitmap.
+static void setBits(uint64_t *row, int start, int end, bool value)
+{
+	while (start < end) {
+		int bit = start & 63;
+		int count = min(end - start, 64 - bit);
+		uint64_t mask = (count == 64) ? ~0ULL : (((1ULL << count) - 1) << bit);
+		if (value) row[start >> 6] |= mask;
+		else row[start >> 6] &= ~mask;
+		start += count;
+	}
+	return;
+}
+
+IConsole::~IConsole()
+{
+}
+
 BaseConsole::BaseConsole()
-	:	mode(Normal)
+	:	screenWidth(0),
+		screenHeight(0),
+		dirtyStride(0),
+		cursorX(0),
+		cursorY(0),
+		cursorVisible(false),
+		pendingScroll(0),
+		holdUpdates(false),
+		updateHeld(false),
+		frameOpen(false),
+		mode(Normal)
 {
 }
 
@@ -139,3 +173,369 @@ bool BaseConsole::processKey(Key c)
 	}
 	return ret;
 }
+
+void BaseConsole::idle()
+{
+	// Don't let a redraw interfere with the prompt
+	if (this->mode == Normal) this->view->idle();
+	return;
+}
+
+void BaseConsole::update(void)
+{
+	if (this->holdUpdates) {
+		this->updateHeld = true;
+		return;
+	}
+	this->updateHeld = false;
+	this->drawFrame();
+	return;
+}
+
+bool BaseConsole::processQueuedKey(Key c, bool more)
+{
+	// A key can open a prompt whose own keys are read by a nested mainLoop(),
+	// and those have to be drawn as they are typed, whatever the outer key
+	// was told.
+	if (!this->frameOpen) {
+		// Time everything from here until the result has been drawn
+		this->frameOpen = true;
+		this->frameStart = std::chrono::steady_clock::now();
+		this->frameBase = ::stats.snapshot();
+	}
+
+	bool held = this->holdUpdates;
+	this->holdUpdates = more;
+	bool ret = this->processKey(c);
+	if (!more) this->flushUpdate();
+	this->holdUpdates = held;
+	return ret;
+}
+
+void BaseConsole::flushUpdate()
+{
+	if (this->updateHeld) {
+		this->updateHeld = false;
+		this->drawFrame();
+	}
+	return;
+}
+
+void BaseConsole::drawFrame()
+{
+	unsigned long changed = 0;
+	for (std::vector<uint64_t>::const_iterator
+		i = this->dirty.begin(); i != this->dirty.end(); i++
+	) {
+		changed += __builtin_popcountll(*i);
+	}
+	::stats.cellsChanged += changed;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	Stats::Timer output(Stats::Phase_Output);
+	this->drawChanges();
+	output.stop();
+	if (!this->frameOpen) return; // not drawing because of a key
+
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	Stats::Frame f = ::stats.snapshot();
+	f.micros = std::chrono::duration_cast<std::chrono::microseconds>(
+		end - this->frameStart).count();
+	f.drawMicros = std::chrono::duration_cast<std::chrono::microseconds>(
+		end - start).count();
+	f.bytesRead -= this->frameBase.bytesRead;
+	f.bitstreamReads -= this->frameBase.bitstreamReads;
+	f.consoleCalls -= this->frameBase.consoleCalls;
+	f.cellsChanged -= this->frameBase.cellsChanged;
+	::stats.lastFrame = f;
+	this->frameOpen = false;
+	return;
+}
+
+int BaseConsole::takeScroll()
+{
+	int scroll = this->pendingScroll;
+	this->pendingScroll = 0;
+	if (abs(scroll) >= this->screenHeight - 2) return 0; // nothing left to move
+	return scroll;
+}
+
+uint32_t *BaseConsole::getFramebuffer(int *iWidth, int *iHeight, int *iStride)
+{
+	return NULL;
+}
+
+void BaseConsole::updateFramebuffer()
+{
+	return;
+}
+
+void BaseConsole::releaseFramebuffer()
+{
+	return;
+}
+
+void BaseConsole::clearStatusBar(SB_Y eY)
+{
+	::stats.consoleCalls++;
+	int y = (eY == SB_BOTTOM) ? this->screenHeight - 1 : 0;
+	this->blankCells(0, y, this->screenWidth);
+	return;
+}
+
+void BaseConsole::setStatusBar(SB_Y eY, SB_X eX, const std::string& strMessage,
+	int cursor)
+{
+	::stats.consoleCalls++;
+	int x;
+	switch (eX) {
+		case SB_CENTRE: x = (this->screenWidth - (int)strMessage.length()) / 2; break;
+		case SB_RIGHT:  x = this->screenWidth - strMessage.length(); break;
+		default: // SB_LEFT
+			x = 0;
+			break;
+	}
+	int y = (eY == SB_BOTTOM) ? this->screenHeight - 1 : 0;
+	if (x < 0) return; // right-justified long text in a short window
+	if ((cursor >= 0) && (cursor <= (int)strMessage.length())) {
+		this->cursorX = x + cursor;
+		this->cursorY = y;
+	}
+	this->writeText(x, y, strMessage);
+	return;
+}
+
+void BaseConsole::gotoxy(int x, int y)
+{
+	::stats.consoleCalls++;
+	this->cursorX = x;
+	this->cursorY = y + 1; // doesn't count status bar
+	return;
+}
+
+void BaseConsole::putstr(const std::string& strContent)
+{
+	::stats.consoleCalls++;
+	// Could put this->cursorX == this->screenWidth
+	this->cursorX += this->writeText(this->cursorX, this->cursorY, strContent);
+	return;
+}
+
+void BaseConsole::putstr(const std::string& strContent, const AttrRuns& runs)
+{
+	::stats.consoleCalls++;
+	this->cursorX += this->writeText(this->cursorX, this->cursorY, strContent,
+		&runs);
+	return;
+}
+
+void BaseConsole::getContentDims(int *iWidth, int *iHeight)
+{
+	*iWidth = this->screenWidth;
+	*iHeight = this->screenHeight - 2; // doesn't count status bars
+	return;
+}
+
+void BaseConsole::scrollContent(int iX, int iY)
+{
+	::stats.consoleCalls++;
+	int from, to, rows;
+	this->scrollGrid(iY, &from, &to, &rows);
+
+	// The display is only scrolled once it is drawn, so a run of scrolls
+	// becomes a single one.
+	this->pendingScroll += iY;
+	return;
+}
+
+void BaseConsole::eraseToEOL(void)
+{
+	::stats.consoleCalls++;
+	this->blankCells(this->cursorX, this->cursorY,
+		this->screenWidth - this->cursorX);
+	return;
+}
+
+void BaseConsole::cursor(bool visible)
+{
+	this->cursorVisible = visible;
+	return;
+}
+
+void BaseConsole::resizeGrid(int width, int height)
+{
+	this->screenWidth = width;
+	this->screenHeight = height;
+	this->cells.resize(width * height);
+	for (int y = 0; y < height; y++) {
+		Cell blank = {0, this->rowAttr(y)};
+		std::fill(this->cells.begin() + y * width,
+			this->cells.begin() + (y + 1) * width, blank);
+	}
+	this->dirtyStride = (width + 63) / 64;
+	this->dirty.resize(this->dirtyStride * height);
+	this->markAllDirty();
+	this->pendingScroll = 0;
+	return;
+}
+
+void BaseConsole::markDirty(int x, int y, int len)
+{
+	if ((y < 0) || (y >= this->screenHeight)) return;
+	int end = min(x + len, this->screenWidth);
+	x = max(x, 0);
+	if (x >= end) return;
+	setBits(&this->dirty[y * this->dirtyStride], x, end, true);
+	return;
+}
+
+void BaseConsole::markAllDirty()
+{
+	for (int y = 0; y < this->screenHeight; y++) {
+		setBits(&this->dirty[y * this->dirtyStride], 0, this->screenWidth, true);
+	}
+	return;
+}
+
+void BaseConsole::clearDirty(int x, int y, int len)
+{
+	if ((y < 0) || (y >= this->screenHeight)) return;
+	int end = min(x + len, this->screenWidth);
+	x = max(x, 0);
+	if (x >= end) return;
+	setBits(&this->dirty[y * this->dirtyStride], x, end, false);
+	return;
+}
+
+void BaseConsole::clearAllDirty()
+{
+	std::fill(this->dirty.begin(), this->dirty.end(), 0);
+	return;
+}
+
+bool BaseConsole::dirtyExtent(int y, int *start, int *end) const
+{
+	const uint64_t *row = &this->dirty[y * this->dirtyStride];
+	int first = 0;
+	while ((first < this->dirtyStride) && !row[first]) first++;
+	if (first == this->dirtyStride) return false;
+	int last = this->dirtyStride - 1;
+	while (!row[last]) last--;
+
+	*start = first * 64 + __builtin_ctzll(row[first]);
+	*end = last * 64 + 64 - __builtin_clzll(row[last]);
+	return true;
+}
+
+void BaseConsole::getDamage(int startY, int endY, std::vector<Rect> *rects)
+	const
+{
+	int rectTop = -1, rectLeft = 0, rectRight = 0;
+	for (int y = startY; y < endY; y++) {
+		int left, right;
+		if (this->dirtyExtent(y, &left, &right)) {
+			if (rectTop < 0) {
+				rectTop = y;
+				rectLeft = left;
+				rectRight = right;
+			} else {
+				rectLeft = min(rectLeft, left);
+				rectRight = max(rectRight, right);
+			}
+		} else if (rectTop >= 0) {
+			rects->push_back({rectLeft, rectTop, rectRight - rectLeft, y - rectTop});
+			rectTop = -1;
+		}
+	}
+	if (rectTop >= 0) {
+		rects->push_back({rectLeft, rectTop, rectRight - rectLeft, endY - rectTop});
+	}
+	return;
+}
+
+unsigned int BaseConsole::writeText(int x, int y, const std::string& strContent,
+	const AttrRuns *runs)
+{
+	if ((y < 0) || (y >= this->screenHeight)) return 0;
+	if ((x < 0) || (x >= this->screenWidth)) return 0;
+
+	unsigned int len = strContent.length();
+	if (len > (unsigned int)(this->screenWidth - x)) len = this->screenWidth - x;
+	uint8_t normal = this->rowAttr(y);
+	Cell *c = &this->cells[y * this->screenWidth + x];
+	const char *text = strContent.data();
+	unsigned int i = 0;
+	if (runs) {
+		for (AttrRuns::const_iterator r = runs->begin(); (r != runs->end()) && (i < len); r++) {
+			unsigned int end = min(i + r->len, len);
+			for (; i < end; i++) {
+				Cell n = {(uint8_t)text[i], r->attr};
+				if (c[i] != n) {
+					c[i] = n;
+					this->markDirty(x + i, y, 1);
+				}
+			}
+		}
+	}
+	for (; i < len; i++) {
+		Cell n = {(uint8_t)text[i], normal};
+		if (c[i] != n) {
+			c[i] = n;
+			this->markDirty(x + i, y, 1);
+		}
+	}
+	return len;
+}
+
+void BaseConsole::blankCells(int x, int y, int len)
+{
+	if ((y < 0) || (y >= this->screenHeight)) return;
+	int end = min(x + len, this->screenWidth);
+	x = max(x, 0);
+	Cell blank = {0, this->rowAttr(y)};
+	Cell *c = &this->cells[y * this->screenWidth];
+	for (; x < end; x++) {
+		if (c[x] != blank) {
+			c[x] = blank;
+			this->markDirty(x, y, 1);
+		}
+	}
+	return;
+}
+
+bool BaseConsole::scrollGrid(int iY, int *from, int *to, int *rows)
+{
+	if (iY == 0) return false;
+	int contentHeight = this->screenHeight - 2;
+	*rows = contentHeight - abs(iY); // rows that stay on the screen
+	int sw = this->screenWidth;
+	Cell blank = {0, ATTR_CONTENT};
+	if (*rows <= 0) {
+		std::fill(this->cells.begin() + sw,
+			this->cells.begin() + (1 + contentHeight) * sw, blank);
+		for (int y = 1; y <= contentHeight; y++) this->markDirty(0, y, sw);
+		return false;
+	}
+
+	// Screen rows, including the top status bar
+	if (iY < 0) {
+		*from = 1;
+		*to = 1 - iY;
+	} else {
+		*from = 1 + iY;
+		*to = 1;
+	}
+	memmove(&this->cells[*to * sw], &this->cells[*from * sw],
+		*rows * sw * sizeof(Cell));
+	// Cells not drawn yet still need drawing in their new place
+	memmove(&this->dirty[*to * this->dirtyStride],
+		&this->dirty[*from * this->dirtyStride],
+		*rows * this->dirtyStride * sizeof(uint64_t));
+
+	// Rows scrolled onto the screen
+	int newRow = (iY < 0) ? 1 : 1 + *rows;
+	std::fill(this->cells.begin() + newRow * sw,
+		this->cells.begin() + (newRow + abs(iY)) * sw, blank);
+	for (int y = newRow; y < newRow + abs(iY); y++) this->markDirty(0, y, sw);
+	return true;
+}
@@ -22,10 +22,30 @@
 #define BASECONSOLE_HPP_
 
 #include <stdint.h>
+#include <chrono>
+#include <vector>
 #include "IConsole.hpp"
 #include "IView.hpp"
+#include "Stats.hpp"
+
+/// How often to call IView::idle() while no keys are pressed, in milliseconds.
+#define IDLE_INTERVAL 250
 
 /// Shared console functions.
+/**
+ * The screen, including both status bars, is kept here as a grid of cells
+ * along with a bitmap of which cells have changed since the console last
+ * drew them.  The drawing functions all work on the grid, so a console only
+ * has to send the damaged parts of it to the display in drawChanges().
+ *
+ * Cells are only marked as changed when their content actually changes, so
+ * a view redrawing a line with the same text costs nothing to display.
+ *
+ * When keys arrive faster than the screen can be drawn (e.g. a key held
+ * down) the consoles pass them to the view with processQueuedKey(), which
+ * only draws once the last key waiting has been handled.  Scrolling done in
+ * the meantime is added up and carried out on the display as one scroll.
+ */
 class BaseConsole: virtual public IConsole
 {
 	public:
@@ -46,7 +66,229 @@ class BaseConsole: virtual public IConsole
 		 */
 		bool processKey(Key c);
 
+		/// Call the view's idle() function, unless text is being entered.
+		void idle();
+
+		/// Draw the changes, unless more keys are waiting to be processed.
+		void update(void);
+
+		/// Default for consoles that can only show text.
+		uint32_t *getFramebuffer(int *iWidth, int *iHeight, int *iStride);
+		void updateFramebuffer();
+		void releaseFramebuffer();
+
+		void clearStatusBar(SB_Y eY);
+		void setStatusBar(SB_Y eY, SB_X eX, const std::string& strMessage,
+			int cursor);
+		void gotoxy(int x, int y);
+		void putstr(const std::string& strContent);
+		void putstr(const std::string& strContent, const AttrRuns& runs);
+		void getContentDims(int *iWidth, int *iHeight);
+		void scrollContent(int iX, int iY);
+		void eraseToEOL(void);
+		void cursor(bool visible);
+
 	protected:
+		/// Send the changed cells to the display.
+		/**
+		 * This is update() for each console, called once the key queue is empty.
+		 * It should carry out any scrolling from takeScroll() first.
+		 */
+		virtual void drawChanges() = 0;
+
+		/// Pass a key to the view, with any redraw held back if more are waiting.
+		/**
+		 * @param c
+		 *   Key to process.
+		 *
+		 * @param more
+		 *   true if more keys are already waiting, so the screen doesn't need to
+		 *   be drawn until they have been processed too.  If false, anything held
+		 *   back by earlier keys is drawn.
+		 *
+		 * @return false if the view wants to exit, as for processKey().
+		 */
+		bool processQueuedKey(Key c, bool more);
+
+		/// Call drawChanges(), timing it for the stats.
+		/**
+		 * If this finishes drawing the result of a key, the stats for the whole
+		 * frame are recorded as well.
+		 */
+		void drawFrame();
+
+		/// Draw anything held back by processQueuedKey().
+		/**
+		 * Consoles call this when they find no more keys waiting, in case the
+		 * input that was thought to be waiting didn't turn into a key.
+		 */
+		void flushUpdate();
+
+		/// Get the number of rows scrolled since the last call, and reset it.
+		/**
+		 * The content of the grid has already been moved, this is how far the
+		 * display needs to move to match.
+		 *
+		 * @return Rows scrolled as for scrollContent(), or 0 if there is nothing
+		 *   on the display that could be moved (e.g. everything has scrolled
+		 *   off the screen.)
+		 */
+		int takeScroll();
+
+		/// One character on the screen.
+		struct Cell {
+			uint8_t ch;   ///< Code page 437 character
+			uint8_t attr; ///< ATTR_CONTENT, etc.
+
+			inline bool operator== (const Cell& b) const
+			{
+				return (this->ch == b.ch) && (this->attr == b.attr);
+			}
+			inline bool operator!= (const Cell& b) const
+			{
+				return !(*this == b);
+			}
+		};
+
+		/// Block of cells that needs to be drawn.
+		struct Rect {
+			int x;      ///< Left-most cell
+			int y;      ///< Top-most row
+			int width;  ///< Number of cells across
+			int height; ///< Number of rows
+		};
+
+		/// Change the size of the grid.
+		/**
+		 * The content is blanked and every cell is marked as changed.
+		 */
+		void resizeGrid(int width, int height);
+
+		/// Mark cells as needing to be drawn.
+		/**
+		 * Cells past the edge of the screen are ignored.
+		 *
+		 * @param x
+		 *   First cell.
+		 *
+		 * @param y
+		 *   Row of the cells, 0 is the top status bar.
+		 *
+		 * @param len
+		 *   Number of cells.
+		 */
+		void markDirty(int x, int y, int len);
+
+		/// Mark every cell as needing to be drawn.
+		void markAllDirty();
+
+		/// Mark cells as drawn.
+		void clearDirty(int x, int y, int len);
+
+		/// Mark every cell as drawn.
+		void clearAllDirty();
+
+		/// Does this cell need drawing?
+		inline bool isDirty(int x, int y) const
+		{
+			return (this->dirty[y * this->dirtyStride + (x >> 6)] >> (x & 63)) & 1;
+		}
+
+		/// Find the changed cells in a row.
+		/**
+		 * @param y
+		 *   Row to check.
+		 *
+		 * @param start
+		 *   On return, the first changed cell.
+		 *
+		 * @param end
+		 *   On return, one past the last changed cell.
+		 *
+		 * @return true if the row has changes, false if not (and start/end are
+		 *   not set.)
+		 */
+		bool dirtyExtent(int y, int *start, int *end) const;
+
+		/// Group the changed cells into rectangles.
+		/**
+		 * Consecutive rows with changes are merged into one rectangle as wide as
+		 * the widest of them, so each rectangle can be sent to the display in
+		 * one go.  Unchanged cells inside a rectangle will be included.
+		 *
+		 * @param startY
+		 *   First row to look at.
+		 *
+		 * @param endY
+		 *   Look at rows up to, but not including, this one.
+		 *
+		 * @param rects
+		 *   Rectangles are added to the end of this list.
+		 */
+		void getDamage(int startY, int endY, std::vector<Rect> *rects) const;
+
+		/// Write text at the given location.
+		/**
+		 * This writes anywhere on the screen, including on the status bars.
+		 *
+		 * @note The text will not overlap onto the next line.
+		 *
+		 * @param runs
+		 *   Colours for the text, or NULL to use the normal colour for the row.
+		 *
+		 * @return The number of characters written, less than the length of the
+		 *   text if it would've run past the end of the line.
+		 */
+		unsigned int writeText(int x, int y, const std::string& strContent,
+			const AttrRuns *runs = NULL);
+
+		/// Blank out cells, as for eraseToEOL().
+		void blankCells(int x, int y, int len);
+
+		/// Move the grid for scrollContent().
+		/**
+		 * The cells and their changed flags are moved, and the rows scrolled onto
+		 * the screen are blanked.
+		 *
+		 * @param iY
+		 *   Number of rows to scroll, as for scrollContent().
+		 *
+		 * @param from
+		 *   On return, the first screen row that was moved.
+		 *
+		 * @param to
+		 *   On return, where the first row was moved to.
+		 *
+		 * @param rows
+		 *   On return, the number of rows that were moved.
+		 *
+		 * @return true if rows were moved, false if the whole content area was
+		 *   blanked instead (or nothing happened.)
+		 */
+		bool scrollGrid(int iY, int *from, int *to, int *rows);
+
+		/// Attribute for blank cells in the given row.
+		inline uint8_t rowAttr(int y) const
+		{
+			return ((y == 0) || (y == this->screenHeight - 1))
+				? ATTR_STATUSBAR : ATTR_CONTENT;
+		}
+
+		int screenWidth;              ///< Width of the screen in cells
+		int screenHeight;             ///< Height of the screen, including status bars
+		std::vector<Cell> cells;      ///< Screen content
+		std::vector<uint64_t> dirty;  ///< One bit per cell, set if it has changed
+		int dirtyStride;              ///< Number of words in dirty for each row
+		int cursorX;                  ///< Where text is written, and the cursor shown
+		int cursorY;                  ///< Row of cursorX, 0 is the top status bar
+		bool cursorVisible;           ///< Show the text cursor?
+		int pendingScroll;            ///< Rows scrolled since last drawn
+		bool holdUpdates;             ///< More keys waiting, don't draw yet
+		bool updateHeld;              ///< update() called while holdUpdates set
+		bool frameOpen;               ///< A key has been handled but not drawn yet
+		std::chrono::steady_clock::time_point frameStart; ///< When frameOpen was set
+		Stats::Frame frameBase;       ///< Totals when frameOpen was set
+
 		ViewVector views;             ///< Views in use
 		IViewPtr view;                ///< Currently active view (not yet in \ref views)
 		IViewPtr nextView;            ///< If non-NULL, next view to replace \ref view
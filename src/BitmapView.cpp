@@ -0,0 +1,464 @@
+/**
+ * @file   BitmapView.cpp
+ * @brief  IView implementation for showing raw data as an image.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sstream>
+#include <stdlib.h>
+#include <string.h>
+#include "BitmapView.hpp"
+#include "HelpView.hpp"
+#include "Stats.hpp"
+#include "cfg.hpp"
+
+#define min(x, y) (((x) < (y)) ? (x) : (y))
+#define max(x, y) (((x) > (y)) ? (x) : (y))
+
+/// Widest image that can be shown, in pixels.
+#define BITMAP_MAX_WIDTH 16384
+
+/// Largest zoom factor.
+#define BITMAP_MAX_ZOOM 16
+
+/// Colour drawn where there is no image data.
+#define BITMAP_BACKGROUND 0x303030
+
+/// Supported bit depths, in the order they are cycled through.
+static const int bitDepths[] = {1, 2, 4, 8, 15, 16, 24, 32};
+
+/// Number of entries in bitDepths.
+#define NUM_BIT_DEPTHS (sizeof(bitDepths) / sizeof(bitDepths[0]))
+
+/// Standard 16-colour EGA palette.
+static const uint32_t egaPalette[] = {
+	0x000000, 0x0000AA, 0x00AA00, 0x00AAAA, 0xAA0000, 0xAA00AA, 0xAA5500, 0xAAAAAA,
+	0x555555, 0x5555FF, 0x55FF55, 0x55FFFF, 0xFF5555, 0xFF55FF, 0xFFFF55, 0xFFFFFF,
+};
+
+/// Expand a 5-bit colour component to 8 bits.
+#define EXPAND5(x) (((x) << 3) | ((x) >> 2))
+
+/// Expand a 6-bit colour component to 8 bits.
+#define EXPAND6(x) (((x) << 2) | ((x) >> 4))
+
+BitmapView::BitmapView(const FileView& parent)
+	:	FileView(parent),
+		imageWidth(320),
+		bpp(8),
+		paletteType(Greyscale),
+		lsbFirst(false),
+		swapRB(false),
+		zoom(1),
+		visibleRows(0),
+		filePaletteLoaded(false)
+{
+	// Start at the byte containing the first cell in the parent view
+	this->iOffset = (this->iOffset * this->bitWidth + this->intraByteOffset) >> 3;
+	this->bitWidth = 8;
+	this->intraByteOffset = 0;
+	this->updatePalette();
+}
+
+BitmapView::~BitmapView()
+{
+}
+
+void BitmapView::init()
+{
+	this->FileView::init();
+	// Don't nag about read-only files, nothing can be edited here anyway
+	this->statusAlert(NULL);
+	return;
+}
+
+bool BitmapView::processKey(Key c)
+{
+	// Hide any active status message on any keypress
+	this->statusAlert(NULL);
+
+	unsigned long iRowBytes = this->rowBytes();
+	bool changed = true;
+	switch (c) {
+		case Key_None: // ignore
+			return true;
+		case Key_Esc:
+		case Key_F10:
+		case 'q':
+		case ALT('b'):
+			// Go back to the view we were opened from
+			this->hideImage();
+			this->pConsole->popView();
+			return true;
+
+		case Key_Up: this->scrollRel(-(camoto::stream::delta)iRowBytes); break;
+		case Key_Down: this->scrollRel(iRowBytes); break;
+		case Key_Left: this->scrollRel(-1); break;
+		case Key_Right: this->scrollRel(1); break;
+		case Key_PageUp:
+			this->scrollRel(-(camoto::stream::delta)(iRowBytes * this->visibleRows));
+			break;
+		case Key_PageDown:
+			this->scrollRel(iRowBytes * this->visibleRows);
+			break;
+		case Key_Home: this->scrollRel(-(camoto::stream::delta)this->iOffset); break;
+		case Key_End: {
+			camoto::stream::pos screen = iRowBytes * this->visibleRows;
+			camoto::stream::pos target = 0;
+			if (this->iFileSize > screen) target = this->iFileSize - screen;
+			this->scrollRel(target - this->iOffset);
+			break;
+		}
+
+		case '-': this->setImageWidth(this->imageWidth - 1); break;
+		case '+': this->setImageWidth(this->imageWidth + 1); break;
+		case '<': this->setImageWidth(this->imageWidth / 2); break;
+		case '>': this->setImageWidth(this->imageWidth * 2); break;
+		case 'b':
+		case 'B': {
+			unsigned int i;
+			for (i = 0; i < NUM_BIT_DEPTHS; i++) {
+				if (bitDepths[i] == this->bpp) break;
+			}
+			if (c == 'B') i = (i + 1) % NUM_BIT_DEPTHS;
+			else i = (i + NUM_BIT_DEPTHS - 1) % NUM_BIT_DEPTHS;
+			this->bpp = bitDepths[i];
+			this->updatePalette();
+			break;
+		}
+		case 'p':
+			switch (this->paletteType) {
+				case Greyscale: this->paletteType = EGA; break;
+				case EGA:
+					if (this->filePaletteLoaded) this->paletteType = FromFile;
+					else this->paletteType = Greyscale;
+					break;
+				case FromFile: this->paletteType = Greyscale; break;
+			}
+			this->updatePalette();
+			break;
+		case 'P': this->loadPalette(); break;
+		case 'o': this->lsbFirst = !this->lsbFirst; break;
+		case 'r': this->swapRB = !this->swapRB; break;
+		case 'z': if (this->zoom > 1) this->zoom--; break;
+		case 'Z': if (this->zoom < BITMAP_MAX_ZOOM) this->zoom++; break;
+		case 'g': this->gotoOffset(); break;
+
+		case CTRL('L'): break;
+		case Key_F1: {
+			this->hideImage();
+			IViewPtr newView(new HelpView(this->pConsole));
+			this->pConsole->pushView(newView);
+			return true;
+		}
+		default: changed = false; break;
+	}
+
+	if (changed) this->redrawScreen();
+	this->pConsole->update();
+	return true; // true == keep going (don't quit)
+}
+
+void BitmapView::redrawScreen()
+{
+	Stats::Timer timer(Stats::Phase_Format);
+	int fbWidth, fbHeight, fbStride;
+	uint32_t *fb = this->pConsole->getFramebuffer(&fbWidth, &fbHeight, &fbStride);
+	if (!fb) {
+		this->statusAlert("This display cannot show images");
+		return;
+	}
+
+	unsigned long iRowBytes = this->rowBytes();
+	this->visibleRows = (fbHeight + this->zoom - 1) / this->zoom;
+	unsigned long lenWanted = iRowBytes * this->visibleRows;
+
+	const uint8_t *pRows;
+	camoto::stream::len lenRead = 0;
+	if (this->map) {
+		// Decode straight from the mapped file
+		if (this->iOffset < this->iFileSize) {
+			lenRead = min(lenWanted, this->iFileSize - this->iOffset);
+		}
+		pRows = this->map->getData() + this->iOffset;
+	} else {
+		// Read all the visible rows at once
+		this->rowData.resize(lenWanted);
+		if (this->iOffset < this->iFileSize) {
+			this->data->seekg(this->iOffset, camoto::stream::start);
+			lenRead = this->data->try_read(&this->rowData[0], lenWanted);
+		}
+		pRows = &this->rowData[0];
+	}
+
+	// Number of pixels in the image that are on the screen
+	int cols = min(this->imageWidth, (fbWidth + this->zoom - 1) / this->zoom);
+	int validRows = lenRead / iRowBytes;
+	int partialPixels = ((lenRead % iRowBytes) * 8) / this->bpp;
+
+	this->rowPixels.resize(this->imageWidth);
+	uint32_t *pOut = fb;
+	for (int y = 0; y < fbHeight; y++, pOut += fbStride) {
+		int row = y / this->zoom;
+		if ((y % this->zoom) != 0) {
+			// Repeated line from zooming, copy the one above
+			memcpy(pOut, pOut - fbStride, fbWidth * sizeof(uint32_t));
+			continue;
+		}
+
+		int rowCols = 0;
+		if (row < validRows) rowCols = cols;
+		else if (row == validRows) rowCols = min(cols, partialPixels);
+
+		int x = 0;
+		if (rowCols > 0) {
+			const uint8_t *pIn = pRows + row * iRowBytes;
+			if (row == validRows) {
+				// Pad the partial row at the end, so it can be decoded like the others
+				this->lastRow.assign(iRowBytes, 0);
+				memcpy(&this->lastRow[0], pIn, lenRead % iRowBytes);
+				pIn = &this->lastRow[0];
+			}
+			Stats::Timer decode(Stats::Phase_Decode);
+			this->decodeRow(pIn, &this->rowPixels[0], rowCols);
+			decode.stop();
+			const uint32_t *pPixel = &this->rowPixels[0];
+			if (this->zoom == 1) {
+				memcpy(pOut, pPixel, rowCols * sizeof(uint32_t));
+				x = rowCols;
+			} else {
+				for (int i = 0; i < rowCols; i++) {
+					uint32_t p = pPixel[i];
+					for (int z = 0; (z < this->zoom) && (x < fbWidth); z++) pOut[x++] = p;
+				}
+			}
+		}
+		for (; x < fbWidth; x++) pOut[x] = BITMAP_BACKGROUND;
+	}
+
+	Stats::Timer output(Stats::Phase_Output);
+	this->pConsole->updateFramebuffer();
+	output.stop();
+	this->updateHeader();
+	return;
+}
+
+void BitmapView::generateHeader(std::ostringstream& ss)
+{
+	ss << "   Offset: " << this->iOffset
+		<< "  Width: " << this->imageWidth
+		<< "  " << this->bpp << "bpp";
+	if (this->bpp <= 8) {
+		switch (this->paletteType) {
+			case Greyscale: ss << " grey"; break;
+			case EGA: ss << " EGA"; break;
+			case FromFile: ss << " file pal"; break;
+		}
+		if (this->bpp < 8) ss << (this->lsbFirst ? " LSB" : " MSB");
+	} else {
+		ss << (this->swapRB ? " BGR" : " RGB");
+	}
+	ss << "  Zoom: " << this->zoom << 'x';
+	return;
+}
+
+void BitmapView::scrollRel(camoto::stream::delta iDelta)
+{
+	if ((iDelta < 0) && ((camoto::stream::pos)-iDelta > this->iOffset)) {
+		this->statusAlert("Top of file");
+		iDelta = -(camoto::stream::delta)this->iOffset;
+	} else if ((iDelta > 0) && (this->iOffset + iDelta >= this->iFileSize)) {
+		this->statusAlert("End of file");
+		if (this->iFileSize == 0) iDelta = 0;
+		else iDelta = this->iFileSize - 1 - this->iOffset;
+	}
+	this->iOffset += iDelta;
+	return;
+}
+
+void BitmapView::setImageWidth(int newWidth)
+{
+	if (newWidth < 1) newWidth = 1;
+	if (newWidth > BITMAP_MAX_WIDTH) newWidth = BITMAP_MAX_WIDTH;
+	this->imageWidth = newWidth;
+	return;
+}
+
+void BitmapView::decodeRow(const uint8_t *pIn, uint32_t *pOut, int width)
+{
+	switch (this->bpp) {
+		case 1:
+		case 2:
+		case 4: {
+			int mask = (1 << this->bpp) - 1;
+			int perByte = 8 / this->bpp;
+			for (int x = 0; x < width; pIn++) {
+				unsigned int b = *pIn;
+				for (int i = 0; (i < perByte) && (x < width); i++, x++) {
+					int shift;
+					if (this->lsbFirst) shift = i * this->bpp;
+					else shift = 8 - this->bpp - i * this->bpp;
+					*pOut++ = this->palette[(b >> shift) & mask];
+				}
+			}
+			break;
+		}
+		case 8:
+			for (int x = 0; x < width; x++) *pOut++ = this->palette[*pIn++];
+			break;
+		case 15:
+		case 16:
+			for (int x = 0; x < width; x++, pIn += 2) {
+				unsigned int v = pIn[0] | (pIn[1] << 8);
+				unsigned int r, g, b;
+				if (this->bpp == 15) {
+					r = EXPAND5((v >> 10) & 0x1F);
+					g = EXPAND5((v >> 5) & 0x1F);
+				} else {
+					r = EXPAND5((v >> 11) & 0x1F);
+					g = EXPAND6((v >> 5) & 0x3F);
+				}
+				b = EXPAND5(v & 0x1F);
+				if (this->swapRB) *pOut++ = (b << 16) | (g << 8) | r;
+				else *pOut++ = (r << 16) | (g << 8) | b;
+			}
+			break;
+		case 24:
+			for (int x = 0; x < width; x++, pIn += 3) {
+				if (this->swapRB) *pOut++ = (pIn[2] << 16) | (pIn[1] << 8) | pIn[0];
+				else *pOut++ = (pIn[0] << 16) | (pIn[1] << 8) | pIn[2];
+			}
+			break;
+		case 32:
+			// Little-endian 0xAARRGGBB, alpha is ignored
+			for (int x = 0; x < width; x++, pIn += 4) {
+				if (this->swapRB) *pOut++ = (pIn[0] << 16) | (pIn[1] << 8) | pIn[2];
+				else *pOut++ = (pIn[2] << 16) | (pIn[1] << 8) | pIn[0];
+			}
+			break;
+	}
+	return;
+}
+
+unsigned long BitmapView::rowBytes() const
+{
+	return ((unsigned long)this->imageWidth * this->bpp + 7) / 8;
+}
+
+void BitmapView::updatePalette()
+{
+	if (this->bpp > 8) return;
+	int colours = 1 << this->bpp;
+	switch (this->paletteType) {
+		case Greyscale:
+			for (int i = 0; i < colours; i++) {
+				unsigned int v = i * 255 / (colours - 1);
+				this->palette[i] = (v << 16) | (v << 8) | v;
+			}
+			break;
+		case EGA: {
+			for (int i = 0; i < 16; i++) this->palette[i] = egaPalette[i];
+			// Fill the rest of the 8-bit palette with a grey ramp and a 6x6x6 colour
+			// cube, so there is something to tell the values apart.
+			for (int i = 0; i < 16; i++) {
+				unsigned int v = i * 17;
+				this->palette[16 + i] = (v << 16) | (v << 8) | v;
+			}
+			for (int i = 0; i < 216; i++) {
+				unsigned int r = (i / 36) * 51, g = ((i / 6) % 6) * 51, b = (i % 6) * 51;
+				this->palette[32 + i] = (r << 16) | (g << 8) | b;
+			}
+			for (int i = 248; i < 256; i++) this->palette[i] = 0;
+			break;
+		}
+		case FromFile:
+			memcpy(this->palette, this->filePalette, sizeof(this->palette));
+			break;
+	}
+	return;
+}
+
+void BitmapView::loadPalette()
+{
+	uint8_t raw[256 * 3];
+	camoto::stream::len lenRead = 0;
+	if (this->iOffset < this->iFileSize) {
+		this->data->seekg(this->iOffset, camoto::stream::start);
+		lenRead = this->data->try_read(raw, sizeof(raw));
+	}
+	if (lenRead < sizeof(raw)) {
+		this->statusAlert("Not enough data for a 256-colour palette");
+		return;
+	}
+
+	bool sixBit = true;
+	for (unsigned int i = 0; i < sizeof(raw); i++) {
+		if (raw[i] > 63) {
+			sixBit = false;
+			break;
+		}
+	}
+	for (int i = 0; i < 256; i++) {
+		unsigned int r = raw[i * 3], g = raw[i * 3 + 1], b = raw[i * 3 + 2];
+		if (sixBit) {
+			r = EXPAND6(r);
+			g = EXPAND6(g);
+			b = EXPAND6(b);
+		}
+		this->filePalette[i] = (r << 16) | (g << 8) | b;
+	}
+	this->filePaletteLoaded = true;
+	this->paletteType = FromFile;
+	this->updatePalette();
+	this->statusAlert(sixBit ? "Loaded 6-bit VGA palette" : "Loaded 8-bit palette");
+	return;
+}
+
+void BitmapView::hideImage()
+{
+	this->pConsole->releaseFramebuffer();
+	return;
+}
+
+void BitmapView::gotoOffset()
+{
+	std::string val = this->pConsole->getString("Offset", 15);
+
+	// Reset status bar to hide prompt
+	this->bStatusAlertVisible = true;
+	this->statusAlert(NULL);
+
+	if (val.length() > 0) {
+		// Get value and scroll if ok
+		const char *nptr = val.c_str();
+		char *endptr;
+		bool relative = (*nptr == '+') || (*nptr == '-');
+		long off = strtol(nptr, &endptr, 0);
+		if (
+			(endptr != nptr) &&  // if text was entered, and
+			(*endptr  == '\0')   // it was all valid
+		) {
+			// Perform the jump
+			if (relative) {
+				this->scrollRel(off);
+			} else {
+				this->scrollRel(off - (camoto::stream::delta)this->iOffset);
+			}
+		}
+	}
+	return;
+}
@@ -0,0 +1,118 @@
+/**
+ * @file   BitmapView.hpp
+ * @brief  IView implementation for showing raw data as an image.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BITMAPVIEW_HPP_
+#define BITMAPVIEW_HPP_
+
+#include <vector>
+#include "FileView.hpp"
+
+/// Bitmap view.
+/**
+ * Shows the data as pixels, to help find images in files of unknown format.
+ * This needs a console that can draw pixels (see IConsole::getFramebuffer()),
+ * so it is only available under X11.
+ */
+class BitmapView: public FileView
+{
+	public:
+		/// Palettes used for 1, 2, 4 and 8 bits per pixel.
+		enum Palette {
+			Greyscale,  ///< Black to white
+			EGA,        ///< 16 EGA colours, then a grey ramp and a colour cube
+			FromFile,   ///< Loaded from the file with loadPalette()
+		};
+
+		/// Create a new bitmap view from an existing view.
+		/**
+		 * @param parent
+		 *   FileView instance from an existing view.  The image starts at the
+		 *   byte containing the seek location of this view.
+		 */
+		BitmapView(const FileView& parent);
+
+		~BitmapView();
+
+		virtual void init();
+		bool processKey(Key c);
+		void redrawScreen();
+		void generateHeader(std::ostringstream& ss);
+
+		/// Scroll by this many bytes, keeping the offset within the file.
+		void scrollRel(camoto::stream::delta iDelta);
+
+		/// Change the image width, keeping it within range.
+		void setImageWidth(int newWidth);
+
+		/// Decode one row of pixels.
+		/**
+		 * @param pIn
+		 *   Data for the row.
+		 *
+		 * @param pOut
+		 *   Destination for the decoded pixels.
+		 *
+		 * @param width
+		 *   Number of pixels to decode, from the start of the row.
+		 */
+		void decodeRow(const uint8_t *pIn, uint32_t *pOut, int width);
+
+		/// Number of bytes in each row of the image.
+		/**
+		 * Rows always start on a byte boundary, even if the last pixel in the
+		 * row does not fill its byte.
+		 */
+		unsigned long rowBytes() const;
+
+		/// Regenerate this->palette for the current palette type and bit depth.
+		void updatePalette();
+
+		/// Use the 256 RGB values at the current offset as the palette.
+		/**
+		 * If all the values are 63 or less, they are assumed to be 6-bit VGA DAC
+		 * values and are scaled up to 8-bit.
+		 */
+		void loadPalette();
+
+		/// Hide the image so the next view can draw text.
+		void hideImage();
+
+		/// Prompt the user for an offset, then jump there.
+		void gotoOffset();
+
+	protected:
+		int imageWidth;              ///< Width of the image in pixels
+		int bpp;                     ///< Bits per pixel
+		Palette paletteType;         ///< Which palette to use for <= 8 bpp
+		bool lsbFirst;               ///< For < 8 bpp, first pixel is in the lowest bits
+		bool swapRB;                 ///< For > 8 bpp, swap the red and blue channels
+		int zoom;                    ///< Each image pixel is drawn as zoom*zoom pixels
+		int visibleRows;             ///< Number of image rows that fit on the screen
+
+		uint32_t palette[256];       ///< Current palette as 0x00RRGGBB
+		uint32_t filePalette[256];   ///< Palette loaded by loadPalette()
+		bool filePaletteLoaded;      ///< true once filePalette is valid
+
+		std::vector<uint8_t> rowData;    ///< Raw data for the visible rows, if not mapped
+		std::vector<uint8_t> lastRow;    ///< Partial row at the end of the data
+		std::vector<uint32_t> rowPixels; ///< One decoded row, before zooming
+};
+
+#endif // BITMAPVIEW_HPP_
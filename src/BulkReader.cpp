@@ -0,0 +1,443 @@
+/**
+ * @file   BulkReader.cpp
+ * @brief  Fast sequential reading of large amounts of data.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <vector>
+#include <config.h>
+#include "BulkReader.hpp"
+#include "CachedStream.hpp"
+#include "MmapStream.hpp"
+#include "DeviceStream.hpp"
+#include "SpoolStream.hpp"
+#include "Stats.hpp"
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#endif
+
+#define min(x, y) (((x) < (y)) ? (x) : (y))
+#define max(x, y) (((x) > (y)) ? (x) : (y))
+
+/// Alignment of the read buffers, enough for O_DIRECT on any device.
+#define BULK_ALIGN 4096
+
+unsigned int BulkReader::depth = BULK_DEFAULT_DEPTH;
+
+/// Passed to the callback in place of data in a hole.
+static const uint8_t zeroChunk[BULK_CHUNK] = {};
+
+#ifdef HAVE_LINUX_IO_URING_H
+/// Rings shared with the kernel, and the buffers registered with it.
+struct UringState
+{
+	int fd;                        ///< io_uring instance
+	void *sqRing;                  ///< Submission queue ring mapping
+	size_t sqRingLen;              ///< Size of sqRing
+	void *cqRing;                  ///< Completion queue ring mapping
+	size_t cqRingLen;              ///< Size of cqRing, 0 if shared with sqRing
+	struct io_uring_sqe *sqes;     ///< Submission queue entries
+	size_t sqesLen;                ///< Size of sqes mapping
+	unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+	unsigned *cqHead, *cqTail, *cqMask;
+	struct io_uring_cqe *cqes;
+	bool fixed;                    ///< Buffers were registered (use READ_FIXED)
+	std::vector<struct iovec> iov; ///< One buffer per slot
+};
+#endif
+
+BulkReader::BulkReader(std::shared_ptr<camoto::stream::inout> data,
+	std::shared_ptr<HoleMap> holes)
+	:	data(data),
+		source(data),
+		holes(holes),
+		mem(NULL),
+		fd(-1),
+		align(1),
+		uring(NULL),
+		buffers(NULL),
+		slots(max(BulkReader::depth, 1))
+{
+	CachedStream *cache = dynamic_cast<CachedStream *>(data.get());
+	if (cache) this->source = cache->getParent();
+
+	MmapStream *map = dynamic_cast<MmapStream *>(this->source.get());
+	DeviceStream *dev = dynamic_cast<DeviceStream *>(this->source.get());
+	SpoolStream *spool = dynamic_cast<SpoolStream *>(this->source.get());
+	if (map) {
+		this->mem = map->getData();
+		return; // no buffers needed
+	} else if (dev) {
+		this->fd = dev->getFd();
+		this->align = dev->getSectorSize();
+	} else if (spool) {
+		this->fd = spool->getFd();
+	}
+
+	if (this->fd < 0) this->slots = 1; // reading through the stream
+	void *p;
+	if (posix_memalign(&p, max(BULK_ALIGN, this->align),
+		(size_t)this->slots * BULK_CHUNK) != 0
+	) {
+		throw camoto::stream::read_error("Out of memory");
+	}
+	this->buffers = (uint8_t *)p;
+
+	if ((this->fd >= 0) && (this->slots > 1)) this->openUring();
+}
+
+BulkReader::~BulkReader()
+{
+#ifdef HAVE_LINUX_IO_URING_H
+	if (this->uring) {
+		// Closing the ring also unregisters the buffers
+		::close(this->uring->fd);
+		munmap(this->uring->sqes, this->uring->sqesLen);
+		if (this->uring->cqRingLen) munmap(this->uring->cqRing, this->uring->cqRingLen);
+		munmap(this->uring->sqRing, this->uring->sqRingLen);
+		delete this->uring;
+	}
+#endif
+	free(this->buffers);
+}
+
+camoto::stream::pos BulkReader::scan(camoto::stream::pos start,
+	camoto::stream::pos end, Callback fn)
+{
+	end = min(end, this->data->size());
+	if (start >= end) return start;
+	if (!this->holes || this->holes->empty()) {
+		return this->scanData(start, end, fn);
+	}
+
+	// Only read the data extents, and make up the zeros in between
+	bool stopped = false;
+	Callback watch = [&](camoto::stream::pos offset, const uint8_t *data,
+		camoto::stream::len len)
+	{
+		if (fn(offset, data, len)) return true;
+		stopped = true;
+		return false;
+	};
+	camoto::stream::pos off = start;
+	while (off < end) {
+		camoto::stream::pos extStart, extEnd;
+		bool hole = this->holes->find(off, &extStart, &extEnd);
+		camoto::stream::pos stop = min(extEnd, end);
+		if (hole) {
+			while (off < stop) {
+				camoto::stream::len len = min(stop - off, (camoto::stream::len)BULK_CHUNK);
+				bool more = fn(off, zeroChunk, len);
+				off += len;
+				if (!more) return off;
+			}
+		} else {
+			off = this->scanData(off, stop, watch);
+			if (stopped || (off < stop)) break; // told to stop, or EOF
+		}
+	}
+	return off;
+}
+
+camoto::stream::pos BulkReader::scanData(camoto::stream::pos start,
+	camoto::stream::pos end, Callback fn)
+{
+	camoto::stream::pos off;
+	if (this->mem) off = this->scanMemory(start, end, fn);
+	else if (this->uring) off = this->scanUring(start, end, fn);
+	else if (this->fd >= 0) off = this->scanPread(start, end, fn);
+	else off = this->scanStream(start, end, fn);
+	::stats.bytesRead += off - start;
+	return off;
+}
+
+const char *BulkReader::getEngine() const
+{
+	if (this->mem) return "mmap";
+	if (this->uring) return "io_uring";
+	if (this->fd >= 0) return "pread";
+	return "stream";
+}
+
+camoto::stream::pos BulkReader::scanMemory(camoto::stream::pos start,
+	camoto::stream::pos end, Callback fn)
+{
+	// Still go in chunks, so the caller can stop part way without the kernel
+	// having paged in the whole file.
+	MmapStream *map = dynamic_cast<MmapStream *>(this->source.get());
+	map->advise(MmapStream::Sequential);
+	camoto::stream::pos off = start;
+	while (off < end) {
+		camoto::stream::len len = min(end - off, (camoto::stream::len)BULK_CHUNK);
+		bool more = fn(off, this->mem + off, len);
+		off += len;
+		if (!more) break;
+	}
+	map->advise(MmapStream::Random);
+	return off;
+}
+
+camoto::stream::pos BulkReader::scanPread(camoto::stream::pos start,
+	camoto::stream::pos end, Callback fn)
+{
+	camoto::stream::pos off = start;
+	while (off < end) {
+		// Reads must start on a sector boundary for devices opened with O_DIRECT
+		camoto::stream::pos at = off - (off % this->align);
+		Stats::Timer wait(Stats::Phase_IOWait);
+		ssize_t r = pread(this->fd, this->buffers, BULK_CHUNK, at);
+		wait.stop();
+		if (r < 0) {
+			if (errno == EINTR) continue;
+			throw camoto::stream::read_error(strerror(errno));
+		}
+		if (at + r <= off) break; // EOF
+		camoto::stream::pos last = min(at + r, end);
+		bool more = fn(off, this->buffers + (off - at), last - off);
+		off = last;
+		if (!more) break;
+	}
+	return off;
+}
+
+camoto::stream::pos BulkReader::scanStream(camoto::stream::pos start,
+	camoto::stream::pos end, Callback fn)
+{
+	CachedStream *cache = dynamic_cast<CachedStream *>(this->data.get());
+	camoto::stream::pos off = start;
+	while (off < end) {
+		camoto::stream::len want = min(end - off, (camoto::stream::len)BULK_CHUNK);
+		camoto::stream::len r;
+		Stats::Timer wait(Stats::Phase_IOWait);
+		if (cache) {
+			r = cache->readDirect(off, this->buffers, want);
+		} else {
+			this->data->seekg(off, camoto::stream::start);
+			r = this->data->try_read(this->buffers, want);
+		}
+		wait.stop();
+		if (r == 0) break;
+		bool more = fn(off, this->buffers, r);
+		off += r;
+		if (!more) break;
+	}
+	return off;
+}
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+void BulkReader::openUring()
+{
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	int rfd = syscall(__NR_io_uring_setup, this->slots, &params);
+	if (rfd < 0) return; // old kernel, or blocked (e.g. in a container)
+
+	UringState *u = new UringState();
+	u->fd = rfd;
+	u->sqRingLen = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	u->cqRingLen = params.cq_off.cqes
+		+ params.cq_entries * sizeof(struct io_uring_cqe);
+	bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+	if (single) {
+		u->sqRingLen = max(u->sqRingLen, u->cqRingLen);
+		u->cqRingLen = 0;
+	}
+	u->sqesLen = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	u->sqRing = mmap(NULL, u->sqRingLen, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, rfd, IORING_OFF_SQ_RING);
+	u->cqRing = single ? u->sqRing : mmap(NULL, u->cqRingLen,
+		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, rfd, IORING_OFF_CQ_RING);
+	void *sqes = mmap(NULL, u->sqesLen, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, rfd, IORING_OFF_SQES);
+	if ((u->sqRing == MAP_FAILED) || (u->cqRing == MAP_FAILED)
+		|| (sqes == MAP_FAILED)
+	) {
+		if (sqes != MAP_FAILED) munmap(sqes, u->sqesLen);
+		if (!single && (u->cqRing != MAP_FAILED)) munmap(u->cqRing, u->cqRingLen);
+		if (u->sqRing != MAP_FAILED) munmap(u->sqRing, u->sqRingLen);
+		::close(rfd);
+		delete u;
+		return;
+	}
+	u->sqes = (struct io_uring_sqe *)sqes;
+
+	uint8_t *sq = (uint8_t *)u->sqRing;
+	u->sqHead = (unsigned *)(sq + params.sq_off.head);
+	u->sqTail = (unsigned *)(sq + params.sq_off.tail);
+	u->sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+	u->sqArray = (unsigned *)(sq + params.sq_off.array);
+	uint8_t *cq = (uint8_t *)u->cqRing;
+	u->cqHead = (unsigned *)(cq + params.cq_off.head);
+	u->cqTail = (unsigned *)(cq + params.cq_off.tail);
+	u->cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+	u->iov.resize(this->slots);
+	for (unsigned int i = 0; i < this->slots; i++) {
+		u->iov[i].iov_base = this->buffers + (size_t)i * BULK_CHUNK;
+		u->iov[i].iov_len = BULK_CHUNK;
+	}
+	// Registered buffers save the kernel mapping them on every read, but
+	// count against the locked memory limit, so it's fine if this fails.
+	u->fixed = syscall(__NR_io_uring_register, rfd, IORING_REGISTER_BUFFERS,
+		&u->iov[0], this->slots) == 0;
+
+	this->uring = u;
+	return;
+}
+
+camoto::stream::pos BulkReader::scanUring(camoto::stream::pos start,
+	camoto::stream::pos end, Callback fn)
+{
+	UringState *u = this->uring;
+	camoto::stream::pos base = start - (start % this->align);
+	// Number of chunks in the range
+	unsigned long total = (end - base + BULK_CHUNK - 1) / BULK_CHUNK;
+
+	std::vector<int> result(this->slots);
+	std::vector<bool> done(this->slots);
+	unsigned long next = 0;      // next chunk to pass to fn
+	unsigned long queued = 0;    // chunks submitted so far
+	unsigned int inFlight = 0;
+	unsigned int toSubmit = 0;
+	bool failed = false;
+
+	// Queue a read of chunk n into slot n % slots.
+	auto submit = [&](unsigned long n) {
+		unsigned int slot = n % this->slots;
+		unsigned tail = *u->sqTail;
+		unsigned idx = tail & *u->sqMask;
+		struct io_uring_sqe *sqe = &u->sqes[idx];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->fd = this->fd;
+		sqe->off = base + (camoto::stream::pos)n * BULK_CHUNK;
+		if (u->fixed) {
+			sqe->opcode = IORING_OP_READ_FIXED;
+			sqe->addr = (unsigned long)u->iov[slot].iov_base;
+			sqe->len = BULK_CHUNK;
+			sqe->buf_index = slot;
+		} else {
+			sqe->opcode = IORING_OP_READV;
+			sqe->addr = (unsigned long)&u->iov[slot];
+			sqe->len = 1;
+		}
+		sqe->user_data = slot;
+		u->sqArray[idx] = idx;
+		__atomic_store_n(u->sqTail, tail + 1, __ATOMIC_RELEASE);
+		done[slot] = false;
+		toSubmit++;
+		inFlight++;
+	};
+
+	// Collect finished reads, waiting for at least one if wait is true.
+	auto reap = [&](bool wait) {
+		int r = syscall(__NR_io_uring_enter, u->fd, toSubmit, wait ? 1 : 0,
+			IORING_ENTER_GETEVENTS, NULL, 0);
+		if (r < 0) {
+			if (errno == EINTR) return;
+			throw camoto::stream::read_error(strerror(errno));
+		}
+		toSubmit -= min((unsigned int)r, toSubmit);
+		unsigned head = *u->cqHead;
+		while (head != __atomic_load_n(u->cqTail, __ATOMIC_ACQUIRE)) {
+			struct io_uring_cqe *cqe = &u->cqes[head & *u->cqMask];
+			unsigned int slot = cqe->user_data;
+			result[slot] = cqe->res;
+			done[slot] = true;
+			inFlight--;
+			head++;
+		}
+		__atomic_store_n(u->cqHead, head, __ATOMIC_RELEASE);
+	};
+
+	while ((queued < total) && (queued < this->slots)) submit(queued++);
+
+	camoto::stream::pos off = start;
+	try {
+		while (next < total) {
+			unsigned int slot = next % this->slots;
+			Stats::Timer wait(Stats::Phase_IOWait, !done[slot]);
+			while (!done[slot]) reap(true);
+			wait.stop();
+
+			int r = result[slot];
+			camoto::stream::pos chunkStart = base + (camoto::stream::pos)next * BULK_CHUNK;
+			if (r < 0) {
+				// Unsupported operation or I/O error.  Let pread carry on from here,
+				// which will report the error if there really is one.
+				failed = true;
+				break;
+			}
+			if ((r < BULK_CHUNK) && (chunkStart + r < end)) {
+				// Short read before the end, finish this chunk the slow way
+				failed = true;
+				break;
+			}
+			camoto::stream::pos first = max(chunkStart, start);
+			camoto::stream::pos last = min(chunkStart + r, end);
+			bool more = (last > first) ?
+				fn(first, (uint8_t *)u->iov[slot].iov_base + (first - chunkStart),
+					last - first)
+				: true;
+			off = max(off, last);
+			next++;
+			if (!more || (r == 0)) break;
+			if (queued < total) submit(queued++);
+		}
+		// Wait for anything still in flight, as the buffers are about to be
+		// reused.
+		while (inFlight) reap(true);
+	} catch (...) {
+		// Can't leave reads going into buffers we might free
+		while (inFlight) {
+			try {
+				reap(true);
+			} catch (...) {
+				break;
+			}
+		}
+		throw;
+	}
+
+	if (failed && (off < end)) return this->scanPread(off, end, fn);
+	return off;
+}
+
+#else // HAVE_LINUX_IO_URING_H
+
+void BulkReader::openUring()
+{
+	return;
+}
+
+camoto::stream::pos BulkReader::scanUring(camoto::stream::pos start,
+	camoto::stream::pos end, Callback fn)
+{
+	return this->scanPread(start, end, fn);
+}
+
+#endif // HAVE_LINUX_IO_URING_H
@@ -0,0 +1,139 @@
+/**
+ * @file   BulkReader.hpp
+ * @brief  Fast sequential reading of large amounts of data.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BULKREADER_HPP_
+#define BULKREADER_HPP_
+
+#include <stdint.h>
+#include <functional>
+#include <camoto/stream.hpp>
+#include "HoleMap.hpp"
+
+/// Size of each read, in bytes.  A multiple of any device's sector size.
+#define BULK_CHUNK (1 << 18)
+
+/// Default number of reads to have in flight at once.
+#define BULK_DEFAULT_DEPTH 8
+
+struct UringState;
+
+/// Reads through a range of data as quickly as possible, in order.
+/**
+ * This is for scans over a large part of the file (e.g. finding every line
+ * in the text view), where reading one block at a time leaves fast storage
+ * idle most of the time.
+ *
+ * Where the data comes from a file descriptor (block devices and spooled
+ * pipes) and io_uring is available, several reads are kept queued at once
+ * into buffers registered with the kernel.  Otherwise pread() is used, or
+ * the data is read straight out of memory if the file is mapped.  Anything
+ * else is read through the stream, bypassing the block cache so the scan
+ * doesn't push out what's on the screen.
+ *
+ * Holes in sparse files are never read, the callback is just given zeros.
+ */
+class BulkReader
+{
+	public:
+		/// Called with each chunk of data, in order.
+		/**
+		 * @param offset
+		 *   Offset of the first byte in data.
+		 *
+		 * @param data
+		 *   Content.  Only valid until the function returns.
+		 *
+		 * @param len
+		 *   Number of bytes in data.
+		 *
+		 * @return true to keep going, false to stop the scan.
+		 */
+		typedef std::function<bool(camoto::stream::pos offset,
+			const uint8_t *data, camoto::stream::len len)> Callback;
+
+		/// Prepare to read the given data.
+		/**
+		 * @param data
+		 *   Data to read, as passed to the views.
+		 *
+		 * @param holes
+		 *   Holes in data, or NULL if it isn't a sparse file.
+		 */
+		BulkReader(std::shared_ptr<camoto::stream::inout> data,
+			std::shared_ptr<HoleMap> holes = NULL);
+
+		~BulkReader();
+
+		/// Read a range of data.
+		/**
+		 * @param start
+		 *   First byte to read.
+		 *
+		 * @param end
+		 *   Stop at this offset, or at the end of the data if it comes first.
+		 *
+		 * @param fn
+		 *   Function to call with each chunk of data.
+		 *
+		 * @return Offset just after the last chunk passed to fn.
+		 *
+		 * @throw camoto::stream::read_error on I/O error.
+		 */
+		camoto::stream::pos scan(camoto::stream::pos start,
+			camoto::stream::pos end, Callback fn);
+
+		/// Name of the method being used to read the data, for display.
+		const char *getEngine() const;
+
+		/// Number of reads to queue at once with io_uring.
+		/**
+		 * Set from the command line.  Takes effect for readers created
+		 * afterwards.
+		 */
+		static unsigned int depth;
+
+	protected:
+		/// Read a range of data containing no holes.
+		camoto::stream::pos scanData(camoto::stream::pos start,
+			camoto::stream::pos end, Callback fn);
+		camoto::stream::pos scanMemory(camoto::stream::pos start,
+			camoto::stream::pos end, Callback fn);
+		camoto::stream::pos scanPread(camoto::stream::pos start,
+			camoto::stream::pos end, Callback fn);
+		camoto::stream::pos scanStream(camoto::stream::pos start,
+			camoto::stream::pos end, Callback fn);
+		camoto::stream::pos scanUring(camoto::stream::pos start,
+			camoto::stream::pos end, Callback fn);
+
+		/// Set up io_uring, leaving this->uring NULL if it's not available.
+		void openUring();
+
+		std::shared_ptr<camoto::stream::inout> data; ///< Stream as given
+		std::shared_ptr<camoto::stream::inout> source; ///< Stream under the cache
+		std::shared_ptr<HoleMap> holes; ///< Holes to skip, or NULL
+		const uint8_t *mem;            ///< Mapped data, or NULL
+		int fd;                        ///< File descriptor to read, or -1
+		unsigned int align;            ///< Required alignment of reads
+		UringState *uring;             ///< io_uring instance, or NULL
+		uint8_t *buffers;              ///< depth * BULK_CHUNK aligned bytes
+		unsigned int slots;            ///< Number of buffers allocated
+};
+
+#endif // BULKREADER_HPP_
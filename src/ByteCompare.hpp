@@ -0,0 +1,78 @@
+/**
+ * @file   ByteCompare.hpp
+ * @brief  Fast comparison of two blocks of memory.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BYTECOMPARE_HPP_
+#define BYTECOMPARE_HPP_
+
+#include <stdint.h>
+#include <string.h>
+#include <camoto/stream.hpp>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/// Count how many bytes at the start of a and b are the same.
+/**
+ * a and b may overlap, e.g. b = a + 1 finds the end of a run of one value.
+ * Compares 16 bytes at a time with SSE2 where available, otherwise a word at
+ * a time.
+ */
+inline camoto::stream::len sameLength(const uint8_t *a, const uint8_t *b,
+	camoto::stream::len len)
+{
+	camoto::stream::len i = 0;
+#ifdef __SSE2__
+	for (; i + 16 <= len; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+		unsigned int eq = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+		if (eq != 0xFFFF) return i + __builtin_ctz(~eq);
+	}
+#else
+	for (; i + 8 <= len; i += 8) {
+		uint64_t x, y;
+		memcpy(&x, a + i, 8);
+		memcpy(&y, b + i, 8);
+		if (x != y) break;
+	}
+#endif
+	while ((i < len) && (a[i] == b[i])) i++;
+	return i;
+}
+
+/// Count how many bytes at the start of a and b are different.
+inline camoto::stream::len diffLength(const uint8_t *a, const uint8_t *b,
+	camoto::stream::len len)
+{
+	camoto::stream::len i = 0;
+#ifdef __SSE2__
+	for (; i + 16 <= len; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+		unsigned int eq = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+		if (eq) return i + __builtin_ctz(eq);
+	}
+#endif
+	while ((i < len) && (a[i] != b[i])) i++;
+	return i;
+}
+
+#endif // BYTECOMPARE_HPP_
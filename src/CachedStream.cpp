@@ -0,0 +1,261 @@
+/**
+ * @file   CachedStream.cpp
+ * @brief  Stream keeping recently read blocks of its parent in memory.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "CachedStream.hpp"
+#include "Stats.hpp"
+
+#define min(x, y) (((x) < (y)) ? (x) : (y))
+#define max(x, y) (((x) > (y)) ? (x) : (y))
+
+CachedStream::CachedStream(std::shared_ptr<camoto::stream::inout> parent,
+	camoto::stream::len budget)
+	:	parent(parent),
+		offset(0),
+		length(parent->size()),
+		maxBlocks(max(budget / CACHE_BLOCK, 2)),
+		generation(0)
+{
+	memset(&this->stats, 0, sizeof(this->stats));
+}
+
+CachedStream::~CachedStream()
+{
+}
+
+camoto::stream::len CachedStream::try_read(uint8_t *buffer,
+	camoto::stream::len len)
+{
+	camoto::stream::len total = 0;
+	while ((len > 0) && (this->offset < this->length)) {
+		BlockPtr block = this->getBlock(this->offset / CACHE_BLOCK, true, NULL);
+		camoto::stream::len start = this->offset % CACHE_BLOCK;
+		if (start >= block->data.size()) break; // file shrank
+		camoto::stream::len amt = min(len, block->data.size() - start);
+		memcpy(buffer, &block->data[start], amt);
+		buffer += amt;
+		len -= amt;
+		total += amt;
+		this->offset += amt;
+	}
+	::stats.bytesRead += total;
+	return total;
+}
+
+void CachedStream::seekg(camoto::stream::delta off,
+	camoto::stream::seek_from from)
+{
+	camoto::stream::delta target;
+	switch (from) {
+		case camoto::stream::cur: target = this->offset + off; break;
+		case camoto::stream::end: target = this->length + off; break;
+		default: target = off; break;
+	}
+	if ((target < 0) || ((camoto::stream::pos)target > this->length)) {
+		throw camoto::stream::seek_error("Seek past end of file");
+	}
+	this->offset = target;
+	return;
+}
+
+camoto::stream::pos CachedStream::tellg() const
+{
+	return this->offset;
+}
+
+camoto::stream::len CachedStream::size() const
+{
+	return this->length;
+}
+
+camoto::stream::len CachedStream::try_write(const uint8_t *buffer,
+	camoto::stream::len len)
+{
+	camoto::stream::len written;
+	{
+		std::lock_guard<std::mutex> pl(this->parentLock);
+		this->parent->seekp(this->offset, camoto::stream::start);
+		written = this->parent->try_write(buffer, len);
+	}
+	std::lock_guard<std::mutex> l(this->lock);
+	this->invalidate(this->offset, written);
+	this->offset += written;
+	if (this->offset > this->length) this->length = this->offset;
+	return written;
+}
+
+void CachedStream::seekp(camoto::stream::delta off,
+	camoto::stream::seek_from from)
+{
+	this->seekg(off, from);
+	return;
+}
+
+camoto::stream::pos CachedStream::tellp() const
+{
+	return this->offset;
+}
+
+void CachedStream::truncate(camoto::stream::len size)
+{
+	{
+		std::lock_guard<std::mutex> pl(this->parentLock);
+		this->parent->truncate(size);
+	}
+	std::lock_guard<std::mutex> l(this->lock);
+	// Drop everything from the last partial block onwards
+	if (size < this->length) this->invalidate(size, this->length - size);
+	else this->invalidate(this->length, size - this->length);
+	this->length = size;
+	if (this->offset > this->length) this->offset = this->length;
+	return;
+}
+
+void CachedStream::flush()
+{
+	std::lock_guard<std::mutex> pl(this->parentLock);
+	this->parent->flush();
+	return;
+}
+
+bool CachedStream::prefetch(camoto::stream::pos offset)
+{
+	{
+		std::lock_guard<std::mutex> l(this->lock);
+		if (offset >= this->length) return false;
+	}
+	bool didLoad = false;
+	this->getBlock(offset / CACHE_BLOCK, false, &didLoad);
+	return didLoad;
+}
+
+bool CachedStream::isCached(camoto::stream::pos offset)
+{
+	std::lock_guard<std::mutex> l(this->lock);
+	return this->blocks.find(offset / CACHE_BLOCK) != this->blocks.end();
+}
+
+CachedStream::Stats CachedStream::getStats()
+{
+	std::lock_guard<std::mutex> l(this->lock);
+	return this->stats;
+}
+
+camoto::stream::len CachedStream::readDirect(camoto::stream::pos offset,
+	uint8_t *buffer, camoto::stream::len len)
+{
+	std::lock_guard<std::mutex> pl(this->parentLock);
+	this->parent->seekg(offset, camoto::stream::start);
+	return this->parent->try_read(buffer, len);
+}
+
+std::shared_ptr<camoto::stream::inout> CachedStream::getParent() const
+{
+	return this->parent;
+}
+
+camoto::stream::len CachedStream::getBudget() const
+{
+	return (camoto::stream::len)this->maxBlocks * CACHE_BLOCK;
+}
+
+CachedStream::BlockPtr CachedStream::getBlock(unsigned long index,
+	bool demand, bool *didLoad)
+{
+	if (didLoad) *didLoad = false;
+	std::unique_lock<std::mutex> l(this->lock);
+	for (;;) {
+		std::map<unsigned long, BlockPtr>::iterator i = this->blocks.find(index);
+		if (i != this->blocks.end()) {
+			if (demand) {
+				// Move to the back of the queue
+				this->lru.splice(this->lru.end(), this->lru, i->second->use);
+				this->stats.hits++;
+				if (i->second->prefetched) {
+					this->stats.prefetchHits++;
+					i->second->prefetched = false;
+				}
+			}
+			return i->second;
+		}
+		// If another thread is already reading this block, wait for it rather
+		// than reading it twice.
+		if (this->loading.find(index) == this->loading.end()) break;
+		::Stats::Timer wait(::Stats::Phase_IOWait, demand);
+		this->loaded.wait(l);
+	}
+	if (demand) this->stats.misses++;
+	this->loading.insert(index);
+	unsigned long gen = this->generation;
+	l.unlock();
+
+	BlockPtr block(new Block());
+	block->prefetched = !demand;
+	try {
+		// Reads ahead don't hold anything up, so only count the ones something
+		// is waiting for
+		::Stats::Timer wait(::Stats::Phase_IOWait, demand);
+		std::lock_guard<std::mutex> pl(this->parentLock);
+		block->data.resize(CACHE_BLOCK);
+		this->parent->seekg((camoto::stream::pos)index * CACHE_BLOCK,
+			camoto::stream::start);
+		block->data.resize(this->parent->try_read(&block->data[0], CACHE_BLOCK));
+	} catch (...) {
+		l.lock();
+		this->loading.erase(index);
+		this->loaded.notify_all();
+		throw;
+	}
+
+	l.lock();
+	this->loading.erase(index);
+	this->loaded.notify_all();
+	if (gen != this->generation) {
+		// The data was changed while it was being read, so the block may be out
+		// of date.  It's still right for this read (the change happened around
+		// the same time), but don't keep it.
+		return block;
+	}
+	block->use = this->lru.insert(this->lru.end(), index);
+	this->blocks[index] = block;
+	while (this->blocks.size() > this->maxBlocks) {
+		this->blocks.erase(this->lru.front());
+		this->lru.pop_front();
+	}
+	if (!demand) this->stats.prefetched++;
+	if (didLoad) *didLoad = true;
+	return block;
+}
+
+void CachedStream::invalidate(camoto::stream::pos start,
+	camoto::stream::len len)
+{
+	this->generation++;
+	if (len == 0) return;
+	unsigned long first = start / CACHE_BLOCK;
+	unsigned long last = (start + len - 1) / CACHE_BLOCK;
+	for (unsigned long i = first; i <= last; i++) {
+		std::map<unsigned long, BlockPtr>::iterator b = this->blocks.find(i);
+		if (b == this->blocks.end()) continue;
+		this->lru.erase(b->second->use);
+		this->blocks.erase(b);
+	}
+	return;
+}
@@ -0,0 +1,177 @@
+/**
+ * @file   CachedStream.hpp
+ * @brief  Stream keeping recently read blocks of its parent in memory.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CACHEDSTREAM_HPP_
+#define CACHEDSTREAM_HPP_
+
+#include <stdint.h>
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <mutex>
+#include <set>
+#include <vector>
+#include <camoto/stream.hpp>
+
+/// Size of each cached block, in bytes.  Blocks start on a multiple of this.
+#define CACHE_BLOCK       (1 << 16)
+
+/// Default amount of memory to use for cached blocks, in bytes.
+#define CACHE_DEFAULT_SIZE (16 << 20)
+
+/// Stream that caches blocks of its parent.
+/**
+ * This sits between the views and the file, so that slow storage (network
+ * filesystems, optical discs, compressed files) is only read once for data
+ * that is looked at repeatedly.  There is one of these per file, shared by
+ * every view of it, so switching between views doesn't lose anything.
+ * Once the memory budget is used up, the least recently read block is
+ * dropped to make room.
+ *
+ * Blocks can also be loaded in the background by another thread with
+ * prefetch(), which is safe to call while the main thread is reading.
+ *
+ * Writes go straight through to the parent, and any cached copies of the
+ * affected blocks are discarded.
+ */
+class CachedStream: virtual public camoto::stream::inout
+{
+	public:
+		/// Counters showing how well the cache is working.
+		struct Stats
+		{
+			unsigned long hits;          ///< Reads satisfied from memory
+			unsigned long misses;        ///< Reads that had to wait for the parent
+			unsigned long prefetched;    ///< Blocks loaded by prefetch()
+			unsigned long prefetchHits;  ///< Prefetched blocks that were then read
+		};
+
+		/// Cache the given stream.
+		/**
+		 * @param parent
+		 *   Stream to cache.  It must not be accessed other than through this
+		 *   object from now on.
+		 *
+		 * @param budget
+		 *   Maximum number of bytes to keep in memory.  This is rounded down to
+		 *   a whole number of blocks, with a minimum of two.
+		 */
+		CachedStream(std::shared_ptr<camoto::stream::inout> parent,
+			camoto::stream::len budget = CACHE_DEFAULT_SIZE);
+
+		virtual ~CachedStream();
+
+		virtual camoto::stream::len try_read(uint8_t *buffer,
+			camoto::stream::len len);
+		virtual void seekg(camoto::stream::delta off,
+			camoto::stream::seek_from from);
+		virtual camoto::stream::pos tellg() const;
+		virtual camoto::stream::len size() const;
+
+		virtual camoto::stream::len try_write(const uint8_t *buffer,
+			camoto::stream::len len);
+		virtual void seekp(camoto::stream::delta off,
+			camoto::stream::seek_from from);
+		virtual camoto::stream::pos tellp() const;
+		virtual void truncate(camoto::stream::len size);
+		virtual void flush();
+
+		/// Load the block containing the given offset, if it isn't cached.
+		/**
+		 * This may be called from any thread.
+		 *
+		 * @param offset
+		 *   Any offset within the block to load.
+		 *
+		 * @return true if the block had to be read from the parent, false if it
+		 *   was already cached (or the offset is past the end of the data.)
+		 */
+		bool prefetch(camoto::stream::pos offset);
+
+		/// Is the block containing the given offset in memory?
+		bool isCached(camoto::stream::pos offset);
+
+		/// Get a copy of the current counters.
+		Stats getStats();
+
+		/// Read from the parent without going through the cache.
+		/**
+		 * This is for reading through large amounts of data once, which would
+		 * otherwise push everything else out of the cache.  It doesn't affect
+		 * the current seek position.  Any thread may call this.
+		 *
+		 * @return Number of bytes read, less than len only at the end of the data.
+		 */
+		camoto::stream::len readDirect(camoto::stream::pos offset,
+			uint8_t *buffer, camoto::stream::len len);
+
+		/// Get the stream being cached.
+		std::shared_ptr<camoto::stream::inout> getParent() const;
+
+		/// Get the most memory the cache will use, in bytes.
+		camoto::stream::len getBudget() const;
+
+	protected:
+		/// One block of cached data.
+		struct Block
+		{
+			std::vector<uint8_t> data; ///< Content, short at the end of the file
+			bool prefetched;           ///< Loaded by prefetch() and not yet read
+			std::list<unsigned long>::iterator use; ///< Position in CachedStream::lru
+		};
+		typedef std::shared_ptr<Block> BlockPtr;
+
+		/// Get a block, reading it from the parent if needed.
+		/**
+		 * @param index
+		 *   Block number (offset / CACHE_BLOCK).
+		 *
+		 * @param demand
+		 *   true if the data is needed now (for the stats), false if it is being
+		 *   prefetched.
+		 *
+		 * @param loaded
+		 *   If not NULL, set to true if the block was read from the parent.
+		 */
+		BlockPtr getBlock(unsigned long index, bool demand, bool *loaded);
+
+		/// Discard the cached blocks overlapping the given range.
+		/**
+		 * @pre this->lock is held.
+		 */
+		void invalidate(camoto::stream::pos start, camoto::stream::len len);
+
+		std::shared_ptr<camoto::stream::inout> parent; ///< Stream being cached
+		camoto::stream::pos offset;    ///< Current read/write position
+		camoto::stream::len length;    ///< Size of the data
+		unsigned long maxBlocks;       ///< Most blocks to keep in memory
+
+		std::mutex lock;               ///< Protects everything below
+		std::map<unsigned long, BlockPtr> blocks; ///< Cached blocks, by index
+		std::list<unsigned long> lru;  ///< Block indices, least recently used first
+		std::set<unsigned long> loading; ///< Blocks being read by some thread
+		std::condition_variable loaded;  ///< Signalled when a block has been read
+		unsigned long generation;      ///< Incremented on every write
+		Stats stats;                   ///< Counters
+
+		std::mutex parentLock;         ///< Held while accessing parent
+};
+
+#endif // CACHEDSTREAM_HPP_
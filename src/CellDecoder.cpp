@@ -0,0 +1,55 @@
+/**
+ * @file   CellDecoder.cpp
+ * @brief  Extract cells of any bit width from a block of memory.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "CellDecoder.hpp"
+
+CellDecoder::CellDecoder(int bitWidth, camoto::bitstream::endian endian)
+	:	width(bitWidth),
+		endian(endian),
+		mask((unsigned int)((1ULL << bitWidth) - 1))
+{
+}
+
+unsigned int CellDecoder::get(const uint8_t *data, unsigned int bit) const
+{
+	if ((this->width == 8) && (bit == 0)) return data[0];
+
+	unsigned int bytes = this->bytesNeeded(bit);
+	uint64_t w = 0;
+	if (this->endian == camoto::bitstream::littleEndian) {
+		// The first bit is the lowest bit of the first byte
+		for (unsigned int i = 0; i < bytes; i++) w |= (uint64_t)data[i] << (8 * i);
+		return (unsigned int)(w >> bit) & this->mask;
+	}
+	// The first bit is the highest bit of the first byte, and ends up as the
+	// highest bit in the value.
+	for (unsigned int i = 0; i < bytes; i++) w = (w << 8) | data[i];
+	return (unsigned int)(w >> (bytes * 8 - bit - this->width)) & this->mask;
+}
+
+unsigned int CellDecoder::bytesNeeded(unsigned int bit) const
+{
+	return (bit + this->width + 7) >> 3;
+}
+
+unsigned int CellDecoder::getMask() const
+{
+	return this->mask;
+}
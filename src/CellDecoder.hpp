@@ -0,0 +1,71 @@
+/**
+ * @file   CellDecoder.hpp
+ * @brief  Extract cells of any bit width from a block of memory.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CELLDECODER_HPP_
+#define CELLDECODER_HPP_
+
+#include <stdint.h>
+#include <camoto/bitstream.hpp>
+
+/// Reads cells out of a buffer the same way camoto::bitstream reads a file.
+/**
+ * Going through the bitstream costs a function call per bit, which is fine
+ * for one screen but not for looking through a whole file.  This gets the
+ * same values straight from memory.
+ */
+class CellDecoder
+{
+	public:
+		/// Set up the cell format.
+		/**
+		 * @param bitWidth
+		 *   Number of bits in each cell, 1 to 32.
+		 *
+		 * @param endian
+		 *   Bit order, as passed to camoto::bitstream.
+		 */
+		CellDecoder(int bitWidth, camoto::bitstream::endian endian);
+
+		/// Get the value of one cell.
+		/**
+		 * @param data
+		 *   Byte holding the first bit of the cell.  Enough bytes must follow to
+		 *   hold the rest of the cell.
+		 *
+		 * @param bit
+		 *   Bit within data[0] where the cell starts, 0 to 7.
+		 *
+		 * @return Cell value.
+		 */
+		unsigned int get(const uint8_t *data, unsigned int bit) const;
+
+		/// Number of bytes needed to hold a cell starting at the given bit.
+		unsigned int bytesNeeded(unsigned int bit) const;
+
+		/// Get the value of a cell with every bit set.
+		unsigned int getMask() const;
+
+	protected:
+		int width;                           ///< Bits per cell
+		camoto::bitstream::endian endian;    ///< Bit order
+		unsigned int mask;                   ///< width bits set
+};
+
+#endif // CELLDECODER_HPP_
@@ -0,0 +1,182 @@
+/**
+ * @file   CellFinder.cpp
+ * @brief  Search forward through a file for cells that change.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "CellFinder.hpp"
+#include "ByteCompare.hpp"
+#include "MmapStream.hpp"
+#include "Stats.hpp"
+
+#define min(x, y) (((x) < (y)) ? (x) : (y))
+#define max(x, y) (((x) > (y)) ? (x) : (y))
+
+CellFinder::CellFinder(std::shared_ptr<camoto::stream::inout> data,
+	std::shared_ptr<HoleMap> holes, int bitWidth, int intraByteOffset,
+	camoto::bitstream::endian endian)
+	:	data(data),
+		holes(holes),
+		cache(dynamic_cast<CachedStream *>(data.get())),
+		mem(NULL),
+		length(data->size()),
+		decoder(bitWidth, endian),
+		bitWidth(bitWidth),
+		intraByteOffset(intraByteOffset),
+		bufStart(0),
+		bufLen(0)
+{
+	MmapStream *map = dynamic_cast<MmapStream *>(data.get());
+	if (map) this->mem = map->getData();
+
+	// Smallest number of whole bytes that is also a whole number of cells
+	unsigned int a = bitWidth, b = 8;
+	while (b) {
+		unsigned int t = a % b;
+		a = b;
+		b = t;
+	}
+	this->period = bitWidth / a;
+}
+
+bool CellFinder::find(camoto::stream::pos cell, Match match,
+	camoto::stream::pos *found)
+{
+	Stats::Timer timer(Stats::Phase_Decode);
+	unsigned int value;
+	if (match == Change) {
+		if (!this->cellAt(cell, &value)) return false;
+		return this->nextDifferent(cell + 1, value, found);
+	}
+
+	unsigned int mask = this->decoder.getMask();
+	camoto::stream::pos c = cell + 1;
+	for (;;) {
+		if (!this->cellAt(c, &value)) return false;
+		if ((value != 0) && (value != mask)) {
+			*found = c;
+			return true;
+		}
+		if (!this->nextDifferent(c + 1, value, &c)) return false;
+	}
+}
+
+bool CellFinder::cellAt(camoto::stream::pos cell, unsigned int *value)
+{
+	camoto::stream::pos bit = cell * this->bitWidth + this->intraByteOffset;
+	if (bit + this->bitWidth > this->length * 8) return false;
+
+	camoto::stream::len need = this->decoder.bytesNeeded(bit & 7);
+	camoto::stream::len avail;
+	const uint8_t *p = this->fetch(bit >> 3, need, &avail);
+	if (!p || (avail < need)) return false;
+	*value = this->decoder.get(p, bit & 7);
+	return true;
+}
+
+bool CellFinder::nextDifferent(camoto::stream::pos cell, unsigned int value,
+	camoto::stream::pos *found)
+{
+	camoto::stream::pos c = cell;
+	camoto::stream::pos streak = cell; // first cell known to equal value
+	for (;;) {
+		unsigned int next;
+		if (!this->cellAt(c, &next)) return false;
+		if (next != value) {
+			*found = c;
+			return true;
+		}
+		c++;
+
+		// Whole bytes covered by the cells checked so far
+		camoto::stream::pos first = (streak * this->bitWidth
+			+ this->intraByteOffset + 7) >> 3;
+		camoto::stream::pos end = (c * this->bitWidth + this->intraByteOffset) >> 3;
+		if (end < first + 2 * this->period + 4) continue;
+
+		// The bytes now repeat for as long as the cells stay the same
+		camoto::stream::pos diff = this->skipRepeats(end, value == 0);
+		if (diff >= this->length) return false;
+
+		// Go back to decoding from the last cell that can't have changed
+		camoto::stream::pos resume = (((diff - this->period) << 3)
+			- this->intraByteOffset) / this->bitWidth;
+		c = max(c, resume);
+		streak = c;
+	}
+}
+
+camoto::stream::pos CellFinder::skipRepeats(camoto::stream::pos start,
+	bool zero)
+{
+	camoto::stream::pos m = start;
+	while (m < this->length) {
+		// Stop at each hole or data boundary, to skip over holes in zeros
+		camoto::stream::len limit = FINDER_CHUNK;
+		if (this->holes) {
+			camoto::stream::pos extStart, extEnd;
+			bool inHole = this->holes->find(m, &extStart, &extEnd);
+			if (inHole && zero) {
+				m = extEnd;
+				continue;
+			}
+			limit = min(limit, extEnd - m);
+		}
+
+		camoto::stream::len avail;
+		const uint8_t *p = this->fetch(m - this->period,
+			this->period + 1, &avail);
+		if (!p || (avail <= this->period)) break;
+
+		camoto::stream::len len = min(avail - this->period, limit);
+		camoto::stream::len same = sameLength(p + this->period, p, len);
+		m += same;
+		if (same < len) return m;
+	}
+	return this->length;
+}
+
+const uint8_t *CellFinder::fetch(camoto::stream::pos offset,
+	camoto::stream::len need, camoto::stream::len *avail)
+{
+	if (offset >= this->length) {
+		*avail = 0;
+		return NULL;
+	}
+	if (this->mem) {
+		*avail = this->length - offset;
+		return this->mem + offset;
+	}
+
+	if ((offset < this->bufStart)
+		|| (offset + need > this->bufStart + this->bufLen)
+	) {
+		this->buffer.resize(FINDER_CHUNK);
+		camoto::stream::len want = min(FINDER_CHUNK, this->length - offset);
+		camoto::stream::len got;
+		if (this->cache) {
+			got = this->cache->readDirect(offset, &this->buffer[0], want);
+		} else {
+			this->data->seekg(offset, camoto::stream::start);
+			got = this->data->try_read(&this->buffer[0], want);
+		}
+		this->bufStart = offset;
+		this->bufLen = got;
+	}
+	*avail = this->bufStart + this->bufLen - offset;
+	return &this->buffer[offset - this->bufStart];
+}
@@ -0,0 +1,156 @@
+/**
+ * @file   CellFinder.hpp
+ * @brief  Search forward through a file for cells that change.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CELLFINDER_HPP_
+#define CELLFINDER_HPP_
+
+#include <vector>
+#include <camoto/stream.hpp>
+#include "CachedStream.hpp"
+#include "CellDecoder.hpp"
+#include "HoleMap.hpp"
+
+/// Amount of data read at a time when the file isn't mapped into memory.
+#define FINDER_CHUNK (1024 * 1024)
+
+/// Find the next cell that differs from the ones before it.
+/**
+ * Cells are decoded one at a time until the same value has been seen for a
+ * few bytes.  From there, as long as the cells keep the same value, the bytes
+ * repeat every L bytes where L is the number of bytes holding a whole number
+ * of cells (1 for 8-bit cells, 5 for 5-bit cells.)  So the rest of the run is
+ * found by comparing the data against itself L bytes later, 16 bytes at a time,
+ * and cells are only decoded again near where that comparison fails.
+ *
+ * Holes in sparse files are skipped without reading them when looking past
+ * zeros.
+ *
+ * Data is read directly from the file rather than through the cache, so
+ * skipping over a few GB doesn't push out what is on the screen.
+ */
+class CellFinder
+{
+	public:
+		/// What kind of cell to look for.
+		enum Match {
+			Change,   ///< Any value other than that of the starting cell
+			NonBlank, ///< Any value other than all bits clear or all bits set
+		};
+
+		/// Set up a search.
+		/**
+		 * @param data
+		 *   Data to search.  Any changes must have been flushed already.
+		 *
+		 * @param holes
+		 *   Holes in data, or NULL if it isn't a sparse file.
+		 *
+		 * @param bitWidth
+		 *   Number of bits in each cell.
+		 *
+		 * @param intraByteOffset
+		 *   Bit where cell 0 starts.
+		 *
+		 * @param endian
+		 *   Bit order of the cells.
+		 */
+		CellFinder(std::shared_ptr<camoto::stream::inout> data,
+			std::shared_ptr<HoleMap> holes, int bitWidth, int intraByteOffset,
+			camoto::bitstream::endian endian);
+
+		/// Find the next matching cell.
+		/**
+		 * @param cell
+		 *   Cell to start from.  The search begins with the cell after this.
+		 *
+		 * @param match
+		 *   What to look for.
+		 *
+		 * @param found
+		 *   On return, the matching cell if there is one.
+		 *
+		 * @return true if a cell was found, false if the end of the data was
+		 *   reached first.
+		 *
+		 * @throw camoto::stream::read_error
+		 *   The data could not be read.
+		 */
+		bool find(camoto::stream::pos cell, Match match, camoto::stream::pos *found);
+
+	protected:
+		/// Get the value of one cell.
+		/**
+		 * @return false if the cell is past the end of the data.
+		 */
+		bool cellAt(camoto::stream::pos cell, unsigned int *value);
+
+		/// Find the first cell from the given one that isn't equal to value.
+		/**
+		 * @return false if the end of the data was reached first.
+		 */
+		bool nextDifferent(camoto::stream::pos cell, unsigned int value,
+			camoto::stream::pos *found);
+
+		/// Find the first byte that isn't the same as the one L bytes before it.
+		/**
+		 * @param start
+		 *   Offset of the first byte to check, in bytes.  Must be at least L.
+		 *
+		 * @param zero
+		 *   true if the repeating bytes are all zero, so holes can be skipped.
+		 *
+		 * @return Offset of the byte, or the size of the data if there isn't one.
+		 */
+		camoto::stream::pos skipRepeats(camoto::stream::pos start, bool zero);
+
+		/// Get a pointer to the data at the given offset.
+		/**
+		 * @param offset
+		 *   Offset of the first byte wanted.
+		 *
+		 * @param need
+		 *   Minimum number of bytes wanted.
+		 *
+		 * @param avail
+		 *   On return, the number of bytes at the returned pointer, which is only
+		 *   less than need at the end of the data.
+		 *
+		 * @return Pointer to the data, or NULL if offset is past the end.
+		 */
+		const uint8_t *fetch(camoto::stream::pos offset, camoto::stream::len need,
+			camoto::stream::len *avail);
+
+		std::shared_ptr<camoto::stream::inout> data; ///< Data being searched
+		std::shared_ptr<HoleMap> holes; ///< Holes to skip, or NULL
+		CachedStream *cache;           ///< data, if it is cached
+		const uint8_t *mem;            ///< Mapped data, or NULL
+		camoto::stream::len length;    ///< Size of data in bytes
+
+		CellDecoder decoder;           ///< Extracts cells from the data
+		int bitWidth;                  ///< Bits per cell
+		int intraByteOffset;           ///< Bit where cell 0 starts
+		camoto::stream::len period;    ///< Bytes holding a whole number of cells
+
+		std::vector<uint8_t> buffer;   ///< Data read when not mapped
+		camoto::stream::pos bufStart;  ///< Offset of buffer[0]
+		camoto::stream::len bufLen;    ///< Valid bytes in buffer
+};
+
+#endif // CELLFINDER_HPP_
@@ -0,0 +1,975 @@
+/**
+ * @file   CompressedStream.cpp
+ * @brief  Read-only stream that transparently decompresses its parent.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <config.h>
+#include "CompressedStream.hpp"
+#include "MmapStream.hpp"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/// Most compressed data passed to a decoder at once from a mapped file.
+#define MAPPED_INPUT  (1 << 30)
+
+/// Signature at the start of a cached index file.
+#define INDEX_SIGNATURE  "LLIDX001"
+
+/// Length of the format name stored in a cached index file.
+#define INDEX_FORMAT_LEN 8
+
+#define min(x, y) (((x) < (y)) ? (x) : (y))
+
+CompressedStream::CompressedStream(std::shared_ptr<camoto::stream::input> raw)
+	:	raw(raw),
+		rawMap(dynamic_cast<MmapStream *>(raw.get())),
+		rawSize(raw->size()),
+		rawMTime(0),
+		indexing(false),
+		decodedSize(0),
+		offset(0),
+		decoderPos(0),
+		chunkStart(0)
+{
+}
+
+CompressedStream::~CompressedStream()
+{
+}
+
+camoto::stream::len CompressedStream::try_read(uint8_t *buffer,
+	camoto::stream::len len)
+{
+	camoto::stream::len done = 0;
+	while ((done < len) && (this->offset < this->decodedSize)) {
+		if (
+			(this->offset < this->chunkStart)
+			|| (this->offset >= this->chunkStart + this->chunk.size())
+		) {
+			this->loadChunk(this->offset);
+			if (this->chunk.empty()) break; // data ended before decodedSize
+		}
+		camoto::stream::pos inChunk = this->offset - this->chunkStart;
+		camoto::stream::len amt = min(len - done, this->chunk.size() - inChunk);
+		memcpy(buffer + done, &this->chunk[inChunk], amt);
+		done += amt;
+		this->offset += amt;
+	}
+	return done;
+}
+
+void CompressedStream::seekg(camoto::stream::delta off,
+	camoto::stream::seek_from from)
+{
+	camoto::stream::delta target;
+	switch (from) {
+		case camoto::stream::cur: target = this->offset + off; break;
+		case camoto::stream::end: target = this->decodedSize + off; break;
+		default: target = off; break; // camoto::stream::start
+	}
+	if ((target < 0) || (target > (camoto::stream::delta)this->decodedSize)) {
+		throw camoto::stream::seek_error("Cannot seek beyond the end of the "
+			"decompressed data");
+	}
+	this->offset = target;
+	return;
+}
+
+camoto::stream::pos CompressedStream::tellg() const
+{
+	return this->offset;
+}
+
+camoto::stream::len CompressedStream::size() const
+{
+	return this->decodedSize;
+}
+
+camoto::stream::len CompressedStream::try_write(const uint8_t *buffer,
+	camoto::stream::len len)
+{
+	throw camoto::stream::write_error("Compressed files are read-only");
+}
+
+void CompressedStream::seekp(camoto::stream::delta off,
+	camoto::stream::seek_from from)
+{
+	this->seekg(off, from);
+	return;
+}
+
+camoto::stream::pos CompressedStream::tellp() const
+{
+	return this->offset;
+}
+
+void CompressedStream::truncate(camoto::stream::len size)
+{
+	throw camoto::stream::write_error("Compressed files are read-only");
+}
+
+void CompressedStream::flush()
+{
+	return;
+}
+
+void CompressedStream::readIndex()
+{
+	if (this->checkpoints.empty()) {
+		Checkpoint first;
+		first.out = 0;
+		first.in = 0;
+		first.state = 0;
+		this->checkpoints.push_back(first);
+	}
+	this->restart(this->checkpoints[0]);
+	this->decoderPos = this->checkpoints[0].out;
+
+	std::vector<uint8_t> buf(DECODE_CHUNK);
+	camoto::stream::len len;
+	while ((len = this->decode(&buf[0], buf.size())) > 0) {
+		this->decoderPos += len;
+	}
+	this->decodedSize = this->decoderPos;
+	return;
+}
+
+void CompressedStream::addCheckpoint(const Checkpoint& cp)
+{
+	if (this->checkpoints.empty() || (cp.out > this->checkpoints.back().out)) {
+		this->checkpoints.push_back(cp);
+	}
+	return;
+}
+
+void CompressedStream::openIndex(const std::string& strFilename)
+{
+	struct stat st;
+	if (stat(strFilename.c_str(), &st) == 0) this->rawMTime = st.st_mtime;
+
+	std::string strCache = this->indexFilename(strFilename);
+	if (strCache.empty() || !this->loadIndex(strCache)) {
+		this->checkpoints.clear();
+		// Building the index usually reads the whole file from start to end
+		if (this->rawMap) this->rawMap->advise(MmapStream::Sequential);
+		this->indexing = true;
+		this->readIndex();
+		this->indexing = false;
+		if (this->rawMap) this->rawMap->advise(MmapStream::Normal);
+		if (!strCache.empty()) this->saveIndex(strCache);
+	}
+	if (this->checkpoints.empty()) {
+		throw camoto::stream::read_error("Unable to index compressed data");
+	}
+
+	this->restart(this->checkpoints[0]);
+	this->decoderPos = this->checkpoints[0].out;
+	this->chunk.clear();
+	this->chunkStart = 0;
+	return;
+}
+
+std::string CompressedStream::indexFilename(const std::string& strFilename) const
+{
+	std::string strDir;
+	const char *cacheHome = getenv("XDG_CACHE_HOME");
+	if (cacheHome && *cacheHome) {
+		strDir = cacheHome;
+	} else {
+		const char *home = getenv("HOME");
+		if ((!home) || (!*home)) return std::string();
+		strDir = std::string(home) + "/.cache";
+	}
+	mkdir(strDir.c_str(), 0700);
+	strDir.append("/ll");
+	mkdir(strDir.c_str(), 0700);
+
+	// Name the index after a hash of the full path, so the same file is found
+	// again no matter which directory it is opened from.
+	char *realPath = realpath(strFilename.c_str(), NULL);
+	std::string strPath(realPath ? realPath : strFilename.c_str());
+	free(realPath);
+
+	uint64_t hash = 14695981039346656037ULL; // FNV-1a
+	for (std::string::const_iterator i = strPath.begin(); i != strPath.end(); i++) {
+		hash ^= (uint8_t)*i;
+		hash *= 1099511628211ULL;
+	}
+
+	std::ostringstream ss;
+	ss << strDir << '/' << std::hex << std::setfill('0') << std::setw(16)
+		<< hash << ".idx";
+	return ss.str();
+}
+
+bool CompressedStream::loadIndex(const std::string& strCache)
+{
+	std::ifstream idx(strCache.c_str(), std::ios::in | std::ios::binary);
+	if (!idx.good()) return false;
+
+	char sig[sizeof(INDEX_SIGNATURE) - 1];
+	char format[INDEX_FORMAT_LEN];
+	uint64_t rawSize, decodedSize, count;
+	int64_t rawMTime;
+	idx.read(sig, sizeof(sig));
+	idx.read(format, sizeof(format));
+	idx.read((char *)&rawSize, sizeof(rawSize));
+	idx.read((char *)&rawMTime, sizeof(rawMTime));
+	idx.read((char *)&decodedSize, sizeof(decodedSize));
+	idx.read((char *)&count, sizeof(count));
+	if (!idx.good()) return false;
+
+	// Ignore the index if it is for a different version of the file
+	if (memcmp(sig, INDEX_SIGNATURE, sizeof(sig)) != 0) return false;
+	if (strncmp(format, this->getFormat(), sizeof(format)) != 0) return false;
+	if (rawSize != this->rawSize) return false;
+	if (rawMTime != this->rawMTime) return false;
+
+	// Decoding always starts from the first checkpoint, so there must be one
+	if (count < 1) return false;
+
+	this->checkpoints.clear();
+	for (uint64_t i = 0; i < count; i++) {
+		Checkpoint cp;
+		uint64_t out, in;
+		int32_t state;
+		uint32_t windowLen;
+		idx.read((char *)&out, sizeof(out));
+		idx.read((char *)&in, sizeof(in));
+		idx.read((char *)&state, sizeof(state));
+		idx.read((char *)&windowLen, sizeof(windowLen));
+		if (!idx.good() || (windowLen > (1 << 16))) return false;
+
+		// Make sure the checkpoints are in order and inside the file, otherwise
+		// a damaged index would quietly decode from the wrong place.
+		if (i == 0) {
+			if (out != 0) return false;
+		} else {
+			const Checkpoint& prev = this->checkpoints.back();
+			if ((out <= prev.out) || (in <= prev.in)) return false;
+		}
+		if ((out > decodedSize) || (in > rawSize)) return false;
+		cp.out = out;
+		cp.in = in;
+		cp.state = state;
+		cp.window.resize(windowLen);
+		if (windowLen) idx.read((char *)&cp.window[0], windowLen);
+		if (!idx.good() || !this->validCheckpoint(cp)) return false;
+		this->checkpoints.push_back(cp);
+	}
+	this->decodedSize = decodedSize;
+	return true;
+}
+
+bool CompressedStream::validCheckpoint(const Checkpoint& cp) const
+{
+	return true;
+}
+
+void CompressedStream::saveIndex(const std::string& strCache) const
+{
+	// Write to a new file and rename it over the old one, so another instance
+	// never sees a partly written index, even if this one is interrupted.
+	std::vector<char> tempName(strCache.begin(), strCache.end());
+	const char suffix[] = ".XXXXXX";
+	tempName.insert(tempName.end(), suffix, suffix + sizeof(suffix));
+	int fd = mkstemp(&tempName[0]);
+	if (fd < 0) return; // no cache, but the index still works this time
+	close(fd);
+	std::ofstream idx(&tempName[0],
+		std::ios::out | std::ios::trunc | std::ios::binary);
+	if (!idx.good()) {
+		unlink(&tempName[0]);
+		return;
+	}
+
+	char format[INDEX_FORMAT_LEN];
+	memset(format, 0, sizeof(format));
+	memcpy(format, this->getFormat(), min(strlen(this->getFormat()), sizeof(format)));
+	uint64_t rawSize = this->rawSize;
+	int64_t rawMTime = this->rawMTime;
+	uint64_t decodedSize = this->decodedSize;
+	uint64_t count = this->checkpoints.size();
+	idx.write(INDEX_SIGNATURE, sizeof(INDEX_SIGNATURE) - 1);
+	idx.write(format, sizeof(format));
+	idx.write((const char *)&rawSize, sizeof(rawSize));
+	idx.write((const char *)&rawMTime, sizeof(rawMTime));
+	idx.write((const char *)&decodedSize, sizeof(decodedSize));
+	idx.write((const char *)&count, sizeof(count));
+
+	for (std::vector<Checkpoint>::const_iterator
+		i = this->checkpoints.begin(); i != this->checkpoints.end(); i++
+	) {
+		uint64_t out = i->out, in = i->in;
+		int32_t state = i->state;
+		uint32_t windowLen = i->window.size();
+		idx.write((const char *)&out, sizeof(out));
+		idx.write((const char *)&in, sizeof(in));
+		idx.write((const char *)&state, sizeof(state));
+		idx.write((const char *)&windowLen, sizeof(windowLen));
+		if (windowLen) idx.write((const char *)&i->window[0], windowLen);
+	}
+	idx.close();
+	if (!idx.good() || (rename(&tempName[0], strCache.c_str()) < 0)) {
+		unlink(&tempName[0]);
+	}
+	return;
+}
+
+void CompressedStream::loadChunk(camoto::stream::pos target)
+{
+	camoto::stream::pos start = target - (target % DECODE_CHUNK);
+
+	// Find the last checkpoint at or before the start of the chunk.  The first
+	// checkpoint is always at offset zero so there will always be one.
+	std::vector<Checkpoint>::const_iterator cp = this->checkpoints.begin();
+	while ((cp + 1 != this->checkpoints.end()) && ((cp + 1)->out <= start)) cp++;
+
+	// Only restart if the decoder isn't already somewhere between the
+	// checkpoint and the target, as continuing on from there is quicker.
+	if ((this->decoderPos > start) || (this->decoderPos < cp->out)) {
+		this->restart(*cp);
+		this->decoderPos = cp->out;
+	}
+
+	this->chunk.resize(DECODE_CHUNK);
+	while (this->decoderPos < start) {
+		camoto::stream::len len = this->decode(&this->chunk[0],
+			min(DECODE_CHUNK, start - this->decoderPos));
+		if (len == 0) {
+			throw camoto::stream::read_error("Compressed data ended early");
+		}
+		this->decoderPos += len;
+	}
+
+	camoto::stream::len got = 0;
+	while (got < DECODE_CHUNK) {
+		camoto::stream::len len = this->decode(&this->chunk[got],
+			DECODE_CHUNK - got);
+		if (len == 0) break;
+		got += len;
+	}
+	this->decoderPos += got;
+	this->chunk.resize(got);
+	this->chunkStart = start;
+	return;
+}
+
+camoto::stream::len CompressedStream::readInput(const uint8_t **next)
+{
+	if (this->rawMap) {
+		camoto::stream::pos pos = this->raw->tellg();
+		camoto::stream::len len = min(this->rawSize - pos,
+			(camoto::stream::len)MAPPED_INPUT);
+		*next = this->rawMap->getData() + pos;
+		this->raw->seekg(len, camoto::stream::cur);
+		return len;
+	}
+	*next = this->inbuf;
+	return this->raw->try_read(this->inbuf, INPUT_BUFFER);
+}
+
+#ifdef HAVE_ZLIB
+
+/// Size of the deflate history window.
+#define GZIP_WINDOW  32768
+
+/// Decompress gzip data (or zlib data with a header.)
+class GzipStream: public CompressedStream
+{
+	public:
+		GzipStream(std::shared_ptr<camoto::stream::input> raw)
+			:	CompressedStream(raw),
+				ended(true),
+				memberStart(true),
+				rawMode(false),
+				windowPos(0),
+				inPos(0)
+		{
+			memset(&this->strm, 0, sizeof(this->strm));
+			if (inflateInit2(&this->strm, 15 + 32) != Z_OK) {
+				throw camoto::stream::error("Unable to initialise zlib");
+			}
+		}
+
+		~GzipStream()
+		{
+			inflateEnd(&this->strm);
+		}
+
+		const char *getFormat() const
+		{
+			return "gzip";
+		}
+
+	protected:
+		bool validCheckpoint(const Checkpoint& cp) const
+		{
+			// Resuming part way through needs the whole window, and state is the
+			// number of bits of the previous byte still to be read.
+			if ((cp.out != 0) && (cp.window.size() != GZIP_WINDOW)) return false;
+			if ((cp.state < 0) || (cp.state > 7)) return false;
+			if ((cp.state != 0) && (cp.in == 0)) return false;
+			return true;
+		}
+
+		void restart(const Checkpoint& cp)
+		{
+			if (cp.out == 0) {
+				// Start of the file, so there's a gzip header to read
+				inflateReset2(&this->strm, 15 + 32);
+				this->raw->seekg(cp.in, camoto::stream::start);
+				this->inPos = cp.in;
+				this->rawMode = false;
+			} else {
+				// Part way through a deflate stream, with no header
+				inflateReset2(&this->strm, -15);
+				this->rawMode = true;
+				camoto::stream::pos from = cp.in - (cp.state ? 1 : 0);
+				this->raw->seekg(from, camoto::stream::start);
+				this->inPos = from;
+				if (cp.state) {
+					uint8_t partial;
+					this->raw->read(&partial, 1);
+					this->inPos++;
+					inflatePrime(&this->strm, cp.state, partial >> (8 - cp.state));
+				}
+				inflateSetDictionary(&this->strm, &cp.window[0], cp.window.size());
+			}
+			this->strm.avail_in = 0;
+			this->ended = false;
+			this->memberStart = (cp.out == 0);
+			this->windowPos = 0;
+			this->window.clear();
+			return;
+		}
+
+		camoto::stream::len decode(uint8_t *buffer, camoto::stream::len len)
+		{
+			this->strm.next_out = buffer;
+			this->strm.avail_out = len;
+			while ((this->strm.avail_out > 0) && !this->ended) {
+				if (this->strm.avail_in == 0) {
+					this->fill();
+					if (this->strm.avail_in == 0) {
+						// Out of data.  Trailing data after the last gzip member is fine
+						// but not in the middle of one.
+						if (!this->memberStart) {
+							throw camoto::stream::read_error("Compressed data is truncated");
+						}
+						this->ended = true;
+						break;
+					}
+				}
+
+				Bytef *before = this->strm.next_out;
+				int ret = inflate(&this->strm, Z_BLOCK);
+				if (this->indexing) this->remember(before, this->strm.next_out - before);
+				if (this->strm.next_out != before) this->memberStart = false;
+
+				if (ret == Z_STREAM_END) {
+					// End of this gzip member, but there could be another one after it.
+					this->endMember();
+					continue;
+				}
+				if ((ret == Z_DATA_ERROR) && this->memberStart) {
+					// Junk or padding after the last member, ignore it like gzip does
+					this->ended = true;
+					break;
+				}
+				if ((ret != Z_OK) && (ret != Z_BUF_ERROR)) {
+					throw camoto::stream::read_error(std::string("Error decompressing "
+						"gzip data: ") + (this->strm.msg ? this->strm.msg : "unknown"));
+				}
+
+				if (
+					this->indexing
+					&& (this->strm.data_type & 128) // at end of a deflate block
+					&& !(this->strm.data_type & 64) // but not the last block
+				) {
+					camoto::stream::pos out = this->decoderPos
+						+ (this->strm.next_out - buffer);
+					if (out - this->checkpoints.back().out >= CHECKPOINT_SPAN) {
+						Checkpoint cp;
+						cp.out = out;
+						cp.in = this->inPos - this->strm.avail_in;
+						cp.state = this->strm.data_type & 7;
+						cp.window.resize(this->window.size());
+						// Copy the ring buffer out oldest byte first
+						camoto::stream::len tail = this->window.size() - this->windowPos;
+						memcpy(&cp.window[0], &this->window[this->windowPos], tail);
+						memcpy(&cp.window[tail], &this->window[0], this->windowPos);
+						this->addCheckpoint(cp);
+					}
+				}
+			}
+			return this->strm.next_out - buffer;
+		}
+
+		/// Read more compressed data into the input buffer.
+		void fill()
+		{
+			const uint8_t *next;
+			camoto::stream::len len = this->readInput(&next);
+			this->inPos += len;
+			this->strm.next_in = (Bytef *)next;
+			this->strm.avail_in = len;
+			return;
+		}
+
+		/// Prepare for the next gzip member after the current one has finished.
+		void endMember()
+		{
+			if (this->rawMode) {
+				// A raw deflate stream stops short of the gzip trailer (CRC and
+				// size), so skip over it as a header-aware decoder would have done.
+				int trailer = 8;
+				while (trailer > 0) {
+					if (this->strm.avail_in == 0) {
+						this->fill();
+						if (this->strm.avail_in == 0) break;
+					}
+					camoto::stream::len skip = min((camoto::stream::len)trailer,
+						this->strm.avail_in);
+					this->strm.next_in += skip;
+					this->strm.avail_in -= skip;
+					trailer -= skip;
+				}
+			}
+			inflateReset2(&this->strm, 15 + 32);
+			this->rawMode = false;
+			this->memberStart = true;
+			return;
+		}
+
+		/// Keep the last GZIP_WINDOW bytes of output for the next checkpoint.
+		void remember(const uint8_t *data, camoto::stream::len len)
+		{
+			if (len >= GZIP_WINDOW) {
+				this->window.assign(data + len - GZIP_WINDOW, data + len);
+				this->windowPos = 0;
+				return;
+			}
+			while (len > 0) {
+				if (this->window.size() < GZIP_WINDOW) {
+					// Still filling the ring for the first time
+					camoto::stream::len amt = min(len, GZIP_WINDOW - this->window.size());
+					this->window.insert(this->window.end(), data, data + amt);
+					data += amt;
+					len -= amt;
+					this->windowPos = this->window.size() % GZIP_WINDOW;
+					continue;
+				}
+				camoto::stream::len amt = min(len, GZIP_WINDOW - this->windowPos);
+				memcpy(&this->window[this->windowPos], data, amt);
+				data += amt;
+				len -= amt;
+				this->windowPos = (this->windowPos + amt) % GZIP_WINDOW;
+			}
+			return;
+		}
+
+		z_stream strm;        ///< zlib state
+		bool ended;           ///< true once all members have been decoded
+		bool memberStart;     ///< true if nothing has been decoded from this member yet
+		bool rawMode;         ///< true if decoding from a checkpoint (no header)
+		std::vector<uint8_t> window;   ///< Ring buffer of recent output, while indexing
+		camoto::stream::len windowPos; ///< Oldest byte in window, once it is full
+		camoto::stream::pos inPos;     ///< Offset of the next byte fill() will read
+};
+
+#endif // HAVE_ZLIB
+
+#ifdef HAVE_LZMA
+
+/// Decompress xz data.
+/**
+ * The block index stored at the end of each xz stream is used to find
+ * checkpoints, so the data does not need to be decompressed to index it.
+ */
+class XzStream: public CompressedStream
+{
+	public:
+		XzStream(std::shared_ptr<camoto::stream::input> raw)
+			:	CompressedStream(raw),
+				ended(true),
+				block(-1),
+				inPos(0)
+		{
+			lzma_stream init = LZMA_STREAM_INIT;
+			this->strm = init;
+		}
+
+		~XzStream()
+		{
+			lzma_end(&this->strm);
+		}
+
+		const char *getFormat() const
+		{
+			return "xz";
+		}
+
+	protected:
+		void readIndex()
+		{
+			if (this->readStreamIndex()) return;
+
+			// The index couldn't be read (e.g. file is truncated) so fall back to
+			// decoding the whole file in one go, which gives only one checkpoint.
+			this->checkpoints.clear();
+			Checkpoint first;
+			first.out = 0;
+			first.in = 0;
+			first.state = -1; // use the stream decoder, not a block decoder
+			this->checkpoints.push_back(first);
+			this->CompressedStream::readIndex();
+			return;
+		}
+
+		/// Read the index from the end of each stream in the file.
+		/**
+		 * @return true on success, false if the index could not be read.
+		 */
+		bool readStreamIndex()
+		{
+			lzma_index *combined = NULL;
+			camoto::stream::pos end = this->rawSize;
+			try {
+				while (end > 0) {
+					uint8_t buf[LZMA_STREAM_HEADER_SIZE];
+
+					// Skip any stream padding
+					lzma_vli padding = 0;
+					while (end >= 4) {
+						this->raw->seekg(end - 4, camoto::stream::start);
+						this->raw->read(buf, 4);
+						if (buf[0] | buf[1] | buf[2] | buf[3]) break;
+						end -= 4;
+						padding += 4;
+					}
+					if (end < 2 * LZMA_STREAM_HEADER_SIZE) throw false;
+
+					lzma_stream_flags footer, header;
+					this->raw->seekg(end - LZMA_STREAM_HEADER_SIZE, camoto::stream::start);
+					this->raw->read(buf, LZMA_STREAM_HEADER_SIZE);
+					if (lzma_stream_footer_decode(&footer, buf) != LZMA_OK) throw false;
+					if (end < LZMA_STREAM_HEADER_SIZE + footer.backward_size) throw false;
+
+					std::vector<uint8_t> index(footer.backward_size);
+					this->raw->seekg(end - LZMA_STREAM_HEADER_SIZE - footer.backward_size,
+						camoto::stream::start);
+					this->raw->read(&index[0], index.size());
+					lzma_index *idx = NULL;
+					uint64_t memlimit = UINT64_MAX;
+					size_t indexPos = 0;
+					if (lzma_index_buffer_decode(&idx, &memlimit, NULL, &index[0],
+						&indexPos, index.size()) != LZMA_OK) throw false;
+
+					lzma_vli streamSize = lzma_index_stream_size(idx);
+					if (end < streamSize) {
+						lzma_index_end(idx, NULL);
+						throw false;
+					}
+					camoto::stream::pos streamStart = end - streamSize;
+					this->raw->seekg(streamStart, camoto::stream::start);
+					this->raw->read(buf, LZMA_STREAM_HEADER_SIZE);
+					if (
+						(lzma_stream_header_decode(&header, buf) != LZMA_OK)
+						|| (lzma_stream_flags_compare(&header, &footer) != LZMA_OK)
+						|| (lzma_index_stream_flags(idx, &footer) != LZMA_OK)
+						|| (lzma_index_stream_padding(idx, padding) != LZMA_OK)
+					) {
+						lzma_index_end(idx, NULL);
+						throw false;
+					}
+
+					// Streams are being read last to first, so add the later ones onto
+					// the end of this one.
+					if (combined) {
+						if (lzma_index_cat(idx, combined, NULL) != LZMA_OK) {
+							lzma_index_end(idx, NULL);
+							throw false;
+						}
+					}
+					combined = idx;
+					end = streamStart;
+				}
+			} catch (bool) {
+				if (combined) lzma_index_end(combined, NULL);
+				return false;
+			} catch (const camoto::stream::error&) {
+				if (combined) lzma_index_end(combined, NULL);
+				return false;
+			}
+			if (!combined) return false;
+
+			lzma_index_iter iter;
+			lzma_index_iter_init(&iter, combined);
+			while (!lzma_index_iter_next(&iter, LZMA_INDEX_ITER_BLOCK)) {
+				Checkpoint cp;
+				cp.out = iter.block.uncompressed_file_offset;
+				cp.in = iter.block.compressed_file_offset;
+				cp.state = iter.stream.flags->check;
+				this->checkpoints.push_back(cp);
+			}
+			this->decodedSize = lzma_index_uncompressed_size(combined);
+			lzma_index_end(combined, NULL);
+
+			if (this->checkpoints.empty()) {
+				// Valid file with no data
+				Checkpoint first;
+				first.out = 0;
+				first.in = 0;
+				first.state = -1;
+				this->checkpoints.push_back(first);
+			}
+			return true;
+		}
+
+		void restart(const Checkpoint& cp)
+		{
+			this->raw->seekg(cp.in, camoto::stream::start);
+			this->inPos = cp.in;
+			this->strm.avail_in = 0;
+			this->ended = false;
+
+			if (cp.state < 0) {
+				// Decode the whole file as a stream
+				this->block = -1;
+				if (lzma_stream_decoder(&this->strm, UINT64_MAX, LZMA_CONCATENATED)
+					!= LZMA_OK) {
+					throw camoto::stream::read_error("Unable to initialise xz decoder");
+				}
+				return;
+			}
+
+			// Decode just this block, using the header at the start of it
+			this->block = &cp - &this->checkpoints[0];
+			uint8_t header[LZMA_BLOCK_HEADER_SIZE_MAX];
+			this->raw->read(header, 1);
+			lzma_filter filters[LZMA_FILTERS_MAX + 1];
+			memset(&this->blk, 0, sizeof(this->blk));
+			this->blk.version = 1;
+			this->blk.check = (lzma_check)cp.state;
+			this->blk.filters = filters;
+			this->blk.header_size = lzma_block_header_size_decode(header[0]);
+			this->raw->read(header + 1, this->blk.header_size - 1);
+			this->inPos += this->blk.header_size;
+			if (lzma_block_header_decode(&this->blk, NULL, header) != LZMA_OK) {
+				throw camoto::stream::read_error("Corrupted xz block header");
+			}
+			lzma_ret ret = lzma_block_decoder(&this->strm, &this->blk);
+			this->blk.filters = NULL;
+			for (int i = 0; filters[i].id != LZMA_VLI_UNKNOWN; i++) {
+				free(filters[i].options);
+			}
+			if (ret != LZMA_OK) {
+				throw camoto::stream::read_error("Unable to initialise xz decoder");
+			}
+			return;
+		}
+
+		camoto::stream::len decode(uint8_t *buffer, camoto::stream::len len)
+		{
+			this->strm.next_out = buffer;
+			this->strm.avail_out = len;
+			while ((this->strm.avail_out > 0) && !this->ended) {
+				if (this->strm.avail_in == 0) {
+					const uint8_t *next;
+					camoto::stream::len got = this->readInput(&next);
+					this->inPos += got;
+					this->strm.next_in = next;
+					this->strm.avail_in = got;
+				}
+				lzma_action action = this->strm.avail_in ? LZMA_RUN : LZMA_FINISH;
+				lzma_ret ret = lzma_code(&this->strm, action);
+				if (ret == LZMA_STREAM_END) {
+					if (
+						(this->block >= 0)
+						&& ((unsigned long)this->block + 1 < this->checkpoints.size())
+					) {
+						// Carry on with the next block
+						uint8_t *next_out = this->strm.next_out;
+						size_t avail_out = this->strm.avail_out;
+						this->restart(this->checkpoints[this->block + 1]);
+						this->strm.next_out = next_out;
+						this->strm.avail_out = avail_out;
+					} else {
+						this->ended = true;
+					}
+					continue;
+				}
+				if (ret != LZMA_OK) {
+					throw camoto::stream::read_error("Error decompressing xz data");
+				}
+			}
+			return this->strm.next_out - buffer;
+		}
+
+		lzma_stream strm;            ///< liblzma state
+		lzma_block blk;              ///< Current block, used by liblzma until it ends
+		bool ended;                  ///< true at the end of the data
+		long block;                  ///< Index into checkpoints of current block, or -1
+		camoto::stream::pos inPos;   ///< Offset of the next byte readInput() will return
+};
+
+#endif // HAVE_LZMA
+
+#ifdef HAVE_ZSTD
+
+/// Decompress zstd data.
+/**
+ * Each zstd frame can be decoded independently, so frame boundaries are used
+ * as checkpoints.
+ */
+class ZstdStream: public CompressedStream
+{
+	public:
+		ZstdStream(std::shared_ptr<camoto::stream::input> raw)
+			:	CompressedStream(raw),
+				ended(true),
+				frameEnd(true),
+				inPos(0)
+		{
+			this->dctx = ZSTD_createDStream();
+			if (!this->dctx) {
+				throw camoto::stream::error("Unable to initialise zstd");
+			}
+			this->in.src = this->inbuf;
+			this->in.size = 0;
+			this->in.pos = 0;
+		}
+
+		~ZstdStream()
+		{
+			ZSTD_freeDStream(this->dctx);
+		}
+
+		const char *getFormat() const
+		{
+			return "zstd";
+		}
+
+	protected:
+		void restart(const Checkpoint& cp)
+		{
+			ZSTD_DCtx_reset(this->dctx, ZSTD_reset_session_only);
+			this->raw->seekg(cp.in, camoto::stream::start);
+			this->inPos = cp.in;
+			this->in.size = 0;
+			this->in.pos = 0;
+			this->ended = false;
+			this->frameEnd = true;
+			return;
+		}
+
+		camoto::stream::len decode(uint8_t *buffer, camoto::stream::len len)
+		{
+			ZSTD_outBuffer out;
+			out.dst = buffer;
+			out.size = len;
+			out.pos = 0;
+			while ((out.pos < out.size) && !this->ended) {
+				if (this->in.pos == this->in.size) {
+					const uint8_t *next;
+					this->in.size = this->readInput(&next);
+					this->in.src = next;
+					this->in.pos = 0;
+					this->inPos += this->in.size;
+					if (this->in.size == 0) {
+						if (!this->frameEnd) {
+							throw camoto::stream::read_error("Compressed data is truncated");
+						}
+						this->ended = true;
+						break;
+					}
+				}
+				size_t ret = ZSTD_decompressStream(this->dctx, &out, &this->in);
+				if (ZSTD_isError(ret)) {
+					throw camoto::stream::read_error(std::string("Error decompressing "
+						"zstd data: ") + ZSTD_getErrorName(ret));
+				}
+				this->frameEnd = (ret == 0);
+				if (this->frameEnd && this->indexing) {
+					// The next frame starts here and can be decoded on its own
+					Checkpoint cp;
+					cp.out = this->decoderPos + out.pos;
+					cp.in = this->inPos - (this->in.size - this->in.pos);
+					cp.state = 0;
+					if (cp.out - this->checkpoints.back().out >= CHECKPOINT_SPAN) {
+						this->addCheckpoint(cp);
+					}
+				}
+			}
+			return out.pos;
+		}
+
+		ZSTD_DStream *dctx;          ///< zstd state
+		ZSTD_inBuffer in;            ///< Input buffer state
+		bool ended;                  ///< true at the end of the data
+		bool frameEnd;               ///< true if the last frame finished cleanly
+		camoto::stream::pos inPos;   ///< Offset of the next byte readInput() will return
+};
+
+#endif // HAVE_ZSTD
+
+std::shared_ptr<CompressedStream> CompressedStream::open(
+	const std::string& strFilename, std::shared_ptr<camoto::stream::input> raw)
+{
+	uint8_t sig[6];
+	memset(sig, 0, sizeof(sig));
+	raw->seekg(0, camoto::stream::start);
+	raw->try_read(sig, sizeof(sig));
+	raw->seekg(0, camoto::stream::start);
+
+	std::shared_ptr<CompressedStream> stream;
+#ifdef HAVE_ZLIB
+	if ((sig[0] == 0x1F) && (sig[1] == 0x8B)) {
+		stream = std::make_shared<GzipStream>(raw);
+	}
+#endif
+#ifdef HAVE_LZMA
+	if (memcmp(sig, "\xFD" "7zXZ\x00", 6) == 0) {
+		stream = std::make_shared<XzStream>(raw);
+	}
+#endif
+#ifdef HAVE_ZSTD
+	if (memcmp(sig, "\x28\xB5\x2F\xFD", 4) == 0) {
+		stream = std::make_shared<ZstdStream>(raw);
+	}
+#endif
+	if (stream) stream->openIndex(strFilename);
+	return stream;
+}
@@ -0,0 +1,189 @@
+/**
+ * @file   CompressedStream.hpp
+ * @brief  Read-only stream that transparently decompresses its parent.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMPRESSEDSTREAM_HPP_
+#define COMPRESSEDSTREAM_HPP_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <camoto/stream.hpp>
+
+/// Distance between checkpoints, in bytes of decompressed data.
+#define CHECKPOINT_SPAN  (1 << 20)
+
+/// Size of the block of decompressed data kept for repeated reads.
+#define DECODE_CHUNK     (1 << 16)
+
+/// Size of the buffer used to read compressed data.
+#define INPUT_BUFFER     (1 << 16)
+
+class MmapStream;
+
+/// Stream presenting the decompressed content of a gzip, xz or zstd file.
+/**
+ * The first time a file is opened, an index of decoder checkpoints is built.
+ * Seeking to an arbitrary offset only needs to decompress from the nearest
+ * checkpoint before that offset, rather than from the start of the file.
+ *
+ * For gzip, checkpoints are taken on deflate block boundaries roughly every
+ * CHECKPOINT_SPAN bytes, storing the 32kB window needed to resume decoding
+ * (the same approach as zlib's zran example.)  For xz and zstd, each block or
+ * frame is independent, so its start is used as a checkpoint.  A file
+ * compressed as a single xz block or zstd frame can only be read sequentially,
+ * so seeking backwards in one of those will restart from the beginning.
+ *
+ * The index is saved in ~/.cache/ll so that reopening the same (unmodified)
+ * file does not need to decompress the whole thing again.
+ */
+class CompressedStream: virtual public camoto::stream::inout
+{
+	public:
+		/// Open a stream if the given data is compressed.
+		/**
+		 * @param strFilename
+		 *   Filename of the compressed file, used to locate the cached index.
+		 *
+		 * @param raw
+		 *   Compressed data.
+		 *
+		 * @return A stream providing the decompressed data, or a NULL pointer if
+		 *   the data is not in a supported compressed format.
+		 *
+		 * @throw camoto::stream::error if the data looks compressed but the index
+		 *   could not be built.
+		 */
+		static std::shared_ptr<CompressedStream> open(
+			const std::string& strFilename,
+			std::shared_ptr<camoto::stream::input> raw);
+
+		virtual ~CompressedStream();
+
+		virtual camoto::stream::len try_read(uint8_t *buffer,
+			camoto::stream::len len);
+		virtual void seekg(camoto::stream::delta off,
+			camoto::stream::seek_from from);
+		virtual camoto::stream::pos tellg() const;
+		virtual camoto::stream::len size() const;
+
+		virtual camoto::stream::len try_write(const uint8_t *buffer,
+			camoto::stream::len len);
+		virtual void seekp(camoto::stream::delta off,
+			camoto::stream::seek_from from);
+		virtual camoto::stream::pos tellp() const;
+		virtual void truncate(camoto::stream::len size);
+		virtual void flush();
+
+		/// Short name of the compression format, e.g. "gzip".
+		virtual const char *getFormat() const = 0;
+
+	protected:
+		/// Position where decoding can resume without earlier data.
+		struct Checkpoint
+		{
+			camoto::stream::pos out; ///< Offset in decompressed data
+			camoto::stream::pos in;  ///< Offset in compressed data
+			int state;               ///< Format-specific (gzip: bits used in byte in-1, xz: check type)
+			std::vector<uint8_t> window; ///< Preceding data needed to resume (gzip only)
+		};
+
+		CompressedStream(std::shared_ptr<camoto::stream::input> raw);
+
+		/// Populate checkpoints and decodedSize from the compressed data.
+		/**
+		 * The default implementation decompresses the whole file, letting
+		 * decode() call addCheckpoint() as it goes.
+		 */
+		virtual void readIndex();
+
+		/// Prepare the decoder to produce data from the given checkpoint.
+		virtual void restart(const Checkpoint& cp) = 0;
+
+		/// Check that a checkpoint from a cached index can be passed to restart().
+		/**
+		 * loadIndex() has already checked that the checkpoints are in order, so
+		 * the default accepts anything.
+		 */
+		virtual bool validCheckpoint(const Checkpoint& cp) const;
+
+		/// Decompress the next block of data.
+		/**
+		 * @param buffer
+		 *   Destination for decompressed data.
+		 *
+		 * @param len
+		 *   Size of buffer.
+		 *
+		 * @return Number of bytes written to buffer, or 0 at the end of the data.
+		 *
+		 * @throw camoto::stream::read_error on corrupted data.
+		 */
+		virtual camoto::stream::len decode(uint8_t *buffer,
+			camoto::stream::len len) = 0;
+
+		/// Record a checkpoint while the index is being built.
+		void addCheckpoint(const Checkpoint& cp);
+
+		/// Build or load the index, and position the decoder at the start.
+		void openIndex(const std::string& strFilename);
+
+		/// Filename of the cached index for the given compressed file.
+		std::string indexFilename(const std::string& strFilename) const;
+
+		/// Load the index from the cache file, if it is still valid.
+		bool loadIndex(const std::string& strCache);
+
+		/// Write the index to the cache file.
+		void saveIndex(const std::string& strCache) const;
+
+		/// Decode the DECODE_CHUNK block of data containing the given offset.
+		void loadChunk(camoto::stream::pos target);
+
+		/// Get the next block of compressed data from the current raw offset.
+		/**
+		 * If the compressed file is memory-mapped, this points straight into the
+		 * mapping rather than copying the data into inbuf.
+		 *
+		 * @param next
+		 *   On return, points to the compressed data.
+		 *
+		 * @return Number of bytes available at *next, 0 at the end of the data.
+		 */
+		camoto::stream::len readInput(const uint8_t **next);
+
+		std::shared_ptr<camoto::stream::input> raw; ///< Compressed data
+		MmapStream *rawMap;           ///< raw, if it is memory-mapped, otherwise NULL
+		camoto::stream::len rawSize;  ///< Size of compressed data
+		int64_t rawMTime;             ///< Modification time of compressed file
+		bool indexing;                ///< true while readIndex() is running
+
+		std::vector<Checkpoint> checkpoints; ///< Sorted by Checkpoint::out
+		camoto::stream::len decodedSize;     ///< Length of decompressed data
+
+		camoto::stream::pos offset;     ///< Current read position
+		camoto::stream::pos decoderPos; ///< Offset of next byte decode() will produce
+
+		std::vector<uint8_t> chunk;     ///< Most recently decoded data
+		camoto::stream::pos chunkStart; ///< Offset of chunk[0] in decompressed data
+
+		uint8_t inbuf[INPUT_BUFFER];    ///< Compressed data, if raw is not mapped
+};
+
+#endif // COMPRESSEDSTREAM_HPP_
@@ -0,0 +1,169 @@
+/**
+ * @file   DeviceStream.cpp
+ * @brief  Read-only stream accessing a block device directly.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include "DeviceStream.hpp"
+
+/// Largest single read from the device, in bytes.
+#define DEVICE_BOUNCE (1 << 16)
+
+#define min(x, y) (((x) < (y)) ? (x) : (y))
+
+DeviceStream::DeviceStream(const std::string& strFilename)
+	:	fd(-1),
+		length(0),
+		offset(0),
+		sector(512),
+		bounce(NULL),
+		bounceLen(DEVICE_BOUNCE)
+{
+	// Not all devices or kernels support O_DIRECT, so fall back to normal reads
+	this->fd = ::open(strFilename.c_str(), O_RDONLY | O_DIRECT);
+	if ((this->fd < 0) && (errno == EINVAL)) {
+		this->fd = ::open(strFilename.c_str(), O_RDONLY);
+	}
+	if (this->fd < 0) {
+		throw camoto::stream::open_error(strerror(errno));
+	}
+
+	uint64_t bytes;
+	if (ioctl(this->fd, BLKGETSIZE64, &bytes) < 0) {
+		int e = errno;
+		::close(this->fd);
+		throw camoto::stream::open_error(std::string("Unable to get device size: ")
+			+ strerror(e));
+	}
+	this->length = bytes;
+
+	int ssz;
+	if ((ioctl(this->fd, BLKSSZGET, &ssz) == 0) && (ssz > 0)) {
+		this->sector = ssz;
+	}
+	if (this->bounceLen < this->sector) this->bounceLen = this->sector;
+
+	void *p;
+	if (posix_memalign(&p, this->sector, this->bounceLen) != 0) {
+		::close(this->fd);
+		throw camoto::stream::open_error("Out of memory");
+	}
+	this->bounce = (uint8_t *)p;
+}
+
+DeviceStream::~DeviceStream()
+{
+	free(this->bounce);
+	::close(this->fd);
+}
+
+camoto::stream::len DeviceStream::try_read(uint8_t *buffer,
+	camoto::stream::len len)
+{
+	camoto::stream::len total = 0;
+	while ((len > 0) && (this->offset < this->length)) {
+		// Read whole sectors around the requested data
+		camoto::stream::pos start = this->offset - (this->offset % this->sector);
+		unsigned int skip = this->offset - start;
+		ssize_t r = pread(this->fd, this->bounce, this->bounceLen, start);
+		if (r < 0) {
+			if (errno == EINTR) continue;
+			if (total) break; // return what we have, fail on the next read
+			throw camoto::stream::read_error(strerror(errno));
+		}
+		if ((unsigned int)r <= skip) break; // device shrank?
+		camoto::stream::len amt = min(len, (camoto::stream::len)(r - skip));
+		amt = min(amt, this->length - this->offset);
+		memcpy(buffer, this->bounce + skip, amt);
+		buffer += amt;
+		len -= amt;
+		total += amt;
+		this->offset += amt;
+	}
+	return total;
+}
+
+void DeviceStream::seekg(camoto::stream::delta off,
+	camoto::stream::seek_from from)
+{
+	camoto::stream::delta target;
+	switch (from) {
+		case camoto::stream::cur: target = this->offset + off; break;
+		case camoto::stream::end: target = this->length + off; break;
+		default: target = off; break;
+	}
+	if ((target < 0) || ((camoto::stream::pos)target > this->length)) {
+		throw camoto::stream::seek_error("Seek past end of device");
+	}
+	this->offset = target;
+	return;
+}
+
+camoto::stream::pos DeviceStream::tellg() const
+{
+	return this->offset;
+}
+
+camoto::stream::len DeviceStream::size() const
+{
+	return this->length;
+}
+
+camoto::stream::len DeviceStream::try_write(const uint8_t *buffer,
+	camoto::stream::len len)
+{
+	throw camoto::stream::write_error("Devices are opened read-only");
+}
+
+void DeviceStream::seekp(camoto::stream::delta off,
+	camoto::stream::seek_from from)
+{
+	this->seekg(off, from);
+	return;
+}
+
+camoto::stream::pos DeviceStream::tellp() const
+{
+	return this->offset;
+}
+
+void DeviceStream::truncate(camoto::stream::len size)
+{
+	throw camoto::stream::write_error("Devices are opened read-only");
+}
+
+void DeviceStream::flush()
+{
+	return;
+}
+
+int DeviceStream::getFd() const
+{
+	return this->fd;
+}
+
+unsigned int DeviceStream::getSectorSize() const
+{
+	return this->sector;
+}
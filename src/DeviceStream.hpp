@@ -0,0 +1,84 @@
+/**
+ * @file   DeviceStream.hpp
+ * @brief  Read-only stream accessing a block device directly.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DEVICESTREAM_HPP_
+#define DEVICESTREAM_HPP_
+
+#include <stdint.h>
+#include <string>
+#include <camoto/stream.hpp>
+
+/// Read-only stream reading a block device (disk, partition, etc.)
+/**
+ * The size of a block device isn't reported by stat(), so it is queried from
+ * the kernel instead.  Where possible the device is opened with O_DIRECT,
+ * bypassing the page cache so that what is seen is what is on the disk, and
+ * avoiding filling memory with data that is already cached by CachedStream.
+ * Direct reads must be aligned to the device's sector size, so any read is
+ * expanded to whole sectors.
+ */
+class DeviceStream: virtual public camoto::stream::inout
+{
+	public:
+		/// Open a block device.
+		/**
+		 * @param strFilename
+		 *   Device to open, e.g. /dev/sda1.
+		 *
+		 * @throw camoto::stream::open_error if the device could not be opened or
+		 *   its size could not be found.
+		 */
+		DeviceStream(const std::string& strFilename);
+
+		virtual ~DeviceStream();
+
+		virtual camoto::stream::len try_read(uint8_t *buffer,
+			camoto::stream::len len);
+		virtual void seekg(camoto::stream::delta off,
+			camoto::stream::seek_from from);
+		virtual camoto::stream::pos tellg() const;
+		virtual camoto::stream::len size() const;
+
+		/// @throw camoto::stream::write_error always, devices are read-only.
+		virtual camoto::stream::len try_write(const uint8_t *buffer,
+			camoto::stream::len len);
+		virtual void seekp(camoto::stream::delta off,
+			camoto::stream::seek_from from);
+		virtual camoto::stream::pos tellp() const;
+		/// @throw camoto::stream::write_error always, devices are read-only.
+		virtual void truncate(camoto::stream::len size);
+		virtual void flush();
+
+		/// Get the file descriptor of the open device.
+		int getFd() const;
+
+		/// Get the size of a sector, which reads must be aligned to.
+		unsigned int getSectorSize() const;
+
+	protected:
+		int fd;                        ///< Open device
+		camoto::stream::len length;    ///< Size of device in bytes
+		camoto::stream::pos offset;    ///< Current read position
+		unsigned int sector;           ///< Alignment needed for reads, in bytes
+		uint8_t *bounce;               ///< Aligned buffer of bounceLen bytes
+		unsigned int bounceLen;        ///< Size of bounce, a multiple of sector
+};
+
+#endif // DEVICESTREAM_HPP_
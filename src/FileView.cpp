@@ -19,14 +19,24 @@
  */
 
 #include <cassert>
+#include <iomanip>
 #include <sstream>
 #include <camoto/stream_file.hpp>
 #include "FileView.hpp"
+#include "CompressedStream.hpp"
+#include "DeviceStream.hpp"
+#include "Stats.hpp"
 
 FileView::FileView(std::string strFilename, std::shared_ptr<camoto::stream::inout> data,
 	IConsole *pConsole)
 	:	strFilename(strFilename),
+		readonly(false),
 		file(data, camoto::bitstream::littleEndian),
+		data(data),
+		map(NULL),
+		cache(dynamic_cast<CachedStream *>(data.get())),
+		spool(dynamic_cast<SpoolStream *>(data.get())),
+		showStats(false),
 		pConsole(pConsole),
 		bStatusAlertVisible(true), // trigger an update when next set
 		bitWidth(8),
@@ -34,23 +44,56 @@ FileView::FileView(std::string strFilename, std::shared_ptr<camoto::stream::inou
 		iOffset(0),
 		iFileSize(data->size())
 {
-/*
-	camoto::stream::file *file = dynamic_cast<camoto::stream::file *>(data.get());
-	if (file) this->readonly = file->readonly();
-	else this->readonly = true; // memory stream
-*/
+	// Look through the cache to see what kind of data it's holding
+	std::shared_ptr<camoto::stream::inout> source = data;
+	if (this->cache) {
+		source = this->cache->getParent();
+		this->prefetcher = std::make_shared<Prefetcher>(
+			std::dynamic_pointer_cast<CachedStream>(data));
+	}
+	this->map = dynamic_cast<MmapStream *>(source.get());
+
+	CompressedStream *compressed = dynamic_cast<CompressedStream *>(source.get());
+	if (compressed) {
+		// Show the format next to the filename, and don't allow edits.
+		this->strFilename += std::string(" (") + compressed->getFormat() + ")";
+		this->readonly = true;
+	}
+	if (this->map) this->readonly = true;
+	if (dynamic_cast<DeviceStream *>(source.get())) this->readonly = true;
+	if (this->spool) {
+		this->strFilename += " (streamed)";
+		this->readonly = true;
+	}
+
+	// Only plain files on disk can be sparse
+	if (this->map || dynamic_cast<camoto::stream::file *>(source.get())) {
+		try {
+			this->holes = std::make_shared<HoleMap>(strFilename);
+			if (this->holes->empty()) this->holes.reset();
+		} catch (const camoto::stream::open_error&) {
+			// Just show the holes as zeros
+		}
+	}
 }
 
 FileView::FileView(const FileView& parent)
 	:	strFilename(parent.strFilename),
 		readonly(parent.readonly),
 		file(parent.file),
+		data(parent.data),
+		map(parent.map),
+		cache(parent.cache),
+		spool(parent.spool),
+		holes(parent.holes),
+		prefetcher(parent.prefetcher),
+		showStats(parent.showStats),
 		pConsole(parent.pConsole),
 		bStatusAlertVisible(true), // trigger an update when next set
 		bitWidth(parent.bitWidth),
 		intraByteOffset(parent.intraByteOffset),
 		iOffset(parent.iOffset),
-		iFileSize(parent.iFileSize)
+		iFileSize(parent.data->size()) // may have grown since parent was created
 {
 }
 
@@ -90,6 +133,31 @@ void FileView::clearTextEntry()
 	return;
 }
 
+void FileView::idle()
+{
+	bool changed = false;
+	if (this->spool) {
+		camoto::stream::len newSize = this->data->size();
+		if (newSize != this->iFileSize) {
+			this->iFileSize = newSize;
+			this->redrawScreen();
+			changed = true;
+		} else if (this->spool->isComplete() && !this->spool->getError().empty()) {
+			std::string msg = "Error reading pipe: " + this->spool->getError();
+			this->statusAlert(msg.c_str());
+			this->spool = NULL; // only report it once
+			changed = true;
+		}
+	}
+	if (this->showStats) {
+		// Keep the counters moving while data is read in the background
+		this->updateStats();
+		changed = true;
+	}
+	if (changed) this->pConsole->update();
+	return;
+}
+
 void FileView::statusAlert(const char *cMsg)
 {
 	// If there's no status message and a blank has been requested, do nothing.
@@ -165,3 +233,95 @@ void FileView::setIntraByteOffset(int delta)
 	this->redrawScreen();
 	return;
 }
+
+void FileView::scrolled(camoto::stream::pos offset,
+	camoto::stream::delta delta, camoto::stream::len screen)
+{
+	if (this->prefetcher) this->prefetcher->scrolled(offset, delta, screen);
+	return;
+}
+
+void FileView::toggleStats()
+{
+	this->showStats = !this->showStats;
+	// Put back the content under the overlay, it will be drawn again if shown
+	if (!this->showStats) this->redrawScreen();
+	return;
+}
+
+/// Write a number of bytes in the most suitable unit.
+static std::string formatSize(unsigned long bytes)
+{
+	std::ostringstream ss;
+	if (bytes < 10 << 10) ss << bytes << " B";
+	else if (bytes < 10 << 20) ss << (bytes >> 10) << " KiB";
+	else ss << (bytes >> 20) << " MiB";
+	return ss.str();
+}
+
+/// Write a time in microseconds as milliseconds.
+static std::string formatMicros(unsigned long micros)
+{
+	std::ostringstream ss;
+	ss << micros / 1000 << '.' << std::setfill('0') << std::setw(3)
+		<< micros % 1000 << " ms";
+	return ss.str();
+}
+
+void FileView::updateStats()
+{
+	if (!this->showStats) return;
+
+	const Stats::Frame& frame = ::stats.lastFrame;
+	std::string cacheHits = "not cached", prefetch = "-";
+	if (this->cache) {
+		CachedStream::Stats cs = this->cache->getStats();
+		unsigned long reads = cs.hits + cs.misses;
+		std::ostringstream ss;
+		ss << (reads ? cs.hits * 100 / reads : 0) << '%';
+		cacheHits = ss.str();
+		ss.str("");
+		ss << (cs.prefetched ? cs.prefetchHits * 100 / cs.prefetched : 0)
+			<< "% of " << cs.prefetched;
+		prefetch = ss.str();
+	}
+
+	struct {
+		const char *label;
+		std::string value;
+	} lines[] = {
+		{"Last frame", formatMicros(frame.micros)},
+		{"  drawing", formatMicros(frame.drawMicros)},
+		{"  bytes read", std::to_string(frame.bytesRead)},
+		{"  bitstream reads", std::to_string(frame.bitstreamReads)},
+		{"  console calls", std::to_string(frame.consoleCalls)},
+		{"  cells changed", std::to_string(frame.cellsChanged)},
+		{"Cache hits", cacheHits},
+		{"Prefetch used", prefetch},
+		{"Index memory", formatSize(this->getIndexMemory())},
+	};
+	const int rows = sizeof(lines) / sizeof(lines[0]);
+
+	int iWidth, iHeight;
+	this->pConsole->getContentDims(&iWidth, &iHeight);
+	if ((iWidth < STATS_WIDTH * 2) || (iHeight < rows + 2)) return; // no room
+
+	// Top right corner, in the status bar colour so it stands out
+	AttrRuns runs(1);
+	runs[0].len = STATS_WIDTH;
+	runs[0].attr = ATTR_STATUSBAR;
+	for (int i = 0; i < rows; i++) {
+		std::ostringstream ss;
+		ss << ' ' << std::left << std::setw(18) << lines[i].label
+			<< std::right << std::setw(STATS_WIDTH - 20) << lines[i].value << ' ';
+		std::string text = ss.str().substr(0, STATS_WIDTH);
+		this->pConsole->gotoxy(iWidth - STATS_WIDTH, i);
+		this->pConsole->putstr(text, runs);
+	}
+	return;
+}
+
+unsigned long FileView::getIndexMemory() const
+{
+	return this->holes ? this->holes->getMemory() : 0;
+}
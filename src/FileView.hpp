@@ -26,6 +26,13 @@
 #include <camoto/bitstream.hpp>
 #include "IView.hpp"
 #include "IConsole.hpp"
+#include "MmapStream.hpp"
+#include "HoleMap.hpp"
+#include "Prefetcher.hpp"
+#include "SpoolStream.hpp"
+
+/// Width of the statistics overlay, in characters.
+#define STATS_WIDTH 34
 
 /// Common implementation for a file viewer.
 /**
@@ -67,6 +74,9 @@ class FileView: virtual public IView
 			unsigned int pos);
 		void clearTextEntry();
 
+		/// Redraw the screen if more data has arrived through a pipe.
+		virtual void idle();
+
 		/// Set an alert message on the status bar.
 		/**
 		 * @param cMsg
@@ -104,10 +114,43 @@ class FileView: virtual public IView
 		 */
 		void setIntraByteOffset(int delta);
 
+		/// Tell the prefetcher the view has moved through the file.
+		/**
+		 * @param offset
+		 *   Offset in bytes of the first byte now on the screen.
+		 *
+		 * @param delta
+		 *   Number of bytes moved, negative if towards the start of the file.
+		 *
+		 * @param screen
+		 *   Number of bytes visible on the screen.
+		 */
+		void scrolled(camoto::stream::pos offset, camoto::stream::delta delta,
+			camoto::stream::len screen);
+
+		/// Show or hide the statistics overlay.
+		void toggleStats();
+
+		/// Draw the statistics overlay over the content, if it is shown.
+		/**
+		 * This is drawn last, after the content, so it stays on top.
+		 */
+		virtual void updateStats();
+
+		/// Get the memory used by indexes into the file, in bytes.
+		virtual unsigned long getIndexMemory() const;
+
 	protected:
 		std::string strFilename;  ///< Filename of open file
 		bool readonly;            ///< Is the file open in read-only mode?
 		camoto::bitstream file;   ///< Bitstream for reading data from file
+		std::shared_ptr<camoto::stream::inout> data; ///< Underlying data, for byte-level reads
+		MmapStream *map;          ///< data, if it is memory-mapped, otherwise NULL
+		CachedStream *cache;      ///< data, if it is cached, otherwise NULL
+		SpoolStream *spool;       ///< data, if it is arriving from a pipe, otherwise NULL
+		std::shared_ptr<HoleMap> holes; ///< Holes in a sparse file, or NULL
+		std::shared_ptr<Prefetcher> prefetcher; ///< Read-ahead into cache, or NULL
+		bool showStats;           ///< Show the statistics overlay?
 		IConsole *pConsole;       ///< Console used for drawing content
 		bool bStatusAlertVisible; ///< true if an alert is visible in the status bar
 		int bitWidth;             ///< Number of bits in each char/cell
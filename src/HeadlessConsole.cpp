@@ -0,0 +1,346 @@
+/**
+ * @file   HeadlessConsole.cpp
+ * @brief  IConsole implementation that draws into memory only.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include "cp437.hpp"
+#include "HeadlessConsole.hpp"
+#include "Stats.hpp"
+
+HeadlessConsole::HeadlessConsole(int width, int height, std::istream& script,
+	std::ostream& frames)
+	:	script(script),
+		frames(frames),
+		scriptLine(0),
+		pending(Key_None),
+		repeat(0),
+		frameCount(0)
+{
+	memset(&this->counters, 0, sizeof(this->counters));
+	this->resizeGrid(width, height);
+}
+
+HeadlessConsole::~HeadlessConsole()
+{
+}
+
+void HeadlessConsole::mainLoop()
+{
+	for (;;) {
+		Key c;
+		if (this->repeat) {
+			c = this->pending;
+			this->repeat--;
+		} else if (!this->typing.empty()) {
+			c = (Key)(uint8_t)this->typing[0];
+			this->typing.erase(0, 1);
+		} else {
+			std::string line;
+			if (!std::getline(this->script, line)) return; // end of script
+			this->scriptLine++;
+
+			// Trim spaces from both ends
+			std::string::size_type start = line.find_first_not_of(" \t\r");
+			if (start == std::string::npos) continue;
+			line = line.substr(start, line.find_last_not_of(" \t\r") - start + 1);
+
+			if (line[0] == '#') continue;
+			if (line == "dump") {
+				this->dump(this->frames);
+				continue;
+			}
+			if (line == "idle") {
+				this->idle();
+				continue;
+			}
+			if (line.compare(0, 8, "section ") == 0) {
+				Section section;
+				section.name = line.substr(8);
+				section.bytesRead = 0;
+				this->sections.push_back(section);
+				continue;
+			}
+			if (line.compare(0, 7, "resize ") == 0) {
+				int width = 0, height = 0;
+				if ((sscanf(line.c_str() + 7, "%d %d", &width, &height) != 2)
+					|| (width < 16) || (height < 4)
+				) {
+					std::cerr << "Key script line " << this->scriptLine
+						<< ": bad size \"" << line << "\"" << std::endl;
+					continue;
+				}
+				this->resize(width, height);
+				continue;
+			}
+			if ((line[0] == '"') && (line.length() >= 2)
+				&& (line[line.length() - 1] == '"')
+			) {
+				this->typing = line.substr(1, line.length() - 2);
+				continue;
+			}
+
+			unsigned long count = 1;
+			std::string::size_type star = line.rfind('*');
+			if ((star != std::string::npos) && (star > 0)) {
+				char *end;
+				count = strtoul(line.c_str() + star + 1, &end, 10);
+				if (*end == '\0') line.erase(star);
+				else count = 1; // just a '*' key
+			}
+			c = HeadlessConsole::parseKey(line);
+			if (c == Key_None) {
+				std::cerr << "Key script line " << this->scriptLine
+					<< ": unknown key \"" << line << "\"" << std::endl;
+				continue;
+			}
+			this->pending = c;
+			this->repeat = count;
+			continue;
+		}
+		// A repeated key is treated as typeahead, all arriving at once
+		if (!this->press(c, this->repeat > 0)) return;
+	}
+}
+
+void HeadlessConsole::update(void)
+{
+	this->counters.update++;
+	this->BaseConsole::update();
+	return;
+}
+
+void HeadlessConsole::drawChanges()
+{
+	this->counters.draws++;
+	if (this->takeScroll()) this->counters.scrolls++;
+	for (std::vector<uint64_t>::const_iterator
+		i = this->dirty.begin(); i != this->dirty.end(); i++
+	) {
+		this->counters.cells += __builtin_popcountll(*i);
+	}
+	this->clearAllDirty();
+	return;
+}
+
+void HeadlessConsole::clearStatusBar(SB_Y eY)
+{
+	this->counters.statusBar++;
+	this->BaseConsole::clearStatusBar(eY);
+	return;
+}
+
+void HeadlessConsole::setStatusBar(SB_Y eY, SB_X eX,
+	const std::string& strMessage, int cursor)
+{
+	this->counters.statusBar++;
+	this->BaseConsole::setStatusBar(eY, eX, strMessage, cursor);
+	return;
+}
+
+void HeadlessConsole::gotoxy(int x, int y)
+{
+	this->counters.gotoxy++;
+	this->BaseConsole::gotoxy(x, y);
+	return;
+}
+
+void HeadlessConsole::putstr(const std::string& strContent)
+{
+	this->counters.putstr++;
+	this->counters.putstrChars += strContent.length();
+	this->BaseConsole::putstr(strContent);
+	return;
+}
+
+void HeadlessConsole::putstr(const std::string& strContent,
+	const AttrRuns& runs)
+{
+	this->counters.putstr++;
+	this->counters.putstrChars += strContent.length();
+	this->counters.attrRuns += runs.size();
+	this->BaseConsole::putstr(strContent, runs);
+	return;
+}
+
+void HeadlessConsole::scrollContent(int iX, int iY)
+{
+	this->counters.scrollContent++;
+	this->BaseConsole::scrollContent(iX, iY);
+	return;
+}
+
+void HeadlessConsole::eraseToEOL(void)
+{
+	this->counters.eraseToEOL++;
+	this->BaseConsole::eraseToEOL();
+	return;
+}
+
+void HeadlessConsole::setColoursFromConfig()
+{
+	return;
+}
+
+const HeadlessConsole::Counters& HeadlessConsole::getCounters() const
+{
+	return this->counters;
+}
+
+void HeadlessConsole::printCounters(std::ostream& out) const
+{
+	out << "keys: " << this->counters.keys
+		<< "\nupdate: " << this->counters.update
+		<< "\nscreen draws: " << this->counters.draws
+		<< "\ncells drawn: " << this->counters.cells
+		<< "\ndisplay scrolls: " << this->counters.scrolls
+		<< "\nputstr: " << this->counters.putstr
+		<< "\nputstr chars: " << this->counters.putstrChars
+		<< "\nputstr colour runs: " << this->counters.attrRuns
+		<< "\ngotoxy: " << this->counters.gotoxy
+		<< "\nscrollContent: " << this->counters.scrollContent
+		<< "\neraseToEOL: " << this->counters.eraseToEOL
+		<< "\nstatus bar: " << this->counters.statusBar
+		<< "\nbytes read: " << ::stats.bytesRead
+		<< std::endl;
+
+	for (std::vector<Section>::const_iterator
+		s = this->sections.begin(); s != this->sections.end(); s++
+	) {
+		if (s->latency.empty()) continue;
+		std::vector<unsigned long> sorted(s->latency);
+		std::sort(sorted.begin(), sorted.end());
+		unsigned long total = 0;
+		for (std::vector<unsigned long>::const_iterator
+			i = sorted.begin(); i != sorted.end(); i++
+		) {
+			total += *i;
+		}
+		// Nearest rank, so p99 of fewer than 100 keys is the slowest one
+		size_t n = sorted.size();
+		out << std::fixed << std::setprecision(1)
+			<< "time " << s->name << ": keys " << n
+			<< ", p50 " << sorted[(n * 50 + 99) / 100 - 1] / 1000.0 << " us"
+			<< ", p99 " << sorted[(n * 99 + 99) / 100 - 1] / 1000.0 << " us"
+			<< ", max " << sorted[n - 1] / 1000.0 << " us"
+			<< ", total " << total / 1000.0 << " us"
+			<< ", read " << s->bytesRead << " bytes"
+			<< std::endl;
+	}
+	return;
+}
+
+void HeadlessConsole::dump(std::ostream& out)
+{
+	out << "--- frame " << ++this->frameCount;
+	if (this->cursorVisible) {
+		out << ", cursor " << this->cursorX << "," << this->cursorY;
+	}
+	out << " ---\n";
+
+	std::string line;
+	for (int y = 0; y < this->screenHeight; y++) {
+		line.clear();
+		const Cell *row = &this->cells[y * this->screenWidth];
+		int len = this->screenWidth;
+		while ((len > 0) && ((row[len - 1].ch == 0) || (row[len - 1].ch == ' '))) {
+			len--;
+		}
+		char utf8[4];
+		for (int x = 0; x < len; x++) {
+			line.append(utf8, cp437_utf8(row[x].ch, utf8));
+		}
+		out << line << '\n';
+	}
+	out.flush();
+	return;
+}
+
+void HeadlessConsole::resize(int width, int height)
+{
+	this->resizeGrid(width, height);
+	this->cursorX = this->cursorY = 0;
+	this->view->init();
+	this->view->redrawScreen();
+	this->update();
+	return;
+}
+
+Key HeadlessConsole::parseKey(const std::string& name)
+{
+	static const struct {
+		const char *name;
+		Key key;
+	} names[] = {
+		{"Up", Key_Up},
+		{"Down", Key_Down},
+		{"Left", Key_Left},
+		{"Right", Key_Right},
+		{"PageUp", Key_PageUp},
+		{"PageDown", Key_PageDown},
+		{"Home", Key_Home},
+		{"End", Key_End},
+		{"Del", Key_Del},
+		{"Esc", Key_Esc},
+		{"Tab", Key_Tab},
+		{"Enter", Key_Enter},
+		{"Backspace", Key_Backspace},
+		{"Space", (Key)' '},
+		{"F1", Key_F1},
+		{"F10", Key_F10},
+	};
+	for (unsigned int i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (name == names[i].name) return names[i].key;
+	}
+	if (name.length() == 1) return (Key)(uint8_t)name[0];
+	if ((name.length() == 6) && (name.compare(0, 5, "Ctrl+") == 0)) {
+		char k = toupper(name[5]);
+		if ((k >= '@') && (k <= '_')) return (Key)CTRL(k);
+	}
+	if ((name.length() == 5) && (name.compare(0, 4, "Alt+") == 0)) {
+		return (Key)ALT(tolower(name[4]));
+	}
+	return Key_None;
+}
+
+bool HeadlessConsole::press(Key c, bool more)
+{
+	this->counters.keys++;
+	if (this->sections.empty()) {
+		Section section;
+		section.name = "keys";
+		section.bytesRead = 0;
+		this->sections.push_back(section);
+	}
+	// A prompt reads more of the script, which may start a new section
+	size_t current = this->sections.size() - 1;
+	unsigned long bytesRead = ::stats.bytesRead;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	bool ret = this->processQueuedKey(c, more);
+	Section& section = this->sections[current];
+	section.latency.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - start).count());
+	section.bytesRead += ::stats.bytesRead - bytesRead;
+	return ret;
+}
@@ -0,0 +1,156 @@
+/**
+ * @file   HeadlessConsole.hpp
+ * @brief  IConsole implementation that draws into memory only.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HEADLESSCONSOLE_HPP_
+#define HEADLESSCONSOLE_HPP_
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include "BaseConsole.hpp"
+
+/// Console with no display, for tests and benchmarks.
+/**
+ * Keys are read from a script instead of the keyboard, and the screen can be
+ * written out as text at any point so it can be compared against a known good
+ * copy.  Calls made by the views are counted, so the cost of drawing can be
+ * checked without a terminal or X server.  The time taken by each key,
+ * including drawing the result, is recorded for benchmarks.
+ *
+ * Each line of the script is one of:
+ *
+ *  - A key name, optionally followed by '*' and a repeat count, e.g.
+ *    "PageDown*100".  Names are Up, Down, Left, Right, PageUp, PageDown, Home,
+ *    End, Del, Esc, Tab, Enter, Backspace, Space, F1, F10, Ctrl+X, Alt+x, or
+ *    any single character.  The repeats arrive together, like keys typed
+ *    ahead while the program is busy, so the screen is only drawn after the
+ *    last one.
+ *  - Text in double quotes, typed one character at a time.
+ *  - "dump", to write the screen to the frame output.
+ *  - "idle", to let the view do background work as if no key was pressed.
+ *  - "resize <width> <height>", to change the screen size.
+ *  - "section <name>", to time the keys that follow separately from those
+ *    before, e.g. "section PageDown" before a run of PageDown keys.
+ *  - A blank line or one starting with '#', which is ignored.
+ */
+class HeadlessConsole: virtual public BaseConsole
+{
+	public:
+		/// Number of times each drawing function has been called.
+		struct Counters {
+			unsigned long keys;          ///< Keys passed to the view
+			unsigned long update;        ///< update()
+			unsigned long draws;         ///< Times the changes were drawn
+			unsigned long cells;         ///< Changed cells drawn
+			unsigned long scrolls;       ///< Scrolls passed on to the display
+			unsigned long putstr;        ///< putstr()
+			unsigned long putstrChars;   ///< Characters passed to putstr()
+			unsigned long attrRuns;      ///< Colour runs passed to putstr()
+			unsigned long gotoxy;        ///< gotoxy()
+			unsigned long scrollContent; ///< scrollContent()
+			unsigned long eraseToEOL;    ///< eraseToEOL()
+			unsigned long statusBar;     ///< setStatusBar() and clearStatusBar()
+		};
+
+		/// Create a console.
+		/**
+		 * @param width
+		 *   Screen width in characters.
+		 *
+		 * @param height
+		 *   Screen height in characters, including both status bars.
+		 *
+		 * @param script
+		 *   Keys to press.
+		 *
+		 * @param frames
+		 *   Where to write the screen when the script says "dump".
+		 */
+		HeadlessConsole(int width, int height, std::istream& script,
+			std::ostream& frames);
+		virtual ~HeadlessConsole();
+
+		void mainLoop();
+		void update(void);
+		void clearStatusBar(SB_Y eY);
+		void setStatusBar(SB_Y eY, SB_X eX, const std::string& strMessage,
+			int cursor);
+		void gotoxy(int x, int y);
+		void putstr(const std::string& strContent);
+		void putstr(const std::string& strContent, const AttrRuns& runs);
+		void scrollContent(int iX, int iY);
+		void eraseToEOL(void);
+		void setColoursFromConfig();
+
+		/// Get the call counts so far.
+		const Counters& getCounters() const;
+
+		/// Write the counters and key timings out as text, one per line.
+		void printCounters(std::ostream& out) const;
+
+		/// Write the screen out as text.
+		/**
+		 * Characters are converted from code page 437 to UTF-8, with control
+		 * characters shown as the glyphs the EGA font has for them.  The cursor
+		 * position is given in the line before the screen, if it is visible.
+		 */
+		void dump(std::ostream& out);
+
+		/// Change the screen size and redraw, as if a window was resized.
+		void resize(int width, int height);
+
+		/// Turn a key name from a script into a key code.
+		/**
+		 * @return The key, or Key_None if the name is not recognised.
+		 */
+		static Key parseKey(const std::string& name);
+
+	protected:
+		void drawChanges();
+
+		/// Pass a key to the view.
+		/**
+		 * @param more
+		 *   true if another key is waiting straight after this one.
+		 *
+		 * @return false if the view wants to exit.
+		 */
+		bool press(Key c, bool more);
+
+		std::istream& script;       ///< Keys to press
+		std::ostream& frames;       ///< Where to write the screen on request
+		unsigned int scriptLine;    ///< Line number in script, for errors
+		Key pending;                ///< Key still to be repeated
+		unsigned long repeat;       ///< Number of times to press pending
+		std::string typing;         ///< Characters still to be typed
+		unsigned long frameCount;   ///< Number of frames dumped
+
+		/// Timings for the keys in one part of the script.
+		struct Section {
+			std::string name;                  ///< Name given in the script
+			std::vector<unsigned long> latency; ///< Nanoseconds taken by each key
+			unsigned long bytesRead;           ///< Bytes read during these keys
+		};
+
+		Counters counters;          ///< Call counts
+		std::vector<Section> sections; ///< Key timings, current section last
+};
+
+#endif // HEADLESSCONSOLE_HPP_
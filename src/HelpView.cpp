@@ -36,16 +36,31 @@
 	"  Arrows     Scroll              S/s   Seek forward/back one bit\n" \
 	"  Home/End   Jump to start/end   E/e   Set big/little endian\n" \
 	"  Ctrl+L     Redraw screen       B/b   +/- num bits per cell\n" \
+	"  Ctrl+T     Show statistics     Alt+L LZW decode view\n" \
+	"                                 Alt+B Bitmap view (X11 only)\n" \
 	"\n" \
 	"  Set colours (help view only)   Hex-view keys\n" \
 	"  ~~~~~~~~~~~~~~~~~~~~~~~~~~~~   ~~~~~~~~~~~~~\n" \
 	"  F/f  Document foreground       Tab   Cycle edit mode\n" \
 	"  B/b  Document background       +/-   Alter line width\n" \
 	"  S/s  Status bar foreground     g     Go to offset (prefix 0=oct, 0x=hex)\n" \
-	"  C/c  Status bar background\n" \
-	"  H/h  Highlight foreground\n" \
-	"  M/m  Highlight background\n" \
-	"  d    Reset to default colours\n" \
+	"  C/c  Status bar background     d     Jump to next data after a hole\n" \
+	"  H/h  Highlight foreground      *     Collapse identical rows\n" \
+	"  M/m  Highlight background      Alt+N Next changed cell\n" \
+	"  d    Reset to default colours  Alt+Z Next cell not all 0s/1s\n" \
+	"\n" \
+	"  LZW-view keys\n" \
+	"  ~~~~~~~~~~~~~\n" \
+	"  W/w  +/- maximum code width    r     Set dictionary reset code\n" \
+	"  N/n  +/- initial code width    x     Set end-of-data code\n" \
+	"  k    Toggle early width change g     Go to decoded offset\n" \
+	"\n" \
+	"  Bitmap-view keys\n" \
+	"  ~~~~~~~~~~~~~~~~\n" \
+	"  +/-  Alter image width         p     Cycle palette\n" \
+	"  </>  Halve/double image width  P     Load palette from current offset\n" \
+	"  B/b  +/- bits per pixel        o     Toggle pixel order in byte\n" \
+	"  Z/z  +/- zoom                  r     Swap red and blue\n" \
 	"\n" \
 	"-= ASCII table =-\n" \
 	"\n" \
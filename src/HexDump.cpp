@@ -0,0 +1,313 @@
+/**
+ * @file   HexDump.cpp
+ * @brief  Write data out in the hex view's format, without a display.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <chrono>
+#include <thread>
+#include "HexDump.hpp"
+#include "CachedStream.hpp"
+#include "SpoolStream.hpp"
+#include "cp437.hpp"
+#include "Stats.hpp"
+
+#define min(x, y) (((x) < (y)) ? (x) : (y))
+#define max(x, y) (((x) > (y)) ? (x) : (y))
+
+/// How often to check whether more has arrived from a pipe, in milliseconds.
+#define DUMP_SPOOL_WAIT 10
+
+HexDump::HexDump(std::shared_ptr<camoto::stream::inout> data, int bitWidth,
+	camoto::bitstream::endian endian, int intraByteOffset, int lineWidth)
+	:	data(data),
+		decoder(bitWidth, endian),
+		bitWidth(bitWidth),
+		intraByteOffset(intraByteOffset),
+		lineWidth(lineWidth),
+		hexWidth((bitWidth + 3) / 4)
+{
+	for (int i = 0; i < 256; i++) {
+		this->glyphLen[i] = cp437_utf8(i, this->glyphs[i]);
+	}
+
+	// Longest a row can be, to work out how many fit in a chunk
+	int rowLen = 17 + this->lineWidth * (4 + this->hexWidth)
+		+ this->lineWidth / 8 + 3;
+	this->chunkCells = (camoto::stream::len)max(1, DUMP_CHUNK / rowLen)
+		* this->lineWidth;
+}
+
+void HexDump::write(int fd, camoto::stream::pos start, camoto::stream::pos end,
+	unsigned int jobs)
+{
+	this->start = start;
+	this->end = end;
+	if (jobs < 1) jobs = 1;
+
+	// Enough chunks that every thread can have one waiting while another is
+	// being written
+	Chunk empty;
+	empty.done = false;
+	empty.last = false;
+	this->chunks.assign(jobs * 2, empty);
+	this->nextChunk = 0;
+	this->written = 0;
+	this->finished = false;
+	this->stop = false;
+	this->error.clear();
+	this->errorChunk = 0;
+
+	std::vector<std::thread> threads;
+	for (unsigned int i = 0; i < jobs; i++) {
+		threads.emplace_back(&HexDump::worker, this);
+	}
+
+	auto finish = [&]() {
+		{
+			std::lock_guard<std::mutex> l(this->lock);
+			this->stop = true;
+		}
+		this->space.notify_all();
+		for (std::vector<std::thread>::iterator
+			i = threads.begin(); i != threads.end(); i++
+		) {
+			i->join();
+		}
+	};
+
+	std::string text;
+	try {
+		for (unsigned long index = 0;; index++) {
+			Chunk& c = this->chunks[index % this->chunks.size()];
+			bool last;
+			{
+				std::unique_lock<std::mutex> l(this->lock);
+				// Everything read before an error is still written out
+				this->ready.wait(l, [&]() {
+					return c.done || (!this->error.empty() && (index >= this->errorChunk));
+				});
+				if (!c.done) throw camoto::stream::read_error(this->error);
+
+				// Take the text, so the slot can be refilled while this is written
+				text.swap(c.text);
+				last = c.last;
+				c.done = false;
+				this->written++;
+			}
+			this->space.notify_all();
+
+			Stats::Timer output(Stats::Phase_Output);
+			const char *p = text.data();
+			size_t left = text.length();
+			while (left > 0) {
+				ssize_t r = ::write(fd, p, left);
+				if (r < 0) {
+					if (errno == EINTR) continue;
+					throw camoto::stream::write_error(strerror(errno));
+				}
+				p += r;
+				left -= r;
+			}
+			output.stop();
+			if (last) break;
+		}
+	} catch (...) {
+		finish();
+		throw;
+	}
+	finish();
+	return;
+}
+
+void HexDump::worker()
+{
+	std::vector<uint8_t> buf;
+	std::string text;
+	for (;;) {
+		unsigned long index;
+		unsigned int bit;
+		camoto::stream::len cells;
+		{
+			// Chunks are read one at a time and in order, as pipes and the
+			// streams themselves can only be read that way.
+			std::lock_guard<std::mutex> r(this->readLock);
+			{
+				std::unique_lock<std::mutex> l(this->lock);
+				this->space.wait(l, [&]() {
+					return this->stop
+						|| (this->nextChunk < this->written + this->chunks.size());
+				});
+				if (this->stop) return;
+			}
+			if (this->finished) return;
+			index = this->nextChunk++;
+			try {
+				cells = this->readChunk(index, buf, &bit);
+			} catch (const camoto::stream::error& e) {
+				this->finished = true;
+				std::lock_guard<std::mutex> l(this->lock);
+				this->error = e.get_message();
+				this->errorChunk = index;
+				this->ready.notify_all();
+				return;
+			}
+			if (cells < this->chunkCells) this->finished = true;
+		}
+
+		Stats::Timer format(Stats::Phase_Format);
+		this->formatRows(&buf[0], bit, this->start + index * this->chunkCells,
+			cells, text);
+		format.stop();
+
+		{
+			std::lock_guard<std::mutex> l(this->lock);
+			Chunk& c = this->chunks[index % this->chunks.size()];
+			c.text.swap(text);
+			c.done = true;
+			c.last = (cells < this->chunkCells);
+		}
+		this->ready.notify_all();
+	}
+}
+
+camoto::stream::len HexDump::readChunk(unsigned long index,
+	std::vector<uint8_t>& buf, unsigned int *bit)
+{
+	camoto::stream::pos first = this->start + index * this->chunkCells;
+	camoto::stream::len cells = this->chunkCells;
+	if (this->end != DUMP_TO_EOF) {
+		if (first >= this->end) return 0;
+		cells = min(cells, this->end - first);
+	}
+	camoto::stream::pos startBit = first * this->bitWidth + this->intraByteOffset;
+	camoto::stream::pos offset = startBit >> 3;
+	*bit = startBit & 7;
+	camoto::stream::len len = (*bit + cells * this->bitWidth + 7) >> 3;
+
+	// Room for CellDecoder to read a few bytes past the last cell
+	buf.resize(len + 8);
+
+	SpoolStream *spool = dynamic_cast<SpoolStream *>(this->data.get());
+	if (spool) {
+		// Wait for the pipe to catch up
+		spool->want(offset + len);
+		while ((spool->size() < offset + len) && !spool->isComplete()) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(DUMP_SPOOL_WAIT));
+		}
+		std::string message = spool->getError();
+		if (!message.empty()) throw camoto::stream::read_error(message);
+	}
+
+	camoto::stream::len got = 0;
+	CachedStream *cache = dynamic_cast<CachedStream *>(this->data.get());
+	if (offset >= this->data->size()) {
+		// Past the end, where some streams can't even seek to
+	} else if (cache) {
+		// Each block is only read once, so don't push anything out of the cache.
+		// This bypasses the cache's own count of bytes read.
+		got = cache->readDirect(offset, &buf[0], len);
+		::stats.bytesRead += got;
+	} else {
+		this->data->seekg(offset, camoto::stream::start);
+		while (got < len) {
+			camoto::stream::len r = this->data->try_read(&buf[got], len - got);
+			if (r == 0) break;
+			got += r;
+		}
+	}
+	memset(&buf[got], 0, buf.size() - got);
+
+	// Only whole cells are shown, as in the hex view
+	camoto::stream::len bits = got * 8;
+	if (bits < *bit + cells * this->bitWidth) {
+		cells = (bits > *bit) ? (bits - *bit) / this->bitWidth : 0;
+	}
+	return cells;
+}
+
+void HexDump::formatRows(const uint8_t *in, unsigned int bit,
+	camoto::stream::pos offset, camoto::stream::len cells,
+	std::string& out) const
+{
+	static const char hexDigits[] = "0123456789ABCDEF";
+
+	// Longest a row can be: up to 16 offset digits, the cells with an extra
+	// space every eight, and up to three bytes of UTF-8 for each character.
+	size_t rowMax = 17 + this->lineWidth * (1 + this->hexWidth)
+		+ this->lineWidth / 8 + 2 + this->lineWidth * 3 + 1;
+	camoto::stream::len rows = (cells + this->lineWidth - 1) / this->lineWidth;
+	out.resize(rows * rowMax);
+	char *p = &out[0];
+
+	// The text column, built up alongside the hex digits.  The glyphs are
+	// always copied four bytes at a time.
+	std::vector<char> textBuf(this->lineWidth * 3 + 4);
+	camoto::stream::pos pos = bit;
+	for (camoto::stream::len row = 0; row < rows; row++) {
+		// Offset, at least eight digits as in the hex view
+		int digits = 8;
+		while ((digits < 16) && (offset >> (digits * 4))) digits++;
+		for (int d = digits - 1; d >= 0; d--) {
+			*p++ = hexDigits[(offset >> (d * 4)) & 15];
+		}
+		*p++ = ' ';
+
+		char *t = &textBuf[0];
+		int len = min(cells, (camoto::stream::len)this->lineWidth);
+		for (int i = 0; i < this->lineWidth; i++) {
+			*p++ = ' ';
+			if (i && (i % 8 == 0)) *p++ = ' ';
+			if (i < len) {
+				unsigned int v = this->decoder.get(in + (pos >> 3), pos & 7);
+				pos += this->bitWidth;
+				unsigned int h = v;
+				for (int d = this->hexWidth - 1; d >= 0; d--) {
+					p[d] = hexDigits[h & 15];
+					h >>= 4;
+				}
+				p += this->hexWidth;
+
+				if (v < 256) {
+					uint8_t c = v ? v : ' ';
+					memcpy(t, this->glyphs[c], 4);
+					t += this->glyphLen[c];
+				} else {
+					*t++ = '.'; // TODO: some non-ASCII char
+				}
+			} else {
+				// Pad out any data at the end of the file
+				memset(p, ' ', this->hexWidth);
+				p += this->hexWidth;
+				*t++ = ' ';
+			}
+		}
+		*p++ = ' ';
+		*p++ = ' ';
+		memcpy(p, &textBuf[0], t - &textBuf[0]);
+		p += t - &textBuf[0];
+		*p++ = '\n';
+
+		cells -= len;
+		offset += this->lineWidth;
+	}
+	out.resize(p - &out[0]);
+	return;
+}
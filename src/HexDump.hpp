@@ -0,0 +1,177 @@
+/**
+ * @file   HexDump.hpp
+ * @brief  Write data out in the hex view's format, without a display.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HEXDUMP_HPP_
+#define HEXDUMP_HPP_
+
+#include <stdint.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <camoto/stream.hpp>
+#include "CellDecoder.hpp"
+
+/// Approximate amount of text formatted by each thread at a time, in bytes.
+#define DUMP_CHUNK (4 << 20)
+
+/// Pass as the end to dump everything up to the end of the data.
+#define DUMP_TO_EOF ((camoto::stream::pos)-1)
+
+/// Writes rows exactly as the hex view draws them, for use in pipelines.
+/**
+ * The rows are split into chunks of a few megabytes of text each, which are
+ * read in order but formatted by several threads at once.  Each chunk is
+ * written out with a single write() once all the ones before it have been,
+ * so the output is in order however the threads finish.  Only a few chunks
+ * per thread are held at once, so memory use doesn't grow with the file.
+ *
+ * The text column is converted from code page 437 to UTF-8, the same as the
+ * screen shows it.
+ */
+class HexDump
+{
+	public:
+		/// Set up the row format.
+		/**
+		 * @param data
+		 *   Data to dump.
+		 *
+		 * @param bitWidth
+		 *   Number of bits in each cell, 1 to 32.
+		 *
+		 * @param endian
+		 *   Bit order, as passed to camoto::bitstream.
+		 *
+		 * @param intraByteOffset
+		 *   Bit in the first byte where cell 0 starts, less than bitWidth.
+		 *
+		 * @param lineWidth
+		 *   Number of cells on each row.
+		 */
+		HexDump(std::shared_ptr<camoto::stream::inout> data, int bitWidth,
+			camoto::bitstream::endian endian, int intraByteOffset, int lineWidth);
+
+		/// Write the rows out.
+		/**
+		 * @param fd
+		 *   Where to write the text.
+		 *
+		 * @param start
+		 *   First cell to dump.  Rows start here, as they do in the hex view when
+		 *   scrolled to this cell.
+		 *
+		 * @param end
+		 *   Stop before this cell, or DUMP_TO_EOF.
+		 *
+		 * @param jobs
+		 *   Number of threads formatting chunks at once.
+		 *
+		 * @throw camoto::stream::read_error
+		 *   The data could not be read.
+		 *
+		 * @throw camoto::stream::write_error
+		 *   The text could not be written.
+		 */
+		void write(int fd, camoto::stream::pos start, camoto::stream::pos end,
+			unsigned int jobs);
+
+	protected:
+		/// One chunk of rows, on its way to being written.
+		struct Chunk {
+			std::string text;          ///< Formatted rows
+			bool done;                 ///< text is ready to write
+			bool last;                 ///< No chunks follow this one
+		};
+
+		/// Thread taking chunks in turn, reading them and formatting them.
+		void worker();
+
+		/// Read the data for one chunk.
+		/**
+		 * Must be called with readLock held, and for each chunk in order.
+		 *
+		 * @param index
+		 *   Chunk number, from 0.
+		 *
+		 * @param buf
+		 *   On return, the bytes holding the chunk's cells, plus padding so
+		 *   CellDecoder can read past the last one.
+		 *
+		 * @param bit
+		 *   On return, the bit in buf[0] where the first cell starts.
+		 *
+		 * @return Number of whole cells read.  Less than chunkCells if the end
+		 *   was reached.
+		 */
+		camoto::stream::len readChunk(unsigned long index,
+			std::vector<uint8_t>& buf, unsigned int *bit);
+
+		/// Turn cells into rows of text.
+		/**
+		 * @param in
+		 *   Data holding the cells.
+		 *
+		 * @param bit
+		 *   Bit in in[0] where the first cell starts.
+		 *
+		 * @param offset
+		 *   Number of the first cell, for the offset column.
+		 *
+		 * @param cells
+		 *   Number of cells to format.  The last row is padded if this is not a
+		 *   whole number of rows.
+		 *
+		 * @param out
+		 *   Replaced with the text.
+		 */
+		void formatRows(const uint8_t *in, unsigned int bit,
+			camoto::stream::pos offset, camoto::stream::len cells,
+			std::string& out) const;
+
+		std::shared_ptr<camoto::stream::inout> data; ///< Data being dumped
+		CellDecoder decoder;           ///< Extracts cells from the data
+		int bitWidth;                  ///< Bits per cell
+		int intraByteOffset;           ///< Bit where cell 0 starts
+		int lineWidth;                 ///< Cells per row
+		int hexWidth;                  ///< Hex digits per cell
+
+		char glyphs[256][4];           ///< UTF-8 for each code page 437 character
+		uint8_t glyphLen[256];         ///< Number of bytes used in glyphs
+
+		camoto::stream::pos start;     ///< First cell being dumped
+		camoto::stream::pos end;       ///< Cell to stop before, or DUMP_TO_EOF
+		camoto::stream::len chunkCells; ///< Cells in each chunk, whole rows
+
+		std::mutex readLock;           ///< Held while reading a chunk
+		unsigned long nextChunk;       ///< Next chunk to be read
+		bool finished;                 ///< The end has been read
+
+		std::mutex lock;               ///< Protects everything below
+		std::condition_variable ready; ///< Signalled when a chunk is done
+		std::condition_variable space; ///< Signalled when a chunk is written
+		std::vector<Chunk> chunks;     ///< Chunks in progress, by index % size
+		unsigned long written;         ///< Number of chunks written so far
+		bool stop;                     ///< Threads should give up
+		std::string error;             ///< Read error from a thread, if any
+		unsigned long errorChunk;      ///< Chunk that couldn't be read
+};
+
+#endif // HEXDUMP_HPP_
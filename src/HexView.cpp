@@ -23,6 +23,9 @@
 #include "HexView.hpp"
 #include "TextView.hpp"
 #include "HelpView.hpp"
+#include "LZWView.hpp"
+#include "BitmapView.hpp"
+#include "Stats.hpp"
 #include "cfg.hpp"
 
 #define min(x, y) (((x) < (y)) ? (x) : (y))
@@ -39,7 +42,12 @@ HexView::HexView(std::string strFilename,
 		pLineBuffer(NULL),
 		cursorOffset(0),
 		editMode(View),
-		hexEditOffset(0)
+		hexEditOffset(0),
+		collapseRuns(false),
+		runsNeeded(0),
+		highlightCell(0),
+		highlightBitWidth(0),
+		highlightIntra(0)
 {
 	this->pLineBuffer = new unsigned int[this->iLineAlloc];
 }
@@ -51,13 +59,19 @@ HexView::HexView(const FileView& parent)
 		pLineBuffer(NULL),
 		cursorOffset(0),
 		editMode(View),
-		hexEditOffset(0)
+		hexEditOffset(0),
+		collapseRuns(false),
+		runsNeeded(0),
+		highlightCell(0),
+		highlightBitWidth(0),
+		highlightIntra(0)
 {
 	this->pLineBuffer = new unsigned int[this->iLineAlloc];
 }
 
 HexView::~HexView()
 {
+	this->runs.reset(); // stop the search before the data goes
 	this->file.flush();
 	assert(this->pLineBuffer != NULL);
 	delete[] this->pLineBuffer;
@@ -79,9 +93,12 @@ bool HexView::processKey(Key c)
 		case Key_F10:
 			return false;
 		case Key_Tab: this->cycleEditMode(); break;
-		case Key_PageUp: this->scrollRel(-this->iLineWidth*iHeight); break;
-		case Key_PageDown: this->scrollRel(this->iLineWidth*iHeight); break;
+		case Key_PageUp: this->scrollRows(-iHeight); break;
+		case Key_PageDown: this->scrollRows(iHeight); break;
 		case CTRL('L'): this->redrawScreen(); break;
+		case CTRL('T'): this->toggleStats(); break;
+		case ALT('n'): this->jumpToCell(CellFinder::Change); break;
+		case ALT('z'): this->jumpToCell(CellFinder::NonBlank); break;
 		case Key_F1: {
 			IViewPtr newView(new HelpView(this->pConsole));
 			this->pConsole->pushView(newView);
@@ -151,6 +168,8 @@ bool HexView::processKey(Key c)
 				case 'e': this->file.changeEndian(camoto::bitstream::littleEndian); this->redrawScreen(); break;
 				case 'E': this->file.changeEndian(camoto::bitstream::bigEndian); this->redrawScreen(); break;
 				case 'g': this->gotoOffset(); break;
+				case 'd': this->jumpToData(); break;
+				case '*': this->toggleRuns(); break;
 				case ALT('h'): {
 					this->file.flush();
 					IViewPtr newView(new TextView(*this));
@@ -158,8 +177,25 @@ bool HexView::processKey(Key c)
 					::cfg.view = View_Text;
 					break;
 				}
-				case Key_Up: this->scrollRel(-this->iLineWidth); break;
-				case Key_Down: this->scrollRel(this->iLineWidth); break;
+				case ALT('l'): {
+					this->file.flush();
+					IViewPtr newView(new LZWView(*this));
+					this->pConsole->pushView(newView);
+					break;
+				}
+				case ALT('b'): {
+					int fbWidth, fbHeight, fbStride;
+					if (!this->pConsole->getFramebuffer(&fbWidth, &fbHeight, &fbStride)) {
+						this->statusAlert("This display cannot show images");
+						break;
+					}
+					this->file.flush();
+					IViewPtr newView(new BitmapView(*this));
+					this->pConsole->pushView(newView);
+					break;
+				}
+				case Key_Up: this->scrollRows(-1); break;
+				case Key_Down: this->scrollRows(1); break;
 				case Key_Left: this->scrollRel(-1); break;
 				case Key_Right: this->scrollRel(1); break;
 				case Key_Home: this->scrollAbs(0); break;
@@ -167,6 +203,15 @@ bool HexView::processKey(Key c)
 					unsigned long sizeInCells = (this->iFileSize << 3) / this->bitWidth;
 					int iLastLineLen = sizeInCells % this->iLineWidth;
 					if (iLastLineLen == 0) iLastLineLen = this->iLineWidth;
+					if (this->collapseRows()) {
+						// Count back by rows, as some may cover more than a line's worth
+						camoto::stream::pos row = sizeInCells - iLastLineLen;
+						for (int i = 0; (i < iHeight - 2) && (row > 0); i++) {
+							row = this->prevRow(row);
+						}
+						this->scrollAbs(row);
+						break;
+					}
 					this->scrollAbs(sizeInCells - iLastLineLen -
 						(iHeight - 2) * this->iLineWidth);
 					break;
@@ -175,6 +220,7 @@ bool HexView::processKey(Key c)
 			}
 			break;
 	} // switch (editMode)
+	this->updateStats();
 	this->pConsole->update();
 	return true; // true == keep going (don't quit)
 }
@@ -185,6 +231,9 @@ void HexView::redrawScreen()
 	this->pConsole->getContentDims(&iWidth, &iHeight);
 	this->showCursor(false);
 
+	// The row length may have changed
+	this->updateRuns(false);
+
 	this->updateHeader();
 	this->redrawLines(0, iHeight);
 
@@ -192,6 +241,35 @@ void HexView::redrawScreen()
 	return;
 }
 
+void HexView::idle()
+{
+	this->FileView::idle();
+	if (!this->runsNeeded) return;
+	if ((this->runs->getProgress() < this->runsNeeded) && !this->runs->isComplete()) {
+		return;
+	}
+	this->runsNeeded = 0;
+	this->redrawScreen();
+	this->updateStats();
+	this->pConsole->update();
+	return;
+}
+
+void HexView::updateStats()
+{
+	if (!this->showStats) return;
+	this->FileView::updateStats();
+	this->showCursor(true);
+	return;
+}
+
+unsigned long HexView::getIndexMemory() const
+{
+	unsigned long total = this->FileView::getIndexMemory();
+	if (this->runs) total += this->runs->getMemory();
+	return total;
+}
+
 void HexView::generateHeader(std::ostringstream& ss)
 {
 	this->FileView::generateHeader(ss);
@@ -277,8 +355,9 @@ void HexView::scrollRel(camoto::stream::delta iDelta)
 		// No, we're only scrolling by a multiple of exact lines.
 		int iLines = iDelta / this->iLineWidth;
 		assert(iLines != 0);
-		if (abs(iLines) >= iHeight) {
-			// But we're scrolling by more than a screenful, so we'll need to
+		if ((abs(iLines) >= iHeight) || this->collapseRows()) {
+			// But we're scrolling by more than a screenful (or some of the lines
+			// are collapsed so we don't know how many rows moved), so we'll need to
 			// redraw the whole screen anyway.
 			this->iOffset += iDelta;
 			this->redrawLines(0, iHeight);
@@ -296,6 +375,11 @@ void HexView::scrollRel(camoto::stream::delta iDelta)
 		}
 	}
 
+	// Let the read-ahead know where we're heading, now the visible data has
+	// been read.
+	this->scrolled((this->iOffset * this->bitWidth) >> 3,
+		iDelta * this->bitWidth / 8, (iScreenSize * this->bitWidth) >> 3);
+
 	this->updateHeader();
 
 	// Make sure cursor stays within limits
@@ -304,11 +388,179 @@ void HexView::scrollRel(camoto::stream::delta iDelta)
 	return;
 }
 
+void HexView::scrollRows(int rows)
+{
+	if (!this->collapseRows()) {
+		this->scrollRel((camoto::stream::delta)rows * this->iLineWidth);
+		return;
+	}
+
+	int iWidth, iHeight;
+	this->pConsole->getContentDims(&iWidth, &iHeight);
+	camoto::stream::pos sizeInCells = (this->iFileSize << 3) / this->bitWidth;
+
+	camoto::stream::pos target = this->iOffset;
+	int moved = 0;
+	if (rows < 0) {
+		while ((moved > rows) && (target > 0)) {
+			target = this->prevRow(target);
+			moved--;
+		}
+		if (moved > rows) this->statusAlert("Top of file");
+	} else {
+		while (moved < rows) {
+			camoto::stream::pos next = this->nextRow(target);
+			if (next >= sizeInCells) break; // can't start a row past EOF
+			target = next;
+			moved++;
+		}
+		if (moved < rows) this->statusAlert("End of file");
+	}
+	if (moved == 0) return;
+
+	camoto::stream::delta iDelta = target - this->iOffset;
+	if (abs(moved) >= iHeight) {
+		this->iOffset = target;
+		this->redrawLines(0, iHeight);
+	} else {
+		this->pConsole->scrollContent(0, moved);
+		this->iOffset = target;
+		if (moved < 0) {
+			this->redrawLines(0, -moved);
+		} else {
+			this->redrawLines(iHeight - moved, iHeight);
+		}
+	}
+
+	this->scrolled((this->iOffset * this->bitWidth) >> 3,
+		iDelta * this->bitWidth / 8,
+		((camoto::stream::pos)iHeight * this->iLineWidth * this->bitWidth) >> 3);
+	this->updateHeader();
+	return;
+}
+
+bool HexView::collapseRows() const
+{
+	return (this->holes || this->runs) && (this->editMode == View);
+}
+
+void HexView::toggleRuns()
+{
+	this->collapseRuns = !this->collapseRuns;
+	this->updateRuns(false);
+	this->redrawScreen();
+	if (!this->collapseRuns) {
+		this->statusAlert("Showing all rows");
+	} else if (this->runs) {
+		this->statusAlert("Collapsing identical rows");
+	} else {
+		this->statusAlert("Rows must be a whole number of bytes to collapse");
+	}
+	return;
+}
+
+void HexView::updateRuns(bool force)
+{
+	unsigned long rowBits = this->iLineWidth * this->bitWidth;
+	if (
+		!this->collapseRuns
+		|| (rowBits % 8)
+		// The search runs in the background, so only do it when the data can
+		// safely be read from another thread.
+		|| !(this->cache || this->map || this->spool)
+	) {
+		this->runs.reset();
+		return;
+	}
+	if (!force && this->runs && (this->runs->getPeriod() == rowBits / 8)) return;
+
+	this->runs.reset(); // stop the old search first
+	this->runs = std::make_shared<RunMap>(this->data, this->holes, rowBits / 8);
+	this->runsNeeded = 0;
+	return;
+}
+
+camoto::stream::pos HexView::nextRow(camoto::stream::pos row, RowType *type)
+{
+	if (type) *type = Row_Data;
+	if (!this->collapseRows()) return row + this->iLineWidth;
+
+	// Bytes the row would show, including any partial bytes at either end
+	camoto::stream::pos firstBit = row * this->bitWidth + this->intraByteOffset;
+	camoto::stream::pos first = firstBit >> 3;
+	camoto::stream::pos last = (firstBit + this->iLineWidth * this->bitWidth + 7) >> 3;
+
+	camoto::stream::pos holeStart, holeEnd;
+	if (
+		this->holes
+		&& this->holes->find(first, &holeStart, &holeEnd)
+		&& (holeEnd >= last)
+	) {
+		// The whole row is in a hole, so this row stands in for every following
+		// row that is also entirely in the hole.
+		camoto::stream::pos cellsInHole = ((holeEnd << 3) - this->intraByteOffset)
+			/ this->bitWidth - row;
+		if (type) *type = Row_Hole;
+		return row + cellsInHole - (cellsInHole % this->iLineWidth);
+	}
+
+	camoto::stream::pos runStart, runEnd;
+	if (
+		this->runs
+		&& (row >= (camoto::stream::pos)this->iLineWidth)
+		// Is every bit of the row above the same as the one below it?
+		&& this->runs->find(
+			(firstBit - this->iLineWidth * this->bitWidth) >> 3,
+			(firstBit + 7) >> 3, &runStart, &runEnd)
+	) {
+		// This row stands in for every row after it that is the same as the one
+		// above, i.e. up to the last row starting inside the run.
+		camoto::stream::pos lastRow = ((runEnd << 3) - this->intraByteOffset)
+			/ this->bitWidth;
+		if (type) *type = Row_Repeat;
+		return lastRow - ((lastRow - row) % this->iLineWidth) + this->iLineWidth;
+	}
+
+	return row + this->iLineWidth;
+}
+
+camoto::stream::pos HexView::prevRow(camoto::stream::pos row)
+{
+	if (row <= (camoto::stream::pos)this->iLineWidth) return 0;
+	camoto::stream::pos prev = row - this->iLineWidth;
+	if (!this->collapseRows()) return prev;
+
+	RowType type;
+	this->nextRow(prev, &type);
+	if (type == Row_Data) return prev;
+
+	// The row above is collapsed, so go back to the first row of the hole or
+	// run, keeping the rows lined up with this one.
+	camoto::stream::pos prevBit = prev * this->bitWidth + this->intraByteOffset;
+	camoto::stream::pos start, end;
+	camoto::stream::pos firstBit;
+	if (type == Row_Hole) {
+		this->holes->find(prevBit >> 3, &start, &end);
+		firstBit = start << 3;
+	} else {
+		this->runs->find((prevBit - this->iLineWidth * this->bitWidth) >> 3,
+			(prevBit + 7) >> 3, &start, &end);
+		// The first repeated row is the one after the row the run starts in
+		firstBit = (start << 3) + this->iLineWidth * this->bitWidth;
+	}
+	camoto::stream::pos cell = (firstBit <= (camoto::stream::pos)this->intraByteOffset) ? 0 :
+		(firstBit - this->intraByteOffset + this->bitWidth - 1) / this->bitWidth;
+	cell += (row + this->iLineWidth - (cell % this->iLineWidth)) % this->iLineWidth;
+	return min(cell, prev);
+}
+
 void HexView::redrawLines(int iTop, int iBottom)
 {
+	Stats::Timer timer(Stats::Phase_Format);
 	this->showCursor(false);
 	int y = iTop;
-	camoto::stream::pos iCurOffset = this->iOffset + iTop * this->iLineWidth;
+	camoto::stream::pos iCurOffset = this->iOffset;
+	for (int i = 0; i < iTop; i++) iCurOffset = this->nextRow(iCurOffset);
 	file.seek(iCurOffset * this->bitWidth + this->intraByteOffset, camoto::stream::start);
 
 	// Convert the offset from whatever bitwidth we're currently using into bytes
@@ -318,10 +570,36 @@ void HexView::redrawLines(int iTop, int iBottom)
 	if (offsetInBytes <= this->iFileSize) {
 		for (; y < iBottom; y++) {
 
+			RowType type;
+			camoto::stream::pos iNextOffset = this->nextRow(iCurOffset, &type);
+			if (type == Row_Hole) {
+				this->drawHoleLine(y, iCurOffset,
+					((iNextOffset - iCurOffset) * this->bitWidth) >> 3);
+				iCurOffset = iNextOffset;
+				if (((iCurOffset * this->bitWidth) >> 3) >= this->iFileSize) {
+					y++;
+					break; // hole runs to EOF
+				}
+				file.seek(iCurOffset * this->bitWidth + this->intraByteOffset,
+					camoto::stream::start);
+				continue;
+			}
+			if (type == Row_Repeat) {
+				this->drawRepeatLine(y, iCurOffset,
+					(iNextOffset - iCurOffset) / this->iLineWidth);
+				iCurOffset = iNextOffset;
+				file.seek(iCurOffset * this->bitWidth + this->intraByteOffset,
+					camoto::stream::start);
+				continue;
+			}
+
 			int iRead;
+			Stats::Timer decode(Stats::Phase_Decode);
 			for (iRead = 0; iRead < this->iLineWidth; iRead++) {
 				if (!file.read(this->bitWidth, &this->pLineBuffer[iRead])) break;
 			}
+			decode.stop();
+			::stats.bitstreamReads += iRead;
 
 			this->drawLine(y, iCurOffset, this->pLineBuffer, iRead);
 			if (iRead < this->iLineWidth) {
@@ -337,6 +615,16 @@ void HexView::redrawLines(int iTop, int iBottom)
 		this->pConsole->eraseToEOL();
 	}
 	this->showCursor(true);
+
+	// If the search for identical rows hasn't got this far yet, draw it again
+	// once it has.
+	if (this->runs && !this->runs->isComplete()) {
+		camoto::stream::pos drawn = ((iCurOffset * this->bitWidth
+			+ this->intraByteOffset) >> 3) + this->runs->getPeriod();
+		if (this->runs->getProgress() < drawn) {
+			this->runsNeeded = max(this->runsNeeded, drawn);
+		}
+	}
 	return;
 }
 
@@ -355,6 +643,17 @@ void HexView::drawLine(int iLine, unsigned long iOffset,
 	// Number of chars wide each num is (e.g. 9-bit nums are three chars wide)
 	int cellNumberWidth = CALC_HEXCELL_WIDTH;
 
+	// Cell on this line to highlight, if any
+	int highlight = -1, highlightPos = 0;
+	if (
+		(this->highlightBitWidth == this->bitWidth)
+		&& (this->highlightIntra == this->intraByteOffset)
+		&& (this->highlightCell >= iOffset)
+		&& (this->highlightCell < iOffset + iLen)
+	) {
+		highlight = this->highlightCell - iOffset;
+	}
+
 	const unsigned int *pb = pData;
 	for (int i = 0; i < iLen; pb++, i++) {
 
@@ -362,6 +661,7 @@ void HexView::drawLine(int iLine, unsigned long iOffset,
 
 		osHex << ((i && (i % 8 == 0)) ? "  " : " ");
 		//else if (i % 4 == 0) ostr << ' ';
+		if (i == highlight) highlightPos = osHex.tellp();
 		osHex << std::setfill('0') << std::setw(cellNumberWidth) << (int)*pb;
 
 		// Binary display (right)
@@ -383,8 +683,58 @@ void HexView::drawLine(int iLine, unsigned long iOffset,
 		for (int j = 0; j < cellNumberWidth; j++) osHex << ' ';
 		osBin << ' ';
 	}
-	osHex << "  " << osBin.str();// << 'x';
-	this->pConsole->putstr(osHex.str().c_str());
+	osHex << "  ";
+	int binPos = osHex.tellp();
+	osHex << osBin.str();// << 'x';
+	if (highlight >= 0) {
+		// Colour the cell in both the hex and the text
+		AttrRuns runs;
+		runs.push_back({(unsigned int)highlightPos, ATTR_CONTENT});
+		runs.push_back({(unsigned int)cellNumberWidth, ATTR_HIGHLIGHT});
+		runs.push_back({(unsigned int)(binPos + highlight - highlightPos
+			- cellNumberWidth), ATTR_CONTENT});
+		runs.push_back({1, ATTR_HIGHLIGHT});
+		this->pConsole->putstr(osHex.str(), runs);
+	} else {
+		this->pConsole->putstr(osHex.str());
+	}
+	this->pConsole->eraseToEOL();
+	return;
+}
+
+void HexView::drawHoleLine(int iLine, unsigned long iOffset,
+	camoto::stream::len bytes)
+{
+	static const char *units[] = {"bytes", "kB", "MB", "GB", "TB", "PB"};
+	double size = bytes;
+	unsigned int unit = 0;
+	while ((size >= 1024) && (unit < sizeof(units) / sizeof(units[0]) - 1)) {
+		size /= 1024;
+		unit++;
+	}
+
+	this->pConsole->gotoxy(0, iLine);
+	std::ostringstream ss;
+	ss << std::hex << std::setiosflags(std::ios_base::uppercase)
+		<< std::setfill('0') << std::setw(8) << iOffset << std::dec
+		<< "  *** hole ";
+	if (unit == 0) ss << bytes;
+	else ss << std::fixed << std::setprecision(1) << size;
+	ss << ' ' << units[unit] << " ***";
+	this->pConsole->putstr(ss.str().c_str());
+	this->pConsole->eraseToEOL();
+	return;
+}
+
+void HexView::drawRepeatLine(int iLine, unsigned long iOffset,
+	camoto::stream::len rows)
+{
+	this->pConsole->gotoxy(0, iLine);
+	std::ostringstream ss;
+	ss << std::hex << std::setiosflags(std::ios_base::uppercase)
+		<< std::setfill('0') << std::setw(8) << iOffset << std::dec
+		<< "  * " << rows << (rows == 1 ? " row" : " rows") << " the same as above";
+	this->pConsole->putstr(ss.str().c_str());
 	this->pConsole->eraseToEOL();
 	return;
 }
@@ -420,6 +770,21 @@ void HexView::adjustLineWidth(int delta)
 void HexView::cycleEditMode()
 {
 	this->editMode = (EditMode)((this->editMode + 1) % NUM_EDIT_MODES);
+	if (
+		(this->holes || this->collapseRuns)
+		&& ((this->editMode == View) || (this->editMode == HexEdit))
+	) {
+		// Rows are collapsed in one mode but not the other, so the rows have
+		// moved.  Anything typed may have filled in part of a hole or changed
+		// which rows are the same too.
+		if (this->editMode == View) {
+			this->file.flush();
+			this->data->flush();
+			if (this->holes) this->holes->refresh();
+			this->updateRuns(true);
+		}
+		this->redrawScreen();
+	}
 	if (this->editMode == View) {
 		this->pConsole->cursor(false);
 	} else {
@@ -615,3 +980,75 @@ void HexView::gotoOffset()
 
 	return;
 }
+
+void HexView::jumpToData()
+{
+	if (!this->holes) {
+		this->statusAlert("This file has no holes");
+		return;
+	}
+	camoto::stream::pos byte =
+		((this->iOffset * this->bitWidth) + this->intraByteOffset) >> 3;
+	camoto::stream::pos next = this->holes->nextData(byte);
+	if (next >= this->iFileSize) {
+		this->statusAlert("No more data after this point");
+		return;
+	}
+	// Put the first cell that includes any of the data at the top
+	camoto::stream::pos bit = next << 3;
+	if (bit < (camoto::stream::pos)this->intraByteOffset) bit = this->intraByteOffset;
+	this->scrollAbs((bit - this->intraByteOffset) / this->bitWidth);
+	return;
+}
+
+void HexView::jumpToCell(CellFinder::Match match)
+{
+	// Start from the cell under the cursor, or the top-left one when viewing
+	camoto::stream::pos cell = this->iOffset;
+	if (this->editMode != View) cell += this->cursorOffset;
+
+	camoto::stream::pos found;
+	try {
+		this->file.flush();
+		CellFinder finder(this->data, this->holes, this->bitWidth,
+			this->intraByteOffset, this->file.getEndian());
+		if (!finder.find(cell, match, &found)) {
+			this->statusAlert(match == CellFinder::Change
+				? "No more changes after this point"
+				: "Only 00 and FF after this point");
+			return;
+		}
+	} catch (const camoto::stream::error& e) {
+		std::string msg = "Read error: " + e.get_message();
+		this->statusAlert(msg.c_str());
+		return;
+	}
+
+	// Remember the cell so it is shown highlighted wherever it ends up
+	this->highlightCell = found;
+	this->highlightBitWidth = this->bitWidth;
+	this->highlightIntra = this->intraByteOffset;
+
+	if (this->editMode == View) {
+		this->scrollAbs(found);
+		return;
+	}
+
+	int iWidth, iHeight;
+	this->pConsole->getContentDims(&iWidth, &iHeight);
+	camoto::stream::len iScreenSize = iHeight * this->iLineWidth;
+	if (found - this->iOffset < iScreenSize) {
+		// Already on the screen, just move the cursor there.  Redrawing only
+		// sends the lines where the highlight has moved.
+		this->cursorOffset = found - this->iOffset;
+		this->hexEditOffset = 0;
+		this->redrawLines(0, iHeight);
+		this->updateCursorPos();
+	} else {
+		// Scroll so the cursor stays in the same place on the screen
+		this->hexEditOffset = 0;
+		this->scrollAbs(found - this->cursorOffset);
+		this->updateCursorPos();
+	}
+	return;
+}
@@ -22,6 +22,8 @@
 #define HEXVIEW_HPP_
 
 #include "FileView.hpp"
+#include "CellFinder.hpp"
+#include "RunMap.hpp"
 
 /// Hex editor view.
 class HexView: public FileView
@@ -40,6 +42,21 @@ class HexView: public FileView
 	#define NUM_EDIT_MODES 3  ///< Number of entries in EditMode
 	EditMode editMode; ///< Current editing mode
 
+	bool collapseRuns;        ///< Collapse rows identical to the one above?
+	std::shared_ptr<RunMap> runs; ///< Identical rows, or NULL if not collapsing
+	camoto::stream::pos runsNeeded; ///< Redraw once runs has searched this far
+
+	camoto::stream::pos highlightCell; ///< Cell found by the last jump, highlighted
+	int highlightBitWidth;    ///< bitWidth when highlightCell was found, or 0
+	int highlightIntra;       ///< intraByteOffset when highlightCell was found
+
+	/// What is shown on one row of the display.
+	enum RowType {
+		Row_Data,   ///< Normal row of data
+		Row_Hole,   ///< Collapsed hole in a sparse file
+		Row_Repeat, ///< Rows the same as the one above, collapsed
+	};
+
 	public:
 		HexView(std::string strFilename, std::shared_ptr<camoto::stream::inout> data,
 			IConsole *pConsole);
@@ -49,8 +66,16 @@ class HexView: public FileView
 		bool processKey(Key c);
 		void redrawScreen();
 
+		/// Redraw once more identical rows have been found.
+		virtual void idle();
+
 		void generateHeader(std::ostringstream& ss);
 
+		/// Draw the overlay, then put the edit cursor back where it was.
+		void updateStats();
+
+		unsigned long getIndexMemory() const;
+
 		/// Scroll to an absolute offset.
 		/**
 		 * @param iNewOffset
@@ -67,6 +92,55 @@ class HexView: public FileView
 		 */
 		void scrollRel(camoto::stream::delta iDelta);
 
+		/// Scroll by this number of rows on the screen.
+		/**
+		 * This is the same as scrolling by rows * iLineWidth cells, except that
+		 * collapsed rows (holes and runs of identical rows) only count as one row.
+		 *
+		 * @param rows
+		 *   Number of rows to scroll, negative to go towards the start of the file.
+		 */
+		void scrollRows(int rows);
+
+		/// Are some rows being collapsed into one?
+		/**
+		 * Rows are only collapsed when viewing, so when editing each row on the
+		 * screen is always iLineWidth cells after the one above it.
+		 */
+		bool collapseRows() const;
+
+		/// Turn collapsing of identical rows on or off.
+		void toggleRuns();
+
+		/// Start searching for identical rows again if the row length changed.
+		/**
+		 * @param force
+		 *   true to search again even if the row length is the same, e.g.
+		 *   because the data has been edited.
+		 */
+		void updateRuns(bool force);
+
+		/// Find where the next row on the screen starts.
+		/**
+		 * @param row
+		 *   Offset of a row, in cells.
+		 *
+		 * @param type
+		 *   Optional.  On return, what the row at this offset shows.
+		 *
+		 * @return Offset of the row after it, in cells.
+		 */
+		camoto::stream::pos nextRow(camoto::stream::pos row, RowType *type = NULL);
+
+		/// Find where the previous row on the screen starts.
+		/**
+		 * @param row
+		 *   Offset of a row, in cells.
+		 *
+		 * @return Offset of the row above it, in cells, or 0 at the top.
+		 */
+		camoto::stream::pos prevRow(camoto::stream::pos row);
+
 		/// Redraw part of the screen.
 		/**
 		 * @param iTop
@@ -95,6 +169,32 @@ class HexView: public FileView
 		void drawLine(int iLine, unsigned long iOffset, const unsigned int *pData,
 			int iLen);
 
+		/// Draw a row standing in for a hole in a sparse file.
+		/**
+		 * @param iLine
+		 *   Line number (0 is first line)
+		 *
+		 * @param iOffset
+		 *   Value to display in file-offset column.
+		 *
+		 * @param bytes
+		 *   Size of the hole covered by the row.
+		 */
+		void drawHoleLine(int iLine, unsigned long iOffset, camoto::stream::len bytes);
+
+		/// Draw a row standing in for rows the same as the one above.
+		/**
+		 * @param iLine
+		 *   Line number (0 is first line)
+		 *
+		 * @param iOffset
+		 *   Value to display in file-offset column.
+		 *
+		 * @param rows
+		 *   Number of identical rows covered by this one.
+		 */
+		void drawRepeatLine(int iLine, unsigned long iOffset, camoto::stream::len rows);
+
 		/// Increase or decrease the line width.
 		/**
 		 * This adjusts how long each line of hex data is.
@@ -154,6 +254,20 @@ class HexView: public FileView
 		/// Prompt the user for an offset, then jump there.
 		void gotoOffset();
 
+		/// Jump to the next allocated data after a hole in a sparse file.
+		void jumpToData();
+
+		/// Move to the next cell that differs from the current one.
+		/**
+		 * The current cell is the one under the cursor, or the one at the top
+		 * left when viewing.
+		 *
+		 * @param match
+		 *   Whether to stop at any change, or only at a value other than all
+		 *   zeros or all ones.
+		 */
+		void jumpToCell(CellFinder::Match match);
+
 };
 
 #endif // HEXVIEW_HPP_
@@ -0,0 +1,132 @@
+/**
+ * @file   HoleMap.cpp
+ * @brief  List of unallocated regions (holes) in a sparse file.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "HoleMap.hpp"
+#include "Stats.hpp"
+
+HoleMap::HoleMap(const std::string& strFilename)
+	:	fd(-1),
+		length(0)
+{
+	this->fd = ::open(strFilename.c_str(), O_RDONLY);
+	if (this->fd < 0) {
+		throw camoto::stream::open_error(strerror(errno));
+	}
+	this->refresh();
+}
+
+HoleMap::~HoleMap()
+{
+	::close(this->fd);
+}
+
+void HoleMap::refresh()
+{
+	Stats::Timer timer(Stats::Phase_Index);
+	std::vector<Hole> found;
+	struct stat st;
+	if (fstat(this->fd, &st) < 0) st.st_size = 0;
+	camoto::stream::len size = st.st_size;
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+	// Files with fewer blocks than bytes can't have holes, so don't bother
+	// asking about every extent of an ordinary file.
+	if ((camoto::stream::len)st.st_blocks * 512 < size) {
+		camoto::stream::pos off = 0;
+		while ((off < size) && (found.size() < HOLEMAP_MAX_HOLES)) {
+			off_t data = lseek(this->fd, off, SEEK_DATA);
+			if (data < 0) {
+				// ENXIO means there's no more data, so the rest is a hole.  Any other
+				// error means the filesystem can't tell us, so give up.
+				if (errno == ENXIO) found.push_back({off, size});
+				else found.clear();
+				break;
+			}
+			if ((camoto::stream::pos)data > off) found.push_back({off, (camoto::stream::pos)data});
+			off_t hole = lseek(this->fd, data, SEEK_HOLE);
+			if (hole <= data) break; // shouldn't happen, there's always one at EOF
+			off = hole;
+		}
+	}
+#endif
+
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->holes.swap(found);
+	this->length = size;
+	return;
+}
+
+bool HoleMap::empty() const
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	return this->holes.empty();
+}
+
+unsigned long HoleMap::getMemory() const
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	return this->holes.capacity() * sizeof(Hole);
+}
+
+bool HoleMap::find(camoto::stream::pos offset, camoto::stream::pos *start,
+	camoto::stream::pos *end) const
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+
+	// First hole starting after offset, so the one before it is the only one
+	// that could contain offset.
+	auto next = std::upper_bound(this->holes.begin(), this->holes.end(), offset,
+		[](camoto::stream::pos o, const Hole& h) { return o < h.start; });
+	if (next != this->holes.begin()) {
+		auto prev = next - 1;
+		if (offset < prev->end) {
+			*start = prev->start;
+			*end = prev->end;
+			return true;
+		}
+		*start = prev->end;
+	} else {
+		*start = 0;
+	}
+	*end = (next == this->holes.end()) ? std::max(this->length, offset + 1) : next->start;
+	return false;
+}
+
+camoto::stream::pos HoleMap::nextData(camoto::stream::pos offset) const
+{
+	camoto::stream::len size;
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+		size = this->length;
+	}
+	camoto::stream::pos start, end;
+	if (!this->find(offset, &start, &end)) {
+		// In data, so look past the hole that follows it
+		if (end >= size) return size;
+		this->find(end, &start, &end);
+	}
+	return end;
+}
@@ -0,0 +1,106 @@
+/**
+ * @file   HoleMap.hpp
+ * @brief  List of unallocated regions (holes) in a sparse file.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HOLEMAP_HPP_
+#define HOLEMAP_HPP_
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <camoto/stream.hpp>
+
+/// Stop recording holes after this many, treating the rest of the file as data.
+#define HOLEMAP_MAX_HOLES (1 << 20)
+
+/// Where the holes are in a sparse file.
+/**
+ * Disk and VM images are often mostly holes, which read back as zeros but
+ * aren't stored anywhere.  The filesystem is asked where they are with
+ * SEEK_DATA and SEEK_HOLE, so they can be shown as a single line and skipped
+ * by anything reading through the whole file.
+ *
+ * Filesystems that don't track holes report the whole file as data, so the
+ * map is just empty.
+ */
+class HoleMap
+{
+	public:
+		/// Find the holes in a file.
+		/**
+		 * @param strFilename
+		 *   File to examine.  It is opened separately, read-only.
+		 *
+		 * @throw camoto::stream::open_error if the file could not be opened.
+		 */
+		HoleMap(const std::string& strFilename);
+
+		~HoleMap();
+
+		/// Ask the filesystem for the holes again, e.g. after data was written.
+		void refresh();
+
+		/// Does the file have any holes?
+		bool empty() const;
+
+		/// Get the memory used to store the holes, in bytes.
+		unsigned long getMemory() const;
+
+		/// Find the hole or data extent containing the given offset.
+		/**
+		 * @param offset
+		 *   Offset in bytes.
+		 *
+		 * @param start
+		 *   On return, the offset of the first byte in the extent.
+		 *
+		 * @param end
+		 *   On return, the offset just past the last byte in the extent.  This is
+		 *   the file size if the extent runs to the end of the file.
+		 *
+		 * @return true if offset is in a hole, false if it is in data.
+		 */
+		bool find(camoto::stream::pos offset, camoto::stream::pos *start,
+			camoto::stream::pos *end) const;
+
+		/// Find the start of the next allocated data after a hole.
+		/**
+		 * @param offset
+		 *   Offset in bytes.  If this is in data, the search starts from the end
+		 *   of that data.
+		 *
+		 * @return Offset of the next data after a hole, or the file size if there
+		 *   is no more data.
+		 */
+		camoto::stream::pos nextData(camoto::stream::pos offset) const;
+
+	protected:
+		/// An unallocated region.
+		struct Hole {
+			camoto::stream::pos start; ///< First byte of the hole
+			camoto::stream::pos end;   ///< One past the last byte of the hole
+		};
+
+		int fd;                        ///< File being examined
+		camoto::stream::len length;    ///< File size when the map was made
+		std::vector<Hole> holes;       ///< Holes in offset order
+		mutable std::mutex lock;       ///< Protects holes, for background scans
+};
+
+#endif // HOLEMAP_HPP_
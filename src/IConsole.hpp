@@ -21,7 +21,9 @@
 #ifndef ICONSOLE_HPP_
 #define ICONSOLE_HPP_
 
+#include <stdint.h>
 #include <string>
+#include <vector>
 #include "IView.hpp"
 
 /// Which status bar to use.
@@ -39,11 +41,29 @@ enum SB_X {
 
 const int SB_NO_CURSOR_MOVE = -1;
 
+/// Attribute for text in the content area.
+#define ATTR_CONTENT   0
+/// Attribute for text on the status bars.
+#define ATTR_STATUSBAR 1
+/// Attribute for text to draw attention to, in cfg.clrHighlight.
+#define ATTR_HIGHLIGHT 2
+/// Number of attributes.
+#define ATTR_COUNT     3
+
+/// Part of a line of text drawn in one colour.
+struct AttrRun {
+	unsigned int len; ///< Number of characters
+	uint8_t attr;     ///< ATTR_CONTENT, etc.
+};
+
+/// Colours for a line of text, as consecutive runs from the first character.
+typedef std::vector<AttrRun> AttrRuns;
+
 /// Interface class to the UI.
 class IConsole
 {
 	public:
-		virtual ~IConsole(); // implemented in main.cpp
+		virtual ~IConsole(); // implemented in BaseConsole.cpp
 
 		/// Set the view that will be shown in this console.
 		/**
@@ -130,6 +150,22 @@ class IConsole
 		 */
 		virtual void putstr(const std::string& strContent) = 0;
 
+		/// Write a string at the current location, in more than one colour.
+		/**
+		 * Consoles change colour once for each run rather than checking every
+		 * character, so highlighting part of a line costs about the same as
+		 * writing it plainly.
+		 *
+		 * @param strContent
+		 *   String to write.
+		 *
+		 * @param runs
+		 *   Colour of each part of strContent, in order.  Any characters past
+		 *   the end of the last run are drawn in the normal colour.
+		 */
+		virtual void putstr(const std::string& strContent, const AttrRuns& runs)
+			= 0;
+
 		/// Get the screen size.
 		/**
 		 * The values are in text cells, e.g. 80x23.  This doesn't include the two
@@ -185,6 +221,40 @@ class IConsole
 		 * colours, and it may then be called later on to set different colours.
 		 */
 		virtual void setColoursFromConfig() = 0;
+
+		/// Get a block of pixels covering the content area.
+		/**
+		 * This allows a view to draw images instead of text.  Pixels are 32-bit
+		 * 0x00RRGGBB values.  Nothing appears on the screen until
+		 * updateFramebuffer() is called.  The returned pointer is only valid until
+		 * the next call to this function, as the framebuffer is resized to match
+		 * the window.
+		 *
+		 * @param iWidth
+		 *   On return, the width of the content area in pixels.
+		 *
+		 * @param iHeight
+		 *   On return, the height of the content area in pixels.
+		 *
+		 * @param iStride
+		 *   On return, the number of pixels (not bytes) from the start of one row
+		 *   to the start of the next.
+		 *
+		 * @return Pointer to the top-left pixel, or NULL if this console cannot
+		 *   display images.
+		 */
+		virtual uint32_t *getFramebuffer(int *iWidth, int *iHeight,
+			int *iStride) = 0;
+
+		/// Show the framebuffer in the content area.
+		/**
+		 * Once this has been called, the framebuffer replaces any text in the
+		 * content area until releaseFramebuffer() is called.
+		 */
+		virtual void updateFramebuffer() = 0;
+
+		/// Go back to showing text in the content area.
+		virtual void releaseFramebuffer() = 0;
 };
 
 #endif // ICONSOLE_HPP_
@@ -101,6 +101,14 @@ class IView
 		/// Clear any prompt used to collect text entry from the user.
 		virtual void clearTextEntry() = 0;
 
+		/// Do any background work while waiting for a keypress.
+		/**
+		 * This is called every IDLE_INTERVAL milliseconds while no keys are being
+		 * pressed, e.g. so the view can show data that has arrived since the
+		 * last update.
+		 */
+		virtual void idle() = 0;
+
 };
 
 typedef std::shared_ptr<IView> IViewPtr;
@@ -0,0 +1,508 @@
+/**
+ * @file   LZWView.cpp
+ * @brief  IView implementation for decoding LZW-compressed data.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+#include <iomanip>
+#include <sstream>
+#include "LZWView.hpp"
+#include "HelpView.hpp"
+#include "Stats.hpp"
+#include "cfg.hpp"
+
+#define min(x, y) (((x) < (y)) ? (x) : (y))
+#define max(x, y) (((x) > (y)) ? (x) : (y))
+
+/// Largest code width supported.
+#define LZW_MAX_WIDTH 16
+
+/// Width of the decoded string column when it is drawn as hex.
+#define LZW_HEX_BYTES 8
+
+LZWView::LZWView(const FileView& parent)
+	:	FileView(parent),
+		topCode(0),
+		minWidth(9),
+		maxWidth(12),
+		resetCode(256),
+		eofCode(257),
+		earlyChange(false),
+		endKnown(false),
+		endCode(0),
+		pLineBuffer(NULL),
+		iLineAlloc(256)
+{
+	this->startBit = this->iOffset * this->bitWidth + this->intraByteOffset;
+	this->pLineBuffer = new uint8_t[this->iLineAlloc];
+	this->resetDecoder();
+}
+
+LZWView::~LZWView()
+{
+	assert(this->pLineBuffer != NULL);
+	delete[] this->pLineBuffer;
+}
+
+bool LZWView::processKey(Key c)
+{
+	int iWidth, iHeight;
+	this->pConsole->getContentDims(&iWidth, &iHeight);
+
+	// Hide any active status message on any keypress
+	this->statusAlert(NULL);
+
+	bool changed = false;
+	switch (c) {
+		case Key_None: // ignore
+			return true;
+		case Key_Esc:
+		case Key_F10:
+		case 'q':
+		case ALT('l'):
+			// Go back to the view we were opened from
+			this->pConsole->popView();
+			return true;
+
+		case Key_Up: this->scrollLines(-1); break;
+		case Key_Down: this->scrollLines(1); break;
+		case Key_PageUp: this->scrollLines(-iHeight); break;
+		case Key_Enter:
+		case Key_PageDown: this->scrollLines(iHeight); break;
+		case Key_Home: this->scrollLines(-(long)this->topCode); break;
+		case Key_End: {
+			LZWState end = this->seekCode((unsigned long)-1);
+			long target = max(0L, (long)end.code - iHeight + 1);
+			this->scrollLines(target - (long)this->topCode);
+			break;
+		}
+
+		case 'w':
+			if (this->maxWidth > this->minWidth) this->maxWidth--;
+			changed = true;
+			break;
+		case 'W':
+			if (this->maxWidth < LZW_MAX_WIDTH) this->maxWidth++;
+			changed = true;
+			break;
+		case 'n':
+			if (this->minWidth > 9) this->minWidth--;
+			changed = true;
+			break;
+		case 'N':
+			if (this->minWidth < this->maxWidth) this->minWidth++;
+			changed = true;
+			break;
+		case 'k':
+			this->earlyChange = !this->earlyChange;
+			changed = true;
+			break;
+		case 'r':
+			this->promptCode("Reset code (-1 for none)", &this->resetCode);
+			changed = true;
+			break;
+		case 'x':
+			this->promptCode("End code (-1 for none)", &this->eofCode);
+			changed = true;
+			break;
+		case 'e': this->file.changeEndian(camoto::bitstream::littleEndian); changed = true; break;
+		case 'E': this->file.changeEndian(camoto::bitstream::bigEndian); changed = true; break;
+		case 'g': this->gotoOffset(); break;
+
+		case CTRL('L'): this->redrawScreen(); break;
+		case Key_F1: {
+			IViewPtr newView(new HelpView(this->pConsole));
+			this->pConsole->pushView(newView);
+			break;
+		}
+		default: break;
+	}
+
+	if (changed) {
+		this->resetDecoder();
+		this->topCode = 0;
+		this->redrawScreen();
+	}
+
+	this->pConsole->update();
+	return true; // true == keep going (don't quit)
+}
+
+void LZWView::redrawScreen()
+{
+	int iWidth, iHeight;
+	this->pConsole->getContentDims(&iWidth, &iHeight);
+	this->pConsole->cursor(false);
+
+	this->redrawLines(0, iHeight);
+	this->updateHeader();
+	return;
+}
+
+void LZWView::generateHeader(std::ostringstream& ss)
+{
+	ss << "   LZW " << this->minWidth << '-' << this->maxWidth << "b/";
+	if (this->file.getEndian() == camoto::bitstream::littleEndian) {
+		ss << "LE";
+	} else {
+		ss << "BE";
+	}
+	if (this->earlyChange) ss << " early";
+	ss << "  Reset: ";
+	if (this->resetCode == LZW_NO_CODE) ss << "none";
+	else ss << this->resetCode;
+	ss << "  End: ";
+	if (this->eofCode == LZW_NO_CODE) ss << "none";
+	else ss << this->eofCode;
+	ss << "  Code: " << this->topCode;
+	if (this->endKnown) ss << '/' << this->endCode;
+	return;
+}
+
+void LZWView::scrollLines(long iDelta)
+{
+	if (iDelta == 0) return; // e.g. pressing Home twice
+
+	int iWidth, iHeight;
+	this->pConsole->getContentDims(&iWidth, &iHeight);
+
+	if (iDelta < 0) {
+		if (-iDelta > (long)this->topCode) {
+			this->statusAlert("Top of data");
+			iDelta = -(long)this->topCode;
+		}
+		if (this->topCode == 0) return;
+	} else {
+		// Make sure there is at least one code left to show at the top
+		LZWState target = this->seekCode(this->topCode + iDelta);
+		if (target.code < this->topCode + iDelta) {
+			this->statusAlert("End of data");
+			if (target.code == 0) return;
+			iDelta = target.code - 1 - this->topCode;
+		}
+		if (iDelta <= 0) return;
+	}
+
+	this->topCode += iDelta;
+
+	if (labs(iDelta) >= iHeight) {
+		this->redrawLines(0, iHeight);
+	} else {
+		this->pConsole->scrollContent(0, iDelta);
+		if (iDelta < 0) {
+			this->redrawLines(0, -iDelta);
+		} else {
+			this->redrawLines(iHeight - iDelta, iHeight);
+		}
+	}
+
+	this->updateHeader();
+	return;
+}
+
+void LZWView::redrawLines(int iTop, int iBottom)
+{
+	Stats::Timer timer(Stats::Phase_Format);
+	int y = iTop;
+	LZWState state = this->seekCode(this->topCode + iTop);
+	if (state.code == this->topCode + iTop) {
+		this->file.seek(state.bitPos, camoto::stream::start);
+		for (; y < iBottom; y++) {
+			LZWCode code;
+			Stats::Timer decode(Stats::Phase_Decode);
+			if (!this->step(state, &code)) break;
+			decode.stop();
+			this->drawLine(y, code, state);
+		}
+	}
+
+	// Blank out any leftover lines
+	for (; y < iBottom; y++) {
+		this->pConsole->gotoxy(0, y);
+		this->pConsole->eraseToEOL();
+	}
+	return;
+}
+
+void LZWView::drawLine(int iLine, const LZWCode& code, const LZWState& state)
+{
+	int iWidth, iHeight;
+	this->pConsole->getContentDims(&iWidth, &iHeight);
+	this->pConsole->gotoxy(0, iLine);
+
+	std::ostringstream ss;
+	ss << std::hex << std::setiosflags(std::ios_base::uppercase)
+		<< std::setfill('0')
+		<< std::setw(8) << code.outPos << "  "
+		<< std::setw(8) << (code.bitPos >> 3) << '+' << (code.bitPos & 7) << "  "
+		<< std::dec << std::setfill(' ') << std::setw(2) << code.width << "b  "
+		<< std::hex << std::setfill('0') << std::setw((LZW_MAX_WIDTH + 3) / 4)
+		<< code.value << "  ";
+
+	switch (code.type) {
+		case LZWCode::Reset: ss << "<reset>"; break;
+		case LZWCode::End: ss << "<end>"; break;
+		case LZWCode::Invalid: ss << "<invalid code>"; break;
+		case LZWCode::String: {
+			// Show the decoded string as hex, then as text
+			unsigned int textLen = max(0, iWidth - (int)ss.tellp() - LZW_HEX_BYTES * 3 - 2);
+			unsigned int len = this->expand(*state.dict, code.value,
+				min(max(textLen, LZW_HEX_BYTES), this->iLineAlloc));
+			for (unsigned int i = 0; i < LZW_HEX_BYTES; i++) {
+				if (i < len) ss << std::setw(2) << (int)this->pLineBuffer[i] << ' ';
+				else if ((i == len) && ((*state.dict)[code.value].len > len)) ss << "...";
+				else ss << "   ";
+			}
+			ss << ' ';
+			for (unsigned int i = 0; i < min(len, textLen); i++) {
+				if (this->pLineBuffer[i] == 0) ss << ' ';
+				else ss << (char)this->pLineBuffer[i];
+			}
+			break;
+		}
+	}
+	this->pConsole->putstr(ss.str());
+	this->pConsole->eraseToEOL();
+	return;
+}
+
+LZWState LZWView::seekCode(unsigned long code)
+{
+	Stats::Timer timer(Stats::Phase_Decode);
+	// Find the last snapshot at or before the target code.  The first snapshot
+	// is always at code zero.
+	unsigned long lo = 0, hi = this->snapshots.size();
+	while (hi - lo > 1) {
+		unsigned long mid = (lo + hi) / 2;
+		if (this->snapshots[mid].code <= code) lo = mid;
+		else hi = mid;
+	}
+	LZWState state = this->snapshots[lo];
+
+	this->file.seek(state.bitPos, camoto::stream::start);
+	while (state.code < code) {
+		LZWCode skipped;
+		if (!this->step(state, &skipped)) break;
+		if (
+			(state.code % LZW_SNAPSHOT_INTERVAL == 0)
+			&& (state.code > this->snapshots.back().code)
+		) {
+			this->snapshots.push_back(state);
+		}
+	}
+	return state;
+}
+
+bool LZWView::step(LZWState& state, LZWCode *out)
+{
+	if (state.finished) return false;
+
+	unsigned int value;
+	::stats.bitstreamReads++;
+	if (!this->file.read(state.width, &value)) {
+		state.finished = true;
+		if (!this->endKnown) {
+			this->endKnown = true;
+			this->endCode = state.code;
+		}
+		return false;
+	}
+	out->index = state.code;
+	out->bitPos = state.bitPos;
+	out->outPos = state.outPos;
+	out->width = state.width;
+	out->value = value;
+	state.code++;
+	state.bitPos += state.width;
+
+	LZWDict& dict = *state.dict;
+	if ((int)value == this->resetCode) {
+		out->type = LZWCode::Reset;
+		// Start a new dictionary, so earlier states still see the old one
+		state.dict.reset(new LZWDict(dict.begin(), dict.begin() + 256));
+		state.width = this->minWidth;
+		state.nextCode = this->firstFreeCode();
+		state.prev = LZW_NO_CODE;
+		return true;
+	}
+	if ((int)value == this->eofCode) {
+		out->type = LZWCode::End;
+		state.finished = true;
+		if (!this->endKnown) {
+			this->endKnown = true;
+			this->endCode = state.code;
+		}
+		return true;
+	}
+
+	LZWEntry entry;
+	if ((value < 256) || (((int)value >= this->firstFreeCode())
+		&& ((int)value < state.nextCode))) {
+		// Code is already in the dictionary
+		entry = dict[value];
+	} else if (((int)value == state.nextCode) && (state.prev != LZW_NO_CODE)) {
+		// The code being defined by this step, which is the previous string plus
+		// its own first character.
+		entry.first = dict[state.prev].first;
+		entry.len = dict[state.prev].len + 1;
+	} else {
+		out->type = LZWCode::Invalid;
+		state.prev = LZW_NO_CODE;
+		return true;
+	}
+	out->type = LZWCode::String;
+
+	if ((state.prev != LZW_NO_CODE) && (state.nextCode < (1 << this->maxWidth))) {
+		LZWEntry added;
+		added.prefix = state.prev;
+		added.first = dict[state.prev].first;
+		added.last = entry.first;
+		added.len = dict[state.prev].len + 1;
+		// Entries past state.nextCode may already be there from an earlier pass
+		// through this part of the data, in which case they will be identical.
+		if ((unsigned int)state.nextCode >= dict.size()) {
+			dict.resize(state.nextCode + 1);
+		}
+		dict[state.nextCode] = added;
+		state.nextCode++;
+	}
+	if (
+		(state.width < this->maxWidth)
+		&& (state.nextCode + (this->earlyChange ? 1 : 0) >= (1 << state.width))
+	) {
+		state.width++;
+	}
+
+	state.outPos += entry.len;
+	state.prev = value;
+	return true;
+}
+
+unsigned int LZWView::expand(const LZWDict& dict, int code, unsigned int maxLen)
+{
+	unsigned int len = dict[code].len;
+	// Walk back from the end of the string, skipping the part that won't fit
+	for (int c = code; c != LZW_NO_CODE; c = dict[c].prefix) {
+		len--;
+		if (len < maxLen) this->pLineBuffer[len] = dict[c].last;
+	}
+	return min(dict[code].len, maxLen);
+}
+
+int LZWView::firstFreeCode() const
+{
+	int first = 256;
+	if (this->resetCode >= first) first = this->resetCode + 1;
+	if (this->eofCode >= first) first = this->eofCode + 1;
+	return first;
+}
+
+void LZWView::resetDecoder()
+{
+	std::shared_ptr<LZWDict> dict(new LZWDict(256));
+	for (int i = 0; i < 256; i++) {
+		(*dict)[i].prefix = LZW_NO_CODE;
+		(*dict)[i].first = i;
+		(*dict)[i].last = i;
+		(*dict)[i].len = 1;
+	}
+
+	LZWState first;
+	first.code = 0;
+	first.bitPos = this->startBit;
+	first.outPos = 0;
+	first.width = this->minWidth;
+	first.nextCode = this->firstFreeCode();
+	first.prev = LZW_NO_CODE;
+	first.finished = false;
+	first.dict = dict;
+
+	this->snapshots.clear();
+	this->snapshots.push_back(first);
+	this->endKnown = false;
+	this->endCode = 0;
+	return;
+}
+
+void LZWView::promptCode(const char *prompt, int *code)
+{
+	std::string val = this->pConsole->getString(prompt, 6);
+
+	// Reset status bar to hide prompt
+	this->bStatusAlertVisible = true;
+	this->statusAlert(NULL);
+
+	if (val.length() > 0) {
+		const char *nptr = val.c_str();
+		char *endptr;
+		long newCode = strtol(nptr, &endptr, 0);
+		if ((endptr != nptr) && (*endptr == '\0')) {
+			if (newCode < 0) newCode = LZW_NO_CODE;
+			if (newCode >= (1 << LZW_MAX_WIDTH)) {
+				this->statusAlert("Code is too large");
+			} else {
+				*code = newCode;
+			}
+		}
+	}
+	return;
+}
+
+void LZWView::gotoOffset()
+{
+	std::string val = this->pConsole->getString("Decoded offset", 15);
+
+	// Reset status bar to hide prompt
+	this->bStatusAlertVisible = true;
+	this->statusAlert(NULL);
+
+	if (val.length() == 0) return;
+	const char *nptr = val.c_str();
+	char *endptr;
+	unsigned long target = strtoul(nptr, &endptr, 0);
+	if ((endptr == nptr) || (*endptr != '\0')) return;
+
+	// Find the last snapshot before the target output offset, then decode from
+	// there to find the code that produced it.
+	LZWState state = this->snapshots[0];
+	for (std::vector<LZWState>::const_iterator
+		i = this->snapshots.begin(); i != this->snapshots.end(); i++
+	) {
+		if (i->outPos > target) break;
+		state = *i;
+	}
+	this->file.seek(state.bitPos, camoto::stream::start);
+	for (;;) {
+		LZWState next = state;
+		LZWCode code;
+		if (!this->step(next, &code)) break;
+		if (next.outPos > target) break;
+		state = next;
+		if (
+			(state.code % LZW_SNAPSHOT_INTERVAL == 0)
+			&& (state.code > this->snapshots.back().code)
+		) {
+			this->snapshots.push_back(state);
+		}
+	}
+	if (state.outPos < target) this->statusAlert("End of data");
+
+	this->topCode = state.code;
+	this->redrawScreen();
+	return;
+}
@@ -0,0 +1,188 @@
+/**
+ * @file   LZWView.hpp
+ * @brief  IView implementation for decoding LZW-compressed data.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LZWVIEW_HPP_
+#define LZWVIEW_HPP_
+
+#include <vector>
+#include "FileView.hpp"
+
+/// Number of codes between each saved decoder state.
+#define LZW_SNAPSHOT_INTERVAL 256
+
+/// Value for resetCode/eofCode when the code is not used.
+#define LZW_NO_CODE -1
+
+/// Dictionary entry for one LZW code.
+struct LZWEntry
+{
+	int prefix;         ///< Code for all but the last byte, or LZW_NO_CODE
+	uint8_t first;      ///< First byte of the string
+	uint8_t last;       ///< Last byte of the string
+	unsigned int len;   ///< Length of the string in bytes
+};
+
+/// Dictionary of LZW codes.
+/**
+ * Entries are only ever appended until the next reset code, at which point a
+ * new dictionary is started.  This means a decoder state can share the
+ * dictionary with every later state up until the next reset, as entries it
+ * has not reached yet are ignored.
+ */
+typedef std::vector<LZWEntry> LZWDict;
+
+/// Everything needed to resume decoding at a given code.
+struct LZWState
+{
+	unsigned long code;          ///< Index of the next code, 0 is the first
+	camoto::stream::pos bitPos;  ///< Bit offset in the file of the next code
+	camoto::stream::pos outPos;  ///< Offset in the decoded data of the next code's output
+	int width;                   ///< Width in bits of the next code
+	int nextCode;                ///< Code that will be assigned to the next new entry
+	int prev;                    ///< Previous code, or LZW_NO_CODE after a reset
+	bool finished;               ///< true if there are no more codes
+	std::shared_ptr<LZWDict> dict; ///< Dictionary in use
+};
+
+/// One decoded code, as shown on a row of the display.
+struct LZWCode
+{
+	enum Type {
+		String,   ///< Code produced some data
+		Reset,    ///< Dictionary reset code
+		End,      ///< End-of-data code
+		Invalid,  ///< Code not yet in the dictionary
+	};
+	Type type;                   ///< What this code did
+	unsigned long index;         ///< Code number, 0 is the first
+	camoto::stream::pos bitPos;  ///< Bit offset of the code in the file
+	camoto::stream::pos outPos;  ///< Offset of this code's output in the decoded data
+	int width;                   ///< Width of the code in bits
+	unsigned int value;          ///< Code value read from the file
+};
+
+/// LZW decoding view.
+/**
+ * Each row shows one LZW code, along with the data it decodes to.  Decoding
+ * starts at the bit offset that was visible in the view this one was opened
+ * from.
+ */
+class LZWView: public FileView
+{
+	public:
+		/// Create a new LZW view from an existing view.
+		/**
+		 * @param parent
+		 *   FileView instance from an existing view.  Decoding starts at the seek
+		 *   location of this view.
+		 */
+		LZWView(const FileView& parent);
+
+		~LZWView();
+
+		bool processKey(Key c);
+		void redrawScreen();
+		void generateHeader(std::ostringstream& ss);
+
+		/// Scroll vertically by this number of codes.
+		/**
+		 * @param iDelta
+		 *   Number of codes (rows) to scroll.  Negative values scroll up.
+		 */
+		void scrollLines(long iDelta);
+
+		/// Redraw part of the screen.
+		/**
+		 * @param iTop
+		 *   First line to redraw, 0 is first data line (just below top status bar)
+		 *
+		 * @param iBottom
+		 *   Stop drawing at this line.  iBottom-1 is the actual last line drawn.
+		 */
+		void redrawLines(int iTop, int iBottom);
+
+		/// Draw one decoded code on the given line.
+		void drawLine(int iLine, const LZWCode& code, const LZWState& state);
+
+		/// Get the decoder state just before the given code.
+		/**
+		 * This resumes from the nearest snapshot, so only the codes between the
+		 * snapshot and the target are decoded.
+		 *
+		 * @param code
+		 *   Code number to seek to.  If this is past the end of the data, the
+		 *   returned state will be the one at the end of the data.
+		 */
+		LZWState seekCode(unsigned long code);
+
+		/// Decode the next code.
+		/**
+		 * @pre this->file has been seeked to state.bitPos.
+		 *
+		 * @param state
+		 *   Decoder state to update.
+		 *
+		 * @param out
+		 *   Details of the code that was decoded.
+		 *
+		 * @return false if there are no more codes.
+		 */
+		bool step(LZWState& state, LZWCode *out);
+
+		/// Write the string for a dictionary entry into pLineBuffer.
+		/**
+		 * @return Number of bytes written, which may be less than the full string
+		 *   if it does not fit.
+		 */
+		unsigned int expand(const LZWDict& dict, int code, unsigned int maxLen);
+
+		/// First code available for new dictionary entries.
+		/**
+		 * This is the first code after the literal bytes and the special codes.
+		 */
+		int firstFreeCode() const;
+
+		/// Discard all saved decoder states after a change to the parameters.
+		void resetDecoder();
+
+		/// Ask the user for a new value for one of the special codes.
+		void promptCode(const char *prompt, int *code);
+
+		/// Ask the user for an offset in the decoded data, then jump there.
+		void gotoOffset();
+
+	protected:
+		camoto::stream::pos startBit;  ///< Bit offset in file where decoding starts
+		unsigned long topCode;         ///< Code shown on the first line
+		int minWidth;                  ///< Code width after a reset
+		int maxWidth;                  ///< Code width at which the dictionary is full
+		int resetCode;                 ///< Code that resets the dictionary
+		int eofCode;                   ///< Code that marks the end of the data
+		bool earlyChange;              ///< Increase width one code early (as in TIFF/PDF)
+
+		std::vector<LZWState> snapshots; ///< Saved decoder states, sorted by code
+		bool endKnown;                   ///< true once the last code has been found
+		unsigned long endCode;           ///< Number of codes, valid when endKnown
+
+		uint8_t *pLineBuffer;          ///< Decoded string for the current line
+		unsigned int iLineAlloc;       ///< Size of pLineBuffer in bytes
+};
+
+#endif // LZWVIEW_HPP_
@@ -0,0 +1,249 @@
+/**
+ * @file   MmapStream.cpp
+ * @brief  Read-only stream backed by a memory-mapped file.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <mutex>
+#include "MmapStream.hpp"
+#include "Stats.hpp"
+
+#define min(x, y) (((x) < (y)) ? (x) : (y))
+
+/// Most files that can be mapped at once.
+#define MMAP_MAX 64
+
+/// Every mapping, so the SIGBUS handler can find the one that faulted.
+static std::atomic<MmapStream *> mappings[MMAP_MAX];
+
+/// Held while changing mappings, which the signal handler only reads.
+static std::mutex mappingsLock;
+
+/// What SIGBUS did before the handler was installed, for faults elsewhere.
+static struct sigaction oldSigbus;
+
+/// Size of a memory page, read before the handler can run.
+static uintptr_t pageSize;
+
+MmapStream::MmapStream(const std::string& strFilename)
+	:	fd(-1),
+		map(NULL),
+		mapLength(0),
+		length(0),
+		offset(0),
+		access(Normal),
+		lost(false)
+{
+	this->fd = ::open(strFilename.c_str(), O_RDONLY);
+	if (this->fd < 0) {
+		throw camoto::stream::open_error(strerror(errno));
+	}
+
+	struct stat st;
+	if (fstat(this->fd, &st) < 0) {
+		int e = errno;
+		::close(this->fd);
+		throw camoto::stream::open_error(strerror(e));
+	}
+	if (!S_ISREG(st.st_mode)) {
+		// Devices and pipes either can't be mapped or have no fixed size
+		::close(this->fd);
+		throw camoto::stream::open_error("Not a regular file");
+	}
+
+	this->mapLength = this->length = st.st_size;
+	if (this->mapLength > 0) {
+		void *p = mmap(NULL, this->mapLength, PROT_READ, MAP_SHARED, this->fd, 0);
+		if (p == MAP_FAILED) {
+			int e = errno;
+			::close(this->fd);
+			throw camoto::stream::open_error(strerror(e));
+		}
+		this->map = (uint8_t *)p;
+
+		// Register the mapping so a truncated file can't crash the program
+		std::lock_guard<std::mutex> l(mappingsLock);
+		if (!pageSize) {
+			pageSize = sysconf(_SC_PAGESIZE);
+			struct sigaction sa;
+			memset(&sa, 0, sizeof(sa));
+			sa.sa_sigaction = MmapStream::sigbus;
+			sigemptyset(&sa.sa_mask);
+			sa.sa_flags = SA_SIGINFO | SA_RESTART;
+			sigaction(SIGBUS, &sa, &oldSigbus);
+		}
+		int i;
+		for (i = 0; i < MMAP_MAX; i++) {
+			if (!mappings[i]) {
+				mappings[i] = this;
+				break;
+			}
+		}
+		if (i == MMAP_MAX) {
+			munmap(this->map, this->mapLength);
+			::close(this->fd);
+			throw camoto::stream::open_error("Too many files mapped");
+		}
+	}
+
+	// Browsing jumps around, so don't waste time reading ahead by default
+	this->advise(Random);
+}
+
+MmapStream::~MmapStream()
+{
+	if (this->map) {
+		std::lock_guard<std::mutex> l(mappingsLock);
+		for (int i = 0; i < MMAP_MAX; i++) {
+			if (mappings[i] == this) mappings[i] = NULL;
+		}
+		munmap(this->map, this->mapLength);
+	}
+	::close(this->fd);
+}
+
+camoto::stream::len MmapStream::try_read(uint8_t *buffer,
+	camoto::stream::len len)
+{
+	this->checkSize();
+	if (this->offset >= this->length) return 0;
+	camoto::stream::len avail = this->length - this->offset;
+	if (len > avail) len = avail;
+	memcpy(buffer, this->map + this->offset, len);
+
+	// If the file was cut short during the copy, only what's left counts
+	if (this->lost) {
+		this->checkSize();
+		if (this->offset >= this->length) return 0;
+		len = min(len, this->length - this->offset);
+	}
+	this->offset += len;
+	::stats.bytesRead += len;
+	return len;
+}
+
+void MmapStream::seekg(camoto::stream::delta off,
+	camoto::stream::seek_from from)
+{
+	this->checkSize();
+	camoto::stream::delta target;
+	switch (from) {
+		case camoto::stream::cur: target = this->offset + off; break;
+		case camoto::stream::end: target = this->length + off; break;
+		default: target = off; break;
+	}
+	if ((target < 0) || ((camoto::stream::pos)target > this->length)) {
+		throw camoto::stream::seek_error("Seek past end of file");
+	}
+	this->offset = target;
+	return;
+}
+
+camoto::stream::pos MmapStream::tellg() const
+{
+	return this->offset;
+}
+
+camoto::stream::len MmapStream::size() const
+{
+	this->checkSize();
+	return this->length;
+}
+
+camoto::stream::len MmapStream::try_write(const uint8_t *buffer,
+	camoto::stream::len len)
+{
+	throw camoto::stream::write_error("File is read-only");
+}
+
+void MmapStream::seekp(camoto::stream::delta off,
+	camoto::stream::seek_from from)
+{
+	this->seekg(off, from);
+	return;
+}
+
+camoto::stream::pos MmapStream::tellp() const
+{
+	return this->offset;
+}
+
+void MmapStream::truncate(camoto::stream::len size)
+{
+	throw camoto::stream::write_error("File is read-only");
+}
+
+void MmapStream::flush()
+{
+	return;
+}
+
+void MmapStream::advise(Access access)
+{
+	if ((access == this->access) || !this->map) return;
+	int advice;
+	switch (access) {
+		case Sequential: advice = MADV_SEQUENTIAL; break;
+		case Random: advice = MADV_RANDOM; break;
+		default: advice = MADV_NORMAL; break;
+	}
+	// Only a hint, so failure doesn't matter
+	madvise(this->map, this->mapLength, advice);
+	this->access = access;
+	return;
+}
+
+const uint8_t *MmapStream::getData() const
+{
+	return this->map;
+}
+
+void MmapStream::checkSize() const
+{
+	if (!this->lost) return;
+	struct stat st;
+	if (fstat(this->fd, &st) < 0) return;
+	if ((camoto::stream::len)st.st_size < this->length) this->length = st.st_size;
+	return;
+}
+
+void MmapStream::sigbus(int sig, siginfo_t *info, void *context)
+{
+	uint8_t *addr = (uint8_t *)info->si_addr;
+	for (int i = 0; i < MMAP_MAX; i++) {
+		MmapStream *m = mappings[i];
+		if (!m || (addr < m->map) || (addr >= m->map + m->mapLength)) continue;
+
+		// The page is past the end of the file now.  Put a page of zeros in its
+		// place, so the access that faulted can carry on.
+		void *page = (void *)((uintptr_t)addr & ~(pageSize - 1));
+		if (mmap(page, pageSize, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+			-1, 0) == MAP_FAILED) break;
+		m->lost = true;
+		return;
+	}
+
+	// Not a mapped file, so let the fault happen again with the old handler
+	sigaction(SIGBUS, &oldSigbus, NULL);
+	return;
+}
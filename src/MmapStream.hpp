@@ -0,0 +1,108 @@
+/**
+ * @file   MmapStream.hpp
+ * @brief  Read-only stream backed by a memory-mapped file.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MMAPSTREAM_HPP_
+#define MMAPSTREAM_HPP_
+
+#include <signal.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <camoto/stream.hpp>
+
+/// Read-only stream reading from a memory-mapped file.
+/**
+ * Reads are a copy out of the mapping, so once the data is in the page cache
+ * no system calls are needed.  Code that wants to avoid even the copy can
+ * use getData() to access the mapping directly.
+ *
+ * If the file is truncated while it is mapped, touching the pages that were
+ * cut off would normally kill the process with SIGBUS.  Instead those pages
+ * are replaced with zeros, and the stream shrinks to the new size of the
+ * file, the same as if it were being read normally.
+ */
+class MmapStream: virtual public camoto::stream::inout
+{
+	public:
+		/// How the data is about to be accessed, to tune the kernel's read-ahead.
+		enum Access {
+			Normal,     ///< No particular pattern
+			Sequential, ///< Reading through the file from start to end
+			Random,     ///< Jumping around the file
+		};
+
+		/// Map a file into memory.
+		/**
+		 * @param strFilename
+		 *   File to open.
+		 *
+		 * @throw camoto::stream::open_error if the file could not be opened or
+		 *   mapped, e.g. because it is not a regular file or too many files are
+		 *   already mapped.
+		 */
+		MmapStream(const std::string& strFilename);
+
+		virtual ~MmapStream();
+
+		virtual camoto::stream::len try_read(uint8_t *buffer,
+			camoto::stream::len len);
+		virtual void seekg(camoto::stream::delta off,
+			camoto::stream::seek_from from);
+		virtual camoto::stream::pos tellg() const;
+		virtual camoto::stream::len size() const;
+
+		/// @throw camoto::stream::write_error always, as the file is read-only.
+		virtual camoto::stream::len try_write(const uint8_t *buffer,
+			camoto::stream::len len);
+		virtual void seekp(camoto::stream::delta off,
+			camoto::stream::seek_from from);
+		virtual camoto::stream::pos tellp() const;
+		/// @throw camoto::stream::write_error always, as the file is read-only.
+		virtual void truncate(camoto::stream::len size);
+		virtual void flush();
+
+		/// Tell the kernel how the data will be accessed from now on.
+		void advise(Access access);
+
+		/// Get a pointer to the start of the mapped data.
+		/**
+		 * @return Pointer to size() bytes, or NULL if the file is empty.  If the
+		 *   file is truncated while this is being used, the part that was cut
+		 *   off reads as zeros.
+		 */
+		const uint8_t *getData() const;
+
+	protected:
+		/// Shrink length if the file has been truncated since it was mapped.
+		void checkSize() const;
+
+		/// SIGBUS handler, replacing pages lost from a mapped file with zeros.
+		static void sigbus(int sig, siginfo_t *info, void *context);
+
+		int fd;                        ///< File descriptor of mapped file
+		uint8_t *map;                  ///< Start of mapping, or NULL if empty
+		camoto::stream::len mapLength; ///< Size of mapping in bytes
+		mutable camoto::stream::len length; ///< Size of file, at most mapLength
+		camoto::stream::pos offset;    ///< Current read position
+		Access access;                 ///< Last value passed to advise()
+		std::atomic<bool> lost;        ///< Some pages have been cut off
+};
+
+#endif // MMAPSTREAM_HPP_
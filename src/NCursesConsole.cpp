@@ -21,12 +21,14 @@
 #include <cassert>
 #include <cstring> // strerror()
 #include <iostream> // for errors before we get to nCurses
-#include <errno.h>
-#include <unistd.h> // sleep()
+#include <unistd.h> // isatty()
 
 #include "cfg.hpp"
+#include "cp437.hpp"
 #include "NCursesConsole.hpp"
 
+#define min(x, y) (((x) < (y)) ? (x) : (y))
+
 // Not sure why these aren't defined elsewhere...is this even portable??
 #define NC_KEY_ENTER1 '\r'
 #define NC_KEY_ENTER2 '\n'
@@ -36,67 +38,35 @@ static const int cgaColours[] = {COLOR_BLACK, COLOR_BLUE, COLOR_GREEN,
 	COLOR_CYAN, COLOR_RED, COLOR_MAGENTA, COLOR_YELLOW, COLOR_WHITE
 };
 
-wchar_t ctl_utf8[] = {
-	0x0020, // NULL = space
-	0x263A, // Ctrl+A == transparent smiley face
-	0x263B, // Ctrl+B == opaque smiley face
-	0x2665, // Heart
-	0x2666, // Diamond
-	0x2663, // Club
-	0x2660, // Spade
-	0x2022, // bullet
-	0x25D8, // inverted bullet
-	0x25CB, // small circle
-	0x25D9, // inverted small circle
-	0x2642, // male
-	0x2640, // female
-	0x266A, // single note
-	0x266B, // double note
-	0x263C, // O thing
-	0x25BA, // solid > triangle
-	0x25C4, // solid < triangle
-	0x2195, // up/down arrow
-	0x203C, // double exclamation mark
-	0x00B6, // end of paragraph marker
-	0x00A7, // weird S thing
-	0x25AC, // thick underline
-	0x21A8, // underlined up/down arrow
-	0x2191, // up arrow
-	0x2193, // down arrow
-	0x2192, // right arrow
-	0x2190, // left arrow
-	0x221F, // |_ brackety thing (should be a bit shorter)
-	0x2194, // left/right arrow
-	0x25B2, // solid ^ triangle
-	0x25BC, // solid v triangle
-};
-const wchar_t ctl_utf8_0x7f = 0x2302;
+/// Colour pair for each attribute.
+static const int attrPairs[ATTR_COUNT] = {CLR_CONTENT, CLR_STATUSBAR,
+	CLR_HIGHLIGHT};
 
 NCursesConsole::NCursesConsole(void)
-	:	maxLineLen(80),
-		cursorInWindow(true)
+	:	line(256)
 {
-	// Init iconv
+	// Work out the Unicode character for each byte once, so text can be
+	// converted with a table lookup.
 	setlocale(LC_ALL, ""); // set locale based on LANG env var
-	this->cd = iconv_open("WCHAR_T", "IBM437");
-	if (this->cd == (iconv_t)-1) {
-		if (errno == EINVAL) {
-			printf("iconv open failed, unable to convert from IBM437 to WCHAR_T\n"
-				"Extended characters will look funny...\n");
-		} else {
-			perror("iconv open failed");
-		}
-		sleep(2);
+	for (int i = 0; i < 256; i++) this->glyphs[i] = cp437_unicode[i];
+
+	// Init ncurses.  If the data is coming in through stdin, read the keyboard
+	// from the terminal instead.
+	this->tty = NULL;
+	if (!isatty(STDIN_FILENO)) this->tty = fopen("/dev/tty", "r");
+	if (this->tty) {
+		this->screen = newterm(NULL, stdout, this->tty);
+	} else {
+		this->screen = NULL;
+		initscr();
 	}
 
-	// Init ncurses
-	initscr();
-
 	raw();  // Line buffering disabled (get keys as they're pressed)
 	keypad(stdscr, TRUE);  // Get F1, F2, etc.
 	noecho();  // Don't echo keypresses with getch()
 	nonl(); // Don't autoconvert the return key
 	curs_set(0);  // Hide the cursor
+	timeout(IDLE_INTERVAL);  // Let views update while waiting for a key
 
 	// Create the status bars
 	this->winStatus[0] = newwin(1, COLS, 0, 0);
@@ -104,6 +74,7 @@ NCursesConsole::NCursesConsole(void)
 
 	// Create the main window between the status bars
 	this->winContent = newwin(LINES - 2, COLS, 1, 0);
+	this->resizeGrid(COLS, LINES);
 
 	// Define our colours
 	if (has_colors() == FALSE) {
@@ -113,7 +84,6 @@ NCursesConsole::NCursesConsole(void)
 	this->setColoursFromConfig();
 
 	idlok(this->winContent, TRUE); // enable efficient scrolling
-	scrollok(this->winContent, TRUE); // Allow scrolling
 
 	wnoutrefresh(this->winStatus[0]);
 	wnoutrefresh(this->winStatus[1]);
@@ -130,16 +100,23 @@ NCursesConsole::~NCursesConsole()
 
 	// Restore the terminal
 	endwin();
-
-	iconv_close(this->cd);
+	if (this->screen) delscreen(this->screen);
+	if (this->tty) fclose(this->tty);
 }
 
 void NCursesConsole::mainLoop()
 {
 	Key c;
 	bool escape = false; // was last keypress ESC?
-	do {
-		c = (Key)getch();
+	for (;;) {
+		int k = getch();
+		if (k == ERR) {
+			// No key pressed within IDLE_INTERVAL
+			this->flushUpdate();
+			this->idle();
+			continue;
+		}
+		c = (Key)k;
 		if (c & KEY_CODE_YES) {
 			// Convert platform-specific keys into generic keys
 			switch (c) {
@@ -163,11 +140,11 @@ void NCursesConsole::mainLoop()
 					this->winStatus[0] = newwin(1, COLS, 0, 0);
 					this->winStatus[1] = newwin(1, COLS, LINES-1, 0);
 					this->winContent = newwin(LINES - 2, COLS, 1, 0);
+					this->resizeGrid(COLS, LINES);
 
 					this->setColoursFromConfig();
 
 					idlok(this->winContent, TRUE); // enable efficient scrolling
-					scrollok(this->winContent, TRUE); // Allow scrolling
 
 					this->view->redrawScreen();
 					continue;
@@ -189,121 +166,89 @@ void NCursesConsole::mainLoop()
 				}
 			}
 		}
-	} while (this->processKey(c));
-
-	return;
-}
 
-void NCursesConsole::update(void)
-{
-	wnoutrefresh(this->winStatus[0]);
-	wnoutrefresh(this->winStatus[1]);
-	wnoutrefresh(this->winContent);
-	if (!this->cursorInWindow) {
-		// Refresh the status bar again so the cursor ends up in this window
-		wnoutrefresh(this->winStatus[1]);
+		// See whether another key is already waiting, and if so only draw the
+		// screen once it has been handled too.
+		timeout(0);
+		int next = getch();
+		timeout(IDLE_INTERVAL);
+		if (next != ERR) ungetch(next);
+		if (!this->processQueuedKey(c, next != ERR)) break;
 	}
-	// Copy the virtual screen onto the terminal
-	doupdate();
-}
 
-void NCursesConsole::clearStatusBar(SB_Y eY)
-{
-	// Erasing the line avoids the entire screen flickering as it does if we
-	// use wclear() instead.
-	wmove(this->winStatus[eY], 0, 0);
-	wclrtoeol(this->winStatus[eY]);
-	this->cursorInWindow = true;
 	return;
 }
 
-void NCursesConsole::setStatusBar(SB_Y eY, SB_X eX,
-	const std::string& strMessage, int cursor)
+void NCursesConsole::drawChanges()
 {
-	int x;
-	switch (eX) {
-		case SB_LEFT:   x = 0; break;
-		case SB_CENTRE: x = (COLS + strMessage.length() / 2); break;
-		case SB_RIGHT:  x = COLS - strMessage.length(); break;
+	// Move what is already on the screen first.  Scrolling is otherwise left
+	// off, so writing to the bottom-right cell doesn't move everything up a
+	// line.
+	int iY = this->takeScroll();
+	if (iY) {
+		scrollok(this->winContent, TRUE);
+		wscrl(this->winContent, iY);
+		scrollok(this->winContent, FALSE);
 	}
-	wmove(this->winStatus[eY], 0, x);
-	waddstr(this->winStatus[eY], strMessage.c_str());
-	if (cursor >= 0) {
-		wmove(this->winStatus[eY], 0, x + cursor);
-		this->cursorInWindow = false;
-	} else {
-		this->cursorInWindow = true;
-	}
-	return;
-}
-
-void NCursesConsole::gotoxy(int x, int y)
-{
-	wmove(this->winContent, y, x);
-	this->cursorInWindow = true;
-	return;
-}
 
-void NCursesConsole::putstr(const std::string& strContent)
-{
-	if (this->cd != (iconv_t)-1) {
-		// iconv is valid, convert
-	again:
-		wchar_t *wout = new wchar_t[this->maxLineLen];
-		char *pIn = (char *)strContent.c_str();
-		char *pOut = (char *)wout;
-		size_t inleft = strContent.length(), outleft = sizeof(wchar_t) * this->maxLineLen;
-		if (iconv(cd, &pIn, &inleft, &pOut, &outleft) == (size_t)-1) {
-			if ((errno == E2BIG) && (this->maxLineLen < 0x10000)) {
-				this->maxLineLen <<= 1;
-				delete[] wout;
-				goto again;
-			}
-			this->setStatusBar(SB_BOTTOM, SB_LEFT, std::string("!!> iconv error: ") + strerror(errno),
-				SB_NO_CURSOR_MOVE);
-		} else {
-			size_t iCount = (wchar_t *)pOut - wout;
-			for (int i = 0; i < iCount; i++) {
-				if (wout[i] < 32) {
-					// This is a control character, so escape it manually
-					wout[i] = ctl_utf8[wout[i]];
-				} else if (wout[i] == 127) {
-					// Also not escaped
-					wout[i] = ctl_utf8_0x7f;
-				}
+	// Only pass curses the cells that have changed
+	if ((int)this->line.size() < this->screenWidth) {
+		this->line.resize(this->screenWidth);
+	}
+	for (int y = 0; y < this->screenHeight; y++) {
+		int start, end;
+		if (!this->dirtyExtent(y, &start, &end)) continue;
+		int winY;
+		WINDOW *win = this->windowForRow(y, &winY);
+		const Cell *row = &this->cells[y * this->screenWidth];
+		wmove(win, winY, start);
+		while (start < end) {
+			// Write each run of the same colour in one go
+			uint8_t attr = row[start].attr;
+			int len = 0;
+			for (int x = start; (x < end) && (row[x].attr == attr); x++) {
+				this->line[len++] = this->glyphs[row[x].ch];
 			}
-			waddnwstr(this->winContent, wout, iCount);
+			int pair = attrPairs[attr < ATTR_COUNT ? attr : ATTR_CONTENT];
+			wattrset(win, COLOR_PAIR(pair) | this->iAttribute[pair]);
+			waddnwstr(win, &this->line[0], len);
+			start += len;
 		}
-		delete[] wout;
-	} else {
-		// No conversion, display as-is
-		waddstr(this->winContent, strContent.c_str());
 	}
-	return;
-}
+	this->clearAllDirty();
 
-void NCursesConsole::getContentDims(int *iWidth, int *iHeight)
-{
-	getmaxyx(this->winContent, *iHeight, *iWidth);
-	return;
-}
+	// Refresh the window with the cursor last, so the cursor ends up there
+	int winY;
+	WINDOW *winCursor = this->windowForRow(this->cursorY, &winY);
+	wmove(winCursor, winY, min(this->cursorX, this->screenWidth - 1));
+	if (winCursor != this->winStatus[0]) wnoutrefresh(this->winStatus[0]);
+	if (winCursor != this->winStatus[1]) wnoutrefresh(this->winStatus[1]);
+	if (winCursor != this->winContent) wnoutrefresh(this->winContent);
+	wnoutrefresh(winCursor);
 
-void NCursesConsole::scrollContent(int iX, int iY)
-{
-	wscrl(this->winContent, iY);
-	return;
+	// Copy the virtual screen onto the terminal
+	doupdate();
 }
 
-void NCursesConsole::eraseToEOL(void)
+void NCursesConsole::cursor(bool visible)
 {
-	wclrtoeol(this->winContent);
+	this->BaseConsole::cursor(visible);
+	curs_set(visible ? 1 : 0);
 	return;
 }
 
-void NCursesConsole::cursor(bool visible)
+WINDOW *NCursesConsole::windowForRow(int y, int *winY)
 {
-	curs_set(visible ? 1 : 0);
-	return;
+	if (y <= 0) {
+		*winY = 0;
+		return this->winStatus[0];
+	}
+	if (y >= this->screenHeight - 1) {
+		*winY = 0;
+		return this->winStatus[1];
+	}
+	*winY = y - 1;
+	return this->winContent;
 }
 
 void NCursesConsole::setColoursFromConfig()
@@ -318,6 +263,11 @@ void NCursesConsole::setColoursFromConfig()
 		cgaColours[cfg.clrContent.iBG & 7]);
 	this->iAttribute[CLR_CONTENT] =
 		(cfg.clrContent.iFG & 8) ? A_BOLD : A_NORMAL;
+	init_pair(CLR_HIGHLIGHT,
+		cgaColours[cfg.clrHighlight.iFG & 7],
+		cgaColours[cfg.clrHighlight.iBG & 7]);
+	this->iAttribute[CLR_HIGHLIGHT] =
+		(cfg.clrHighlight.iFG & 8) ? A_BOLD : A_NORMAL;
 
 	for (int i = 0; i < 2; i++) {
 		wattrset(this->winStatus[i],
@@ -331,5 +281,8 @@ void NCursesConsole::setColoursFromConfig()
 	wbkgdset(this->winContent, COLOR_PAIR(CLR_CONTENT));
 	wclear(this->winContent);
 
+	// Everything has been cleared, so it all has to be written out again
+	this->markAllDirty();
+
 	return;
 }
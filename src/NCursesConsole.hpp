@@ -33,11 +33,7 @@
 # error This file should not be compiled without ncurses!
 #endif
 
-#ifndef HAVE_ICONV
-#error This file should not be compiled without iconv!
-#endif
-
-#include <iconv.h>
+#include <vector>
 #include "BaseConsole.hpp"
 
 /// Console interface to a standard terminal using ncurses for control codes.
@@ -48,33 +44,39 @@ class NCursesConsole: virtual public BaseConsole
 		// will overwrite the content window!
 		WINDOW *winStatus[2]; ///< Status bars (0 == top, 1 == bottom)
 		WINDOW *winContent;   ///< Main display area (between the status bars)
-		bool cursorInWindow;  ///< false if the cursor is in the bottom status bar
 
-		int maxLineLen;  ///< Maximum length of a single line (will expand as necessary)
+		wchar_t glyphs[256]; ///< Character to display for each code page 437 byte
+		std::vector<wchar_t> line; ///< Reused buffer for converting changed cells
 
-		iconv_t cd;      ///< iconv handle
+		FILE *tty;       ///< Terminal, if stdin is being used for data, or NULL
+		SCREEN *screen;  ///< ncurses screen on tty, or NULL if using stdin
 
 // Colour pairs
 #define CLR_STATUSBAR 1
 #define CLR_CONTENT 2
-		attr_t iAttribute[3]; ///< Attributes (bold etc.) for matching colour pairs
+#define CLR_HIGHLIGHT 3
+		attr_t iAttribute[4]; ///< Attributes (bold etc.) for matching colour pairs
 
 	public:
 		NCursesConsole(void);
 		virtual ~NCursesConsole();
 
 		void mainLoop();
-		void update(void);
-		void clearStatusBar(SB_Y eY);
-		void setStatusBar(SB_Y eY, SB_X eX, const std::string& strMessage,
-			int cursor);
-		void gotoxy(int x, int y);
-		void putstr(const std::string& strContent);
-		void getContentDims(int *iWidth, int *iHeight);
-		void scrollContent(int iX, int iY);
-		void eraseToEOL(void);
 		void cursor(bool visible);
 		void setColoursFromConfig();
+
+	protected:
+		void drawChanges();
+
+		/// Find the curses window showing a row of the screen.
+		/**
+		 * @param y
+		 *   Row of the screen, 0 is the top status bar.
+		 *
+		 * @param winY
+		 *   On return, the row within the window.
+		 */
+		WINDOW *windowForRow(int y, int *winY);
 };
 
 #endif // NCURSESCONSOLE_HPP_
@@ -0,0 +1,139 @@
+/**
+ * @file   Prefetcher.cpp
+ * @brief  Background read-ahead following the direction of scrolling.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Prefetcher.hpp"
+
+#define min(x, y) (((x) < (y)) ? (x) : (y))
+#define max(x, y) (((x) > (y)) ? (x) : (y))
+
+Prefetcher::Prefetcher(std::shared_ptr<CachedStream> cache)
+	:	cache(cache),
+		stop(false),
+		request(0),
+		start(0),
+		end(0),
+		backwards(false),
+		streak(0),
+		rate(0),
+		worker(&Prefetcher::run, this)
+{
+}
+
+Prefetcher::~Prefetcher()
+{
+	{
+		std::lock_guard<std::mutex> l(this->lock);
+		this->stop = true;
+	}
+	this->wake.notify_one();
+	this->worker.join();
+}
+
+void Prefetcher::scrolled(camoto::stream::pos offset,
+	camoto::stream::delta delta, camoto::stream::len screen)
+{
+	if ((delta == 0) || (screen == 0)) return;
+
+	// Work out how fast we're going.  A pause of more than a second starts
+	// afresh, so a single keypress after a long scroll doesn't read megabytes.
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	double elapsed = std::chrono::duration<double>(now - this->lastScroll).count();
+	this->lastScroll = now;
+	camoto::stream::len dist = (delta < 0) ? -delta : delta;
+	bool back = delta < 0;
+	if ((elapsed > 1.0) || (this->streak == 0)) {
+		this->streak = 1;
+		this->rate = 0;
+	} else {
+		if (back == this->backwards) this->streak++;
+		else this->streak = 1;
+		double speed = dist / max(elapsed, 0.001);
+		this->rate = this->rate * 0.7 + speed * 0.3;
+	}
+
+	// Only look one screen ahead until the direction is clear, then go further
+	// the faster the user is moving.
+	camoto::stream::len ahead = screen;
+	if (this->streak > 1) {
+		ahead = max(screen * PREFETCH_SCREENS,
+			(camoto::stream::len)(this->rate * PREFETCH_SECONDS));
+		ahead = min(ahead, PREFETCH_MAX);
+	}
+	// Leave room in the cache for what's on the screen now
+	ahead = min(ahead, this->cache->getBudget() / 2);
+
+	std::lock_guard<std::mutex> l(this->lock);
+	this->backwards = back;
+	if (back) {
+		this->start = (offset > ahead) ? offset - ahead : 0;
+		this->end = offset;
+	} else {
+		this->start = offset + screen;
+		this->end = this->start + ahead;
+	}
+	this->request++;
+	this->wake.notify_one();
+	return;
+}
+
+void Prefetcher::run()
+{
+	unsigned long done = 0;
+	std::unique_lock<std::mutex> l(this->lock);
+	for (;;) {
+		while (!this->stop && (this->request == done)) this->wake.wait(l);
+		if (this->stop) break;
+
+		done = this->request;
+		camoto::stream::pos first = this->start;
+		camoto::stream::pos last = this->end;
+		bool back = this->backwards;
+		l.unlock();
+
+		// Read the blocks nearest the screen first, and give up as soon as a
+		// newer range comes in.
+		first -= first % CACHE_BLOCK;
+		try {
+			if (back) {
+				camoto::stream::pos off = last;
+				while (off > first) {
+					off -= min(off - first, (camoto::stream::pos)CACHE_BLOCK);
+					this->cache->prefetch(off);
+					std::lock_guard<std::mutex> c(this->lock);
+					if (this->stop || (this->request != done)) break;
+				}
+			} else {
+				for (camoto::stream::pos off = first; off < last; off += CACHE_BLOCK) {
+					if (!this->cache->prefetch(off) && !this->cache->isCached(off)) {
+						break; // past EOF
+					}
+					std::lock_guard<std::mutex> c(this->lock);
+					if (this->stop || (this->request != done)) break;
+				}
+			}
+		} catch (const camoto::stream::error&) {
+			// The read will be tried again, and the error reported, when the data
+			// is actually needed.
+		}
+
+		l.lock();
+	}
+	return;
+}
@@ -0,0 +1,95 @@
+/**
+ * @file   Prefetcher.hpp
+ * @brief  Background read-ahead following the direction of scrolling.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PREFETCHER_HPP_
+#define PREFETCHER_HPP_
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "CachedStream.hpp"
+
+/// Number of screens to read ahead once scrolling is under way.
+#define PREFETCH_SCREENS  4
+
+/// How many seconds of scrolling at the current speed to read ahead.
+#define PREFETCH_SECONDS  1.0
+
+/// Most data to read ahead, in bytes.  Never more than half the cache.
+#define PREFETCH_MAX      (8 << 20)
+
+/// Reads data into a CachedStream before it is needed.
+/**
+ * The views call scrolled() each time they move through the file.  From this
+ * the direction and speed of scrolling is worked out, and a background thread
+ * reads the data that is likely to be shown next, so holding down PageDown
+ * on slow storage doesn't wait on a read for every screen.
+ */
+class Prefetcher
+{
+	public:
+		/// Start the background thread.
+		/**
+		 * @param cache
+		 *   Cache to load data into.
+		 */
+		Prefetcher(std::shared_ptr<CachedStream> cache);
+
+		/// Stop the background thread, waiting for any read in progress.
+		~Prefetcher();
+
+		/// Notify that the view has scrolled.
+		/**
+		 * @param offset
+		 *   Offset in bytes of the first byte now on the screen.
+		 *
+		 * @param delta
+		 *   Number of bytes scrolled, negative if towards the start of the file.
+		 *
+		 * @param screen
+		 *   Number of bytes visible on the screen.
+		 */
+		void scrolled(camoto::stream::pos offset, camoto::stream::delta delta,
+			camoto::stream::len screen);
+
+	protected:
+		/// Background thread.
+		void run();
+
+		std::shared_ptr<CachedStream> cache; ///< Where to put the data
+
+		std::mutex lock;                  ///< Protects everything below
+		std::condition_variable wake;     ///< Signalled when there's new work
+		bool stop;                        ///< true when the thread should exit
+		unsigned long request;            ///< Incremented on each new range
+		camoto::stream::pos start;        ///< First byte to read ahead
+		camoto::stream::pos end;          ///< Stop reading ahead at this byte
+		bool backwards;                   ///< Read from end down to start
+
+		// Only used by scrolled()
+		int streak;                       ///< Scrolls in a row in one direction
+		double rate;                      ///< Average scroll speed in bytes/sec
+		std::chrono::steady_clock::time_point lastScroll; ///< Time of last call
+
+		std::thread worker;               ///< Thread running run()
+};
+
+#endif // PREFETCHER_HPP_
@@ -0,0 +1,170 @@
+/**
+ * @file   RunMap.cpp
+ * @brief  Background search for data that repeats every row.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include "RunMap.hpp"
+#include "BulkReader.hpp"
+#include "ByteCompare.hpp"
+#include "Stats.hpp"
+
+#define min(x, y) (((x) < (y)) ? (x) : (y))
+
+RunMap::RunMap(std::shared_ptr<camoto::stream::inout> data,
+	std::shared_ptr<HoleMap> holes, camoto::stream::len period)
+	:	data(data),
+		holes(holes),
+		period(period),
+		open({0, 0}),
+		inRun(false),
+		runFrom(0),
+		progress(0),
+		complete(false),
+		stop(false),
+		worker(&RunMap::run, this)
+{
+}
+
+RunMap::~RunMap()
+{
+	this->stop = true;
+	this->worker.join();
+}
+
+camoto::stream::len RunMap::getPeriod() const
+{
+	return this->period;
+}
+
+bool RunMap::find(camoto::stream::pos start, camoto::stream::pos end,
+	camoto::stream::pos *runStart, camoto::stream::pos *runEnd) const
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+
+	// Last run starting at or before start
+	auto next = std::upper_bound(this->runs.begin(), this->runs.end(), start,
+		[](camoto::stream::pos o, const Run& r) { return o < r.start; });
+	if (next != this->runs.begin()) {
+		auto prev = next - 1;
+		if (end <= prev->end) {
+			*runStart = prev->start;
+			*runEnd = prev->end;
+			return true;
+		}
+	}
+	if ((this->open.start <= start) && (end <= this->open.end)) {
+		*runStart = this->open.start;
+		*runEnd = this->open.end;
+		return true;
+	}
+	return false;
+}
+
+camoto::stream::pos RunMap::getProgress() const
+{
+	return this->progress;
+}
+
+bool RunMap::isComplete() const
+{
+	return this->complete;
+}
+
+unsigned long RunMap::getMemory() const
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	return this->runs.capacity() * sizeof(Run);
+}
+
+void RunMap::run()
+{
+	Stats::Timer timer(Stats::Phase_Index);
+	// The last period bytes of the previous chunk, to compare against the
+	// start of the next one.
+	std::vector<uint8_t> tail, join;
+	try {
+		BulkReader reader(this->data, this->holes);
+		reader.scan(0, this->data->size(),
+			[&](camoto::stream::pos offset, const uint8_t *buf, camoto::stream::len len) {
+				if (this->stop) return false;
+
+				camoto::stream::len t = tail.size();
+				camoto::stream::len k = min(len, this->period);
+				if (t + k > this->period) {
+					join.assign(tail.begin(), tail.end());
+					join.insert(join.end(), buf, buf + k);
+					this->compare(&join[0], &join[this->period], t + k - this->period,
+						offset - t);
+				}
+				if (len > this->period) {
+					this->compare(buf, buf + this->period, len - this->period, offset);
+					tail.assign(buf + len - this->period, buf + len);
+				} else {
+					tail.insert(tail.end(), buf, buf + len);
+					if (tail.size() > this->period) {
+						tail.erase(tail.begin(), tail.end() - this->period);
+					}
+				}
+				this->progress = offset + len;
+				return !this->stop;
+			});
+	} catch (const camoto::stream::error&) {
+		// Rows past the error just won't be collapsed
+	}
+
+	{
+		// Keep the run that went right up to the end of the file
+		std::lock_guard<std::mutex> guard(this->lock);
+		if (this->inRun && (this->open.end - this->open.start >= this->period)) {
+			this->runs.push_back(this->open);
+		}
+		this->open = {0, 0};
+	}
+	this->complete = true;
+	return;
+}
+
+void RunMap::compare(const uint8_t *a, const uint8_t *b,
+	camoto::stream::len len, camoto::stream::pos offset)
+{
+	camoto::stream::len i = 0;
+	while (i < len) {
+		if (this->inRun) {
+			i += sameLength(a + i, b + i, len - i);
+			if (i == len) break;
+			// Run has ended, only keep it if it's long enough to cover a row
+			this->inRun = false;
+			if (offset + i - this->runFrom >= this->period) {
+				std::lock_guard<std::mutex> guard(this->lock);
+				this->runs.push_back({this->runFrom, offset + i});
+				if (this->runs.size() >= RUNMAP_MAX_RUNS) this->stop = true;
+			}
+		} else {
+			i += diffLength(a + i, b + i, len - i);
+			if (i == len) break;
+			this->inRun = true;
+			this->runFrom = offset + i;
+		}
+	}
+
+	std::lock_guard<std::mutex> guard(this->lock);
+	if (this->inRun) this->open = {this->runFrom, offset + len};
+	else this->open = {0, 0};
+	return;
+}
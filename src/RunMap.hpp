@@ -0,0 +1,147 @@
+/**
+ * @file   RunMap.hpp
+ * @brief  Background search for data that repeats every row.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RUNMAP_HPP_
+#define RUNMAP_HPP_
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <camoto/stream.hpp>
+#include "HoleMap.hpp"
+
+/// Stop looking for runs after finding this many.
+#define RUNMAP_MAX_RUNS (1 << 20)
+
+/// Where the data repeats itself every row.
+/**
+ * A run is a range of bytes where each byte is the same as the one a row
+ * further on.  Any row that starts a row after the start of a run, and ends
+ * within it, is identical to the row above it and can be collapsed into one
+ * marker line, as hexdump does with '*'.
+ *
+ * Since a run is defined by the row length and not by where the rows start,
+ * the same map works no matter which byte is at the top of the screen.
+ *
+ * The map is built by a background thread reading through the whole file,
+ * comparing 16 bytes at a time with SSE2 where available.  Until it has
+ * finished, only runs before getProgress() are known.
+ */
+class RunMap
+{
+	public:
+		/// Start building the map.
+		/**
+		 * @param data
+		 *   Data to search.  Must be safe to read from another thread, i.e.
+		 *   cached, mapped or spooled.
+		 *
+		 * @param holes
+		 *   Holes in data, or NULL if it isn't a sparse file.
+		 *
+		 * @param period
+		 *   Length of a row in bytes.
+		 */
+		RunMap(std::shared_ptr<camoto::stream::inout> data,
+			std::shared_ptr<HoleMap> holes, camoto::stream::len period);
+
+		/// Stop the background thread.
+		~RunMap();
+
+		/// Length of a row in bytes, as passed to the constructor.
+		camoto::stream::len getPeriod() const;
+
+		/// Find the run containing a range of bytes.
+		/**
+		 * @param start
+		 *   First byte that must be in the run.
+		 *
+		 * @param end
+		 *   One past the last byte that must be in the run.
+		 *
+		 * @param runStart
+		 *   On return, the first byte of the run.
+		 *
+		 * @param runEnd
+		 *   On return, one past the last byte of the run, or of the part found
+		 *   so far if the run is still being searched.
+		 *
+		 * @return true if the whole range is in one run, false if not or if it
+		 *   hasn't been searched yet.
+		 */
+		bool find(camoto::stream::pos start, camoto::stream::pos end,
+			camoto::stream::pos *runStart, camoto::stream::pos *runEnd) const;
+
+		/// Offset the search has reached, in bytes.
+		camoto::stream::pos getProgress() const;
+
+		/// Has the whole file been searched?
+		bool isComplete() const;
+
+		/// Get the memory used to store the runs, in bytes.
+		unsigned long getMemory() const;
+
+	protected:
+		/// A range of bytes that repeats every period bytes.
+		struct Run {
+			camoto::stream::pos start; ///< First byte of the run
+			camoto::stream::pos end;   ///< One past the last byte of the run
+		};
+
+		/// Background thread.
+		void run();
+
+		/// Compare bytes with those period bytes later, and record any runs.
+		/**
+		 * @param a
+		 *   Bytes to compare.
+		 *
+		 * @param b
+		 *   Bytes period bytes after those in a.
+		 *
+		 * @param len
+		 *   Number of bytes to compare.
+		 *
+		 * @param offset
+		 *   Offset in the file of a[0].
+		 */
+		void compare(const uint8_t *a, const uint8_t *b, camoto::stream::len len,
+			camoto::stream::pos offset);
+
+		std::shared_ptr<camoto::stream::inout> data; ///< Data being searched
+		std::shared_ptr<HoleMap> holes; ///< Holes to skip, or NULL
+		camoto::stream::len period;    ///< Row length in bytes
+
+		mutable std::mutex lock;       ///< Protects runs and open
+		std::vector<Run> runs;         ///< Runs found so far, in offset order
+		Run open;                      ///< Run still being searched, or empty
+
+		// Only used by the background thread
+		bool inRun;                    ///< Was the last byte compared the same?
+		camoto::stream::pos runFrom;   ///< Start of the current run if inRun
+
+		std::atomic<camoto::stream::pos> progress; ///< Bytes searched so far
+		std::atomic<bool> complete;    ///< true once the whole file is searched
+		std::atomic<bool> stop;        ///< true when the thread should exit
+		std::thread worker;            ///< Thread running run()
+};
+
+#endif // RUNMAP_HPP_
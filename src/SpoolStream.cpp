@@ -0,0 +1,220 @@
+/**
+ * @file   SpoolStream.cpp
+ * @brief  Seekable stream of data arriving through a pipe.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include "SpoolStream.hpp"
+#include "Stats.hpp"
+
+/// Amount of data to copy from the pipe at a time.
+#define SPOOL_CHUNK (1 << 16)
+
+/// How often the reader thread checks whether it should exit, in milliseconds.
+#define SPOOL_POLL 200
+
+SpoolStream::SpoolStream(int fd, camoto::stream::len ahead)
+	:	fd(fd),
+		offset(0),
+		ahead(ahead),
+		received(0),
+		complete(false),
+		stop(false),
+		wanted(0)
+{
+	this->spool = tmpfile();
+	if (!this->spool) {
+		throw camoto::stream::open_error(std::string("Unable to create temporary "
+			"file: ") + strerror(errno));
+	}
+	this->spoolFd = fileno(this->spool);
+	this->reader = std::thread(&SpoolStream::run, this);
+}
+
+SpoolStream::~SpoolStream()
+{
+	{
+		std::lock_guard<std::mutex> l(this->lock);
+		this->stop = true;
+	}
+	this->more.notify_one();
+	this->reader.join();
+	fclose(this->spool);
+	::close(this->fd);
+}
+
+camoto::stream::len SpoolStream::try_read(uint8_t *buffer,
+	camoto::stream::len len)
+{
+	Stats::Timer wait(Stats::Phase_IOWait);
+	this->want(this->offset + len);
+	camoto::stream::len avail = this->received;
+	if (this->offset >= avail) return 0;
+	if (len > avail - this->offset) len = avail - this->offset;
+	camoto::stream::len total = 0;
+	while (total < len) {
+		ssize_t r = pread(this->spoolFd, buffer + total, len - total,
+			this->offset + total);
+		if (r < 0) {
+			if (errno == EINTR) continue;
+			throw camoto::stream::read_error(strerror(errno));
+		}
+		if (r == 0) break;
+		total += r;
+	}
+	this->offset += total;
+	::stats.bytesRead += total;
+	return total;
+}
+
+void SpoolStream::seekg(camoto::stream::delta off,
+	camoto::stream::seek_from from)
+{
+	camoto::stream::len length = this->received;
+	camoto::stream::delta target;
+	switch (from) {
+		case camoto::stream::cur: target = this->offset + off; break;
+		case camoto::stream::end: target = length + off; break;
+		default: target = off; break;
+	}
+	if ((target < 0) || ((camoto::stream::pos)target > length)) {
+		throw camoto::stream::seek_error("Seek past end of data received so far");
+	}
+	this->offset = target;
+	return;
+}
+
+camoto::stream::pos SpoolStream::tellg() const
+{
+	return this->offset;
+}
+
+camoto::stream::len SpoolStream::size() const
+{
+	return this->received;
+}
+
+camoto::stream::len SpoolStream::try_write(const uint8_t *buffer,
+	camoto::stream::len len)
+{
+	throw camoto::stream::write_error("Streamed data is read-only");
+}
+
+void SpoolStream::seekp(camoto::stream::delta off,
+	camoto::stream::seek_from from)
+{
+	this->seekg(off, from);
+	return;
+}
+
+camoto::stream::pos SpoolStream::tellp() const
+{
+	return this->offset;
+}
+
+void SpoolStream::truncate(camoto::stream::len size)
+{
+	throw camoto::stream::write_error("Streamed data is read-only");
+}
+
+void SpoolStream::flush()
+{
+	return;
+}
+
+bool SpoolStream::isComplete() const
+{
+	return this->complete;
+}
+
+std::string SpoolStream::getError() const
+{
+	if (!this->complete) return std::string();
+	return this->error;
+}
+
+int SpoolStream::getFd() const
+{
+	return this->spoolFd;
+}
+
+void SpoolStream::want(camoto::stream::pos end)
+{
+	if (!this->ahead) return;
+	std::lock_guard<std::mutex> l(this->lock);
+	if (end > this->wanted) {
+		this->wanted = end;
+		this->more.notify_one();
+	}
+	return;
+}
+
+void SpoolStream::run()
+{
+	uint8_t buffer[SPOOL_CHUNK];
+	struct pollfd p;
+	p.fd = this->fd;
+	p.events = POLLIN;
+	while (!this->stop) {
+		if (this->ahead) {
+			// Don't read an endless source any further than needed
+			std::unique_lock<std::mutex> l(this->lock);
+			while (!this->stop && (this->received >= this->wanted + this->ahead)) {
+				this->more.wait(l);
+			}
+			if (this->stop) break;
+		}
+
+		// Wait with a timeout so we notice when we're asked to stop, even if the
+		// writer at the other end of the pipe has gone quiet.
+		int ready = poll(&p, 1, SPOOL_POLL);
+		if (ready == 0) continue;
+		if ((ready < 0) && (errno == EINTR)) continue;
+
+		ssize_t len = (ready < 0) ? -1 : ::read(this->fd, buffer, sizeof(buffer));
+		if (len < 0) {
+			if ((errno == EINTR) || (errno == EAGAIN)) continue;
+			this->error = strerror(errno);
+			break;
+		}
+		if (len == 0) break; // EOF
+
+		camoto::stream::len pos = this->received;
+		ssize_t done = 0;
+		while (done < len) {
+			ssize_t w = pwrite(this->spoolFd, buffer + done, len - done, pos + done);
+			if (w < 0) {
+				if (errno == EINTR) continue;
+				break;
+			}
+			done += w;
+		}
+		if (done < len) {
+			this->error = std::string("Unable to write to temporary file: ")
+				+ strerror(errno);
+			break;
+		}
+		// Only make the data visible once it's in the file
+		this->received = pos + len;
+	}
+	this->complete = true;
+	return;
+}
@@ -0,0 +1,129 @@
+/**
+ * @file   SpoolStream.hpp
+ * @brief  Seekable stream of data arriving through a pipe.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SPOOLSTREAM_HPP_
+#define SPOOLSTREAM_HPP_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <camoto/stream.hpp>
+
+/// How far to read ahead of the viewer for sources that may never end.
+#define SPOOL_DEVICE_AHEAD (4 << 20)
+
+/// Read-only stream of data from a pipe, which can be viewed as it arrives.
+/**
+ * Pipes can't be seeked and their size isn't known until they are closed.
+ * The same goes for character devices and files in /proc.  A background
+ * thread copies the data into an unlinked temporary file as it arrives, and
+ * reads come from there.  size() returns the amount of data received so far,
+ * so it grows until isComplete() returns true.
+ *
+ * Some sources (e.g. /dev/urandom) never end, so reading can be limited to a
+ * certain distance past the furthest point that has been read from this
+ * stream.
+ */
+class SpoolStream: virtual public camoto::stream::inout
+{
+	public:
+		/// Start spooling data from a file descriptor.
+		/**
+		 * @param fd
+		 *   File descriptor to read until EOF.  It is closed by the destructor.
+		 *
+		 * @param ahead
+		 *   Stop reading once this many bytes past the furthest read have been
+		 *   received, until more is read.  0 reads until EOF regardless.
+		 *
+		 * @throw camoto::stream::open_error if the temporary file could not be
+		 *   created.
+		 */
+		SpoolStream(int fd, camoto::stream::len ahead = 0);
+
+		/// Stop reading and discard the temporary file.
+		virtual ~SpoolStream();
+
+		virtual camoto::stream::len try_read(uint8_t *buffer,
+			camoto::stream::len len);
+		virtual void seekg(camoto::stream::delta off,
+			camoto::stream::seek_from from);
+		virtual camoto::stream::pos tellg() const;
+
+		/// Get the amount of data received so far.
+		virtual camoto::stream::len size() const;
+
+		/// @throw camoto::stream::write_error always, as the data is read-only.
+		virtual camoto::stream::len try_write(const uint8_t *buffer,
+			camoto::stream::len len);
+		virtual void seekp(camoto::stream::delta off,
+			camoto::stream::seek_from from);
+		virtual camoto::stream::pos tellp() const;
+		/// @throw camoto::stream::write_error always, as the data is read-only.
+		virtual void truncate(camoto::stream::len size);
+		virtual void flush();
+
+		/// Has all the data been received?
+		bool isComplete() const;
+
+		/// Get the reason reading stopped early, or an empty string if it didn't.
+		std::string getError() const;
+
+		/// Get a file descriptor for the temporary file holding the data.
+		/**
+		 * Only the first size() bytes are valid.  Use pread() as other threads
+		 * may be reading from it too.
+		 */
+		int getFd() const;
+
+		/// Note that data up to the given offset is wanted.
+		/**
+		 * Sources that never end are only read this far ahead, so this must be
+		 * called before waiting for size() to grow.  Reads do it themselves.
+		 */
+		void want(camoto::stream::pos end);
+
+	protected:
+		/// Background thread copying from the pipe to the temporary file.
+		void run();
+
+		int fd;                        ///< Pipe being read
+		FILE *spool;                   ///< Temporary file holding data so far
+		int spoolFd;                   ///< File descriptor of spool
+		camoto::stream::pos offset;    ///< Current read position
+		camoto::stream::len ahead;     ///< Read-ahead limit, or 0 for none
+
+		std::atomic<camoto::stream::len> received; ///< Bytes in spool so far
+		std::atomic<bool> complete;    ///< true once EOF has been reached
+		std::atomic<bool> stop;        ///< true when the thread should exit
+		std::string error;             ///< Why reading stopped, set before complete
+
+		std::mutex lock;               ///< Protects wanted
+		std::condition_variable more;  ///< Signalled when wanted increases
+		camoto::stream::pos wanted;    ///< Furthest offset read so far
+
+		std::thread reader;            ///< Thread running run()
+};
+
+#endif // SPOOLSTREAM_HPP_
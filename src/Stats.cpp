@@ -0,0 +1,150 @@
+/**
+ * @file   Stats.cpp
+ * @brief  Counters for working out why a file is slow to view.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iomanip>
+#include <ostream>
+#include <config.h>
+#include "Stats.hpp"
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#endif
+
+Stats stats;
+
+thread_local Stats::Timer *Stats::Timer::current = NULL;
+
+/// Fire the perf probe for the start or end of a phase.
+/**
+ * Each phase has its own pair of probes, e.g. sdt_ll:decode_begin and
+ * sdt_ll:decode_end, so one can be picked out without a filter.  They are
+ * single no-op instructions until perf attaches to them.
+ */
+static inline void probe(Stats::Phase phase, bool begin)
+{
+#ifdef HAVE_SYS_SDT_H
+#define PHASE_PROBE(p, name) \
+	case Stats::p: \
+		if (begin) { DTRACE_PROBE(ll, name##_begin); } \
+		else { DTRACE_PROBE(ll, name##_end); } \
+		break
+	switch (phase) {
+		PHASE_PROBE(Phase_Index, index);
+		PHASE_PROBE(Phase_Decode, decode);
+		PHASE_PROBE(Phase_Format, format);
+		PHASE_PROBE(Phase_Output, output);
+		PHASE_PROBE(Phase_IOWait, iowait);
+		default: break;
+	}
+#undef PHASE_PROBE
+#endif
+	return;
+}
+
+/// Nanoseconds between two times.
+static inline unsigned long nanos(std::chrono::steady_clock::time_point from,
+	std::chrono::steady_clock::time_point to)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count();
+}
+
+Stats::Timer::Timer(Phase phase, bool active)
+	:	phase(phase),
+		active(active),
+		timed(active && ::stats.timing),
+		outer(NULL)
+{
+	if (!this->active) return;
+	probe(phase, true);
+	if (!this->timed) return;
+
+	this->start = std::chrono::steady_clock::now();
+	this->outer = current;
+	if (this->outer) {
+		// Stop the clock on the phase this one is part of, until this one ends
+		::stats.phaseNanos[this->outer->phase] += nanos(this->outer->start,
+			this->start);
+	}
+	current = this;
+	::stats.phaseCalls[phase]++;
+}
+
+Stats::Timer::~Timer()
+{
+	this->stop();
+}
+
+void Stats::Timer::stop()
+{
+	if (!this->active) return;
+	this->active = false;
+	if (this->timed) {
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		::stats.phaseNanos[this->phase] += nanos(this->start, now);
+		current = this->outer;
+		if (this->outer) this->outer->start = now;
+	}
+	probe(this->phase, false);
+	return;
+}
+
+Stats::Frame Stats::snapshot() const
+{
+	Frame f = {};
+	f.bytesRead = this->bytesRead;
+	f.bitstreamReads = this->bitstreamReads;
+	f.consoleCalls = this->consoleCalls;
+	f.cellsChanged = this->cellsChanged;
+	return f;
+}
+
+void Stats::startTiming()
+{
+	this->timingStart = std::chrono::steady_clock::now();
+	this->timing = true;
+	return;
+}
+
+void Stats::printReport(std::ostream& out) const
+{
+	static const char *names[Phase_Count] = {
+		"indexing",
+		"decoding",
+		"formatting",
+		"console output",
+		"I/O waits",
+	};
+	unsigned long run = nanos(this->timingStart, std::chrono::steady_clock::now());
+
+	out << std::fixed << std::setprecision(3)
+		<< "Time spent, in all threads:    ms      calls\n";
+	for (int p = 0; p < Phase_Count; p++) {
+		out << "  " << std::left << std::setw(16) << names[p] << std::right
+			<< std::setw(14) << this->phaseNanos[p] / 1e6
+			<< std::setw(11) << this->phaseCalls[p] << "\n";
+	}
+	out << "  " << std::left << std::setw(16) << "run time" << std::right
+		<< std::setw(14) << run / 1e6 << "\n"
+		<< "Bytes read: " << this->bytesRead
+		<< "\nCells read one at a time: " << this->bitstreamReads
+		<< "\nCells changed on screen: " << this->cellsChanged
+		<< std::endl;
+	return;
+}
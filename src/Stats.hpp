@@ -0,0 +1,123 @@
+/**
+ * @file   Stats.hpp
+ * @brief  Counters for working out why a file is slow to view.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STATS_HPP_
+#define STATS_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <iosfwd>
+
+/// Running totals kept while the program runs, shown with Ctrl+T.
+/**
+ * These are always counted, so they have to be cheap: each is a single
+ * atomic add, made once per call or once per loop rather than per byte.
+ * Reads can happen in the prefetch and background search threads as well as
+ * the main one.
+ *
+ * The time spent in each phase is only kept when asked for with --stats, as
+ * reading the clock costs more than the counters do.
+ */
+struct Stats
+{
+	/// Parts of the work that time is kept for.
+	enum Phase {
+		Phase_Index,  ///< Finding line starts, holes and repeated rows
+		Phase_Decode, ///< Reading cells out of the data
+		Phase_Format, ///< Turning cells into text on the screen grid
+		Phase_Output, ///< Sending the changes to the display
+		Phase_IOWait, ///< Waiting for data to come in from the file
+		Phase_Count   ///< Number of entries in Phase
+	};
+
+	/// Adds the time until it goes out of scope to one phase.
+	/**
+	 * Phases can be nested, and time spent in an inner one is not counted
+	 * against the outer one as well, so the totals never overlap.  Each
+	 * thread has its own nesting.
+	 *
+	 * The perf probes at the start and end of each phase fire whether or not
+	 * the time is being kept.
+	 */
+	class Timer
+	{
+		public:
+			/// Start timing.
+			/**
+			 * @param phase
+			 *   Phase to add the time to.
+			 *
+			 * @param active
+			 *   false to do nothing, for phases that only sometimes apply.
+			 */
+			Timer(Phase phase, bool active = true);
+			~Timer();
+
+			/// Stop timing before going out of scope.
+			void stop();
+
+		protected:
+			Phase phase;             ///< Phase being timed
+			bool active;             ///< false if doing nothing, or already stopped
+			bool timed;              ///< true if the time is being kept
+			Timer *outer;            ///< Phase this one interrupted, or NULL
+			std::chrono::steady_clock::time_point start; ///< When last started or resumed
+
+			/// Innermost timer running in this thread.
+			static thread_local Timer *current;
+	};
+
+	/// Totals at one point in time, or the difference between two points.
+	struct Frame
+	{
+		unsigned long micros;         ///< Time from the first key to the end of drawing
+		unsigned long drawMicros;     ///< Part of micros spent drawing
+		unsigned long bytesRead;      ///< Bytes read from the data
+		unsigned long bitstreamReads; ///< Cells read one at a time through camoto::bitstream
+		unsigned long consoleCalls;   ///< Drawing functions called on the console
+		unsigned long cellsChanged;   ///< Cells that were different when drawn
+	};
+
+	std::atomic<unsigned long> bytesRead;
+	std::atomic<unsigned long> bitstreamReads;
+	std::atomic<unsigned long> consoleCalls;
+	std::atomic<unsigned long> cellsChanged;
+
+	std::atomic<unsigned long> phaseNanos[Phase_Count]; ///< Time spent in each phase
+	std::atomic<unsigned long> phaseCalls[Phase_Count]; ///< Times each phase was entered
+	bool timing;                  ///< Keep phaseNanos and phaseCalls?
+	std::chrono::steady_clock::time_point timingStart; ///< When timing began
+
+	/// The last key or keys handled, and drawing the result.  Main thread only.
+	Frame lastFrame;
+
+	/// Get the current totals, with the times left as zero.
+	Frame snapshot() const;
+
+	/// Start keeping the time spent in each phase, for --stats.
+	void startTiming();
+
+	/// Write out the time spent in each phase and the totals.
+	void printReport(std::ostream& out) const;
+};
+
+extern Stats stats;
+
+#endif // STATS_HPP_
@@ -22,11 +22,18 @@
 #include "TextView.hpp"
 #include "HexView.hpp"
 #include "HelpView.hpp"
+#include "LZWView.hpp"
+#include "BitmapView.hpp"
+#include "BulkReader.hpp"
+#include "Stats.hpp"
 #include "cfg.hpp"
 
 /// Maximum number of lines to reach when pressing the 'end' key.  If the file
 /// has more lines than this, this is as far as the 'end' key will go.
-#define MAX_LINE  (1 << 25)   // ~32 million lines (128MB memory use)
+#define MAX_LINE  (1 << 25)   // ~32 million lines (256MB memory use)
+
+/// Finding more than this many lines at once uses BulkReader.
+#define BULK_LINES 1000
 
 #define min(x, y) (((x) < (y)) ? (x) : (y))
 #define max(x, y) (((x) > (y)) ? (x) : (y))
@@ -63,7 +70,7 @@ TextView::TextView(const FileView& parent)
 				this->line = numLines - 1;
 				break;
 			}
-			int bitOffset = this->iOffset * 8;
+			camoto::stream::pos bitOffset = this->iOffset * 8;
 			if (this->linePos.back() > bitOffset) {
 				this->line = this->linePos.size() - 1;
 				if (this->line > 0) this->line--;
@@ -117,7 +124,24 @@ bool TextView::processKey(Key c)
 			::cfg.view = View_Hex;
 			break;
 		}
+		case ALT('l'): {
+			IViewPtr newView(new LZWView(*this));
+			this->pConsole->pushView(newView);
+			break;
+		}
+		case ALT('b'): {
+			int fbWidth, fbHeight, fbStride;
+			if (!this->pConsole->getFramebuffer(&fbWidth, &fbHeight, &fbStride)) {
+				this->statusAlert("This display cannot show images");
+				break;
+			}
+			this->file.flush();
+			IViewPtr newView(new BitmapView(*this));
+			this->pConsole->pushView(newView);
+			break;
+		}
 		case CTRL('L'): this->redrawScreen(); break;
+		case CTRL('T'): this->toggleStats(); break;
 		case Key_Up: this->scrollLines(-1); break;
 		case Key_Down: this->scrollLines(1); break;
 		case Key_Home:
@@ -131,7 +155,10 @@ bool TextView::processKey(Key c)
 			}
 			break;
 		case Key_End: {
+			// Finding the lines reads through the file from start to end
+			if (this->map) this->map->advise(MmapStream::Sequential);
 			this->cacheLines(MAX_LINE, iWidth);
+			if (this->map) this->map->advise(MmapStream::Random);
 			int target = this->linePos.size() - iHeight;
 			if ((this->line + iHeight > target) && (this->line - iHeight < target)) {
 				// Relative scroll
@@ -151,6 +178,7 @@ bool TextView::processKey(Key c)
 		default: break;
 	}
 
+	this->updateStats();
 	this->pConsole->update();
 	return true; // true == keep going (don't quit)
 }
@@ -181,6 +209,23 @@ void TextView::generateHeader(std::ostringstream& ss)
 	return;
 }
 
+unsigned long TextView::getIndexMemory() const
+{
+	return this->FileView::getIndexMemory()
+		+ this->linePos.capacity() * sizeof(this->linePos[0]);
+}
+
+void TextView::idle()
+{
+	// If more data has arrived, the last line may continue or there may be new
+	// lines after it.
+	if (this->spool && (this->data->size() != this->iFileSize)) {
+		this->cacheComplete = false;
+	}
+	this->FileView::idle();
+	return;
+}
+
 void TextView::setBitWidth(int newWidth)
 {
 	// Clear all the line markings so they are re-read
@@ -235,6 +280,7 @@ void TextView::scrollLines(int iDelta)
 		}
 	}
 
+	camoto::stream::pos oldPos = this->linePos[this->line];
 	this->line += iDelta;
 
 	// If we are past EOF, display a notice to the user.
@@ -263,6 +309,14 @@ void TextView::scrollLines(int iDelta)
 		}
 	}
 
+	// Let the read-ahead know where we're heading.  Line positions are in bits.
+	camoto::stream::pos newPos = this->linePos[this->line];
+	unsigned long bottom = min((unsigned long)(this->line + iHeight),
+		(unsigned long)this->linePos.size() - 1);
+	this->scrolled(newPos >> 3,
+		((camoto::stream::delta)newPos - (camoto::stream::delta)oldPos) / 8,
+		(this->linePos[bottom] - newPos) >> 3);
+
 	this->updateHeader();
 
 	return;
@@ -270,6 +324,7 @@ void TextView::scrollLines(int iDelta)
 
 void TextView::redrawLines(int iTop, int iBottom, int width)
 {
+	Stats::Timer timer(Stats::Phase_Format);
 	if (width > this->iLineAlloc) {
 		// Enlarge the buffer
 		delete[] this->pLineBuffer;
@@ -286,7 +341,7 @@ void TextView::redrawLines(int iTop, int iBottom, int width)
 	if (this->line + y < cachedLines) {
 		// There is content to draw (as opposed to drawing past EOF, e.g. when
 		// drawing 'new' lines at the bottom of the screen when scrolling.)
-		int lastOffset = this->linePos[this->line + y];//iCurOffset * this->bitWidth + this->intraByteOffset;
+		camoto::stream::pos lastOffset = this->linePos[this->line + y];//iCurOffset * this->bitWidth + this->intraByteOffset;
 		file.seek(lastOffset, camoto::stream::start);
 		bool eof = false;
 
@@ -297,6 +352,7 @@ void TextView::redrawLines(int iTop, int iBottom, int width)
 
 			int prev = -1;
 			int x;
+			Stats::Timer decode(Stats::Phase_Decode);
 			for (x = 0; (x < width) && !eof; x++) {
 				unsigned int c;
 				if (!file.read(this->bitWidth, &c)) {
@@ -335,6 +391,7 @@ void TextView::redrawLines(int iTop, int iBottom, int width)
 				}
 				prev = c;
 			}
+			decode.stop();
 
 			this->pLineBuffer[x] = 0; // force EOL
 
@@ -353,6 +410,7 @@ void TextView::redrawLines(int iTop, int iBottom, int width)
 			this->pConsole->putstr((char *)this->pLineBuffer);
 			if (x < width) this->pConsole->eraseToEOL();
 		}
+		::stats.bitstreamReads += off;
 	}
 
 	// Blank out any leftover lines
@@ -366,6 +424,7 @@ void TextView::redrawLines(int iTop, int iBottom, int width)
 
 void TextView::cacheLines(int maxLine, int width)
 {
+	Stats::Timer timer(Stats::Phase_Index);
 	int cachedLines = this->linePos.size();
 	if (cachedLines == 0) {
 		// First line or bit seek changed
@@ -373,9 +432,17 @@ void TextView::cacheLines(int maxLine, int width)
 		cachedLines++;
 	}
 
+	if ((maxLine - cachedLines >= BULK_LINES) && (this->bitWidth == 8)
+		&& (this->intraByteOffset == 0)
+	) {
+		// Lots of plain bytes to get through, so do it the fast way
+		this->cacheLinesBulk(maxLine, width);
+		return;
+	}
+
 	if (maxLine >= cachedLines) {
 		// Need to read more data to get to this line
-		int lastOffset = this->linePos.back();
+		camoto::stream::pos lastOffset = this->linePos.back();
 		file.seek(lastOffset, camoto::stream::start);
 
 		int off = 0;
@@ -398,8 +465,40 @@ void TextView::cacheLines(int maxLine, int width)
 			}
 			if (!eof) this->linePos.push_back(lastOffset + off * this->bitWidth);
 		}
+		::stats.bitstreamReads += off;
 
 		assert((this->linePos.size() == maxLine + 1) || eof);
 	}
 	return;
 }
+
+void TextView::cacheLinesBulk(int maxLine, int width)
+{
+	// This must split lines exactly the same way as cacheLines() does
+	camoto::stream::pos start = this->linePos.back() / 8;
+	int x = 0;
+	int prev = -1;
+	bool full = false;
+	BulkReader reader(this->data, this->holes);
+	reader.scan(start, this->data->size(),
+		[&](camoto::stream::pos offset, const uint8_t *buf, camoto::stream::len len) {
+			for (camoto::stream::len i = 0; i < len; i++) {
+				uint8_t c = buf[i];
+				x++;
+				bool lineEnd = ((c == '\n') && (prev != 0)) || (x == width);
+				prev = c;
+				if (lineEnd) {
+					this->linePos.push_back((offset + i + 1) * 8);
+					x = 0;
+					if ((int)this->linePos.size() > maxLine) {
+						full = true;
+						return false;
+					}
+				}
+			}
+			return true;
+		}
+	);
+	if (!full) this->cacheComplete = true; // cached all lines in file now
+	return;
+}
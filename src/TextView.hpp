@@ -34,7 +34,7 @@ class TextView: public FileView
 		int iLineAlloc;           ///< Size of pLineBuffer in bytes (may be > iLineWidth)
 
 		int line;                 ///< Current line at top of screen, 0 == first line
-		std::vector<int> linePos; ///< List of offsets where each line begins
+		std::vector<camoto::stream::pos> linePos; ///< Bit offset where each line begins
 		bool cacheComplete;       ///< True if linePos covers the entire file
 
 	public:
@@ -64,8 +64,10 @@ class TextView: public FileView
 
 		void redrawScreen();
 		void generateHeader(std::ostringstream& ss);
+		unsigned long getIndexMemory() const;
 
 		bool processKey(Key c);
+		void idle();
 
 		void setBitWidth(int newWidth);
 		void setIntraByteOffset(int delta);
@@ -119,6 +121,13 @@ class TextView: public FileView
 		 *   Width of output console (for wrapping long lines)
 		 */
 		void cacheLines(int maxLine, int width);
+
+		/// Faster version of cacheLines() for eight-bit cells on byte boundaries.
+		/**
+		 * This reads the data in large chunks with BulkReader instead of one cell
+		 * at a time through the bitstream.
+		 */
+		void cacheLinesBulk(int maxLine, int width);
 };
 
 #endif // TEXTVIEW_HPP_
@@ -0,0 +1,426 @@
+/**
+ * @file   VTConsole.cpp
+ * @brief  IConsole implementation writing escape codes straight to a terminal.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <algorithm>
+#include <iostream>
+
+// termios.h has its own version, which IView.hpp replaces
+#undef CTRL
+
+#include "cfg.hpp"
+#include "cp437.hpp"
+#include "Stats.hpp"
+#include "VTConsole.hpp"
+
+/// Unchanged cells to rewrite rather than moving the cursor over them.
+#define VT_MAX_GAP 4
+
+/// How long to wait for the rest of an escape sequence, in milliseconds.
+#define VT_ESC_TIMEOUT 25
+
+/// ANSI colour number for each CGA colour.
+static const int ansiColours[] = {0, 4, 2, 6, 1, 5, 3, 7};
+
+/// Set by the SIGWINCH handler when the terminal changes size.
+static volatile sig_atomic_t resized = 0;
+
+/// Record that the terminal has been resized.
+static void sigwinch(int sig)
+{
+	resized = 1;
+}
+
+VTConsole::VTConsole(int fd)
+	:	fd(fd),
+		saved(new struct termios),
+		termX(-1),
+		termY(-1),
+		termAttr(-1),
+		termCursorVisible(true),
+		keys(0),
+		bytesTotal(0),
+		bytesMax(0),
+		bytesKey(0)
+{
+	// Encode each character as UTF-8 once
+	for (int i = 0; i < 256; i++) {
+		this->glyphLen[i] = cp437_utf8(i, this->glyphs[i]);
+	}
+
+	struct sigaction sa;
+	sa.sa_handler = sigwinch;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0; // interrupt select() so the resize is seen straight away
+	sigaction(SIGWINCH, &sa, NULL);
+
+	tcgetattr(this->fd, this->saved);
+	struct termios raw = *this->saved;
+	cfmakeraw(&raw);
+	tcsetattr(this->fd, TCSAFLUSH, &raw);
+
+	// Alternate screen, no line wrap, no cursor
+	this->output += "\x1B[?1049h\x1B[?7l\x1B[?25l";
+	this->termCursorVisible = false;
+
+	this->setColoursFromConfig();
+	this->getSize();
+}
+
+VTConsole::~VTConsole()
+{
+	this->output += "\x1B[0m\x1B[?25h\x1B[?7h\x1B[?1049l";
+	this->flushOutput();
+	tcsetattr(this->fd, TCSAFLUSH, this->saved);
+	close(this->fd);
+	delete this->saved;
+
+	struct sigaction sa;
+	sa.sa_handler = SIG_DFL;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+	sigaction(SIGWINCH, &sa, NULL);
+
+	// Only when asked, alongside the rest of the --stats report
+	if (this->keys && ::stats.timing) {
+		std::cerr << "Terminal output: " << this->bytesTotal << " bytes for "
+			<< this->keys << " keys, " << this->bytesTotal / this->keys
+			<< " on average and " << this->bytesMax << " at most" << std::endl;
+	}
+}
+
+void VTConsole::mainLoop()
+{
+	for (;;) {
+		if (resized) {
+			resized = 0;
+			this->getSize();
+			this->view->init();
+			this->view->redrawScreen();
+			this->update();
+		}
+
+		Key c;
+		if (!this->readKey(&c)) {
+			// No key pressed within IDLE_INTERVAL
+			this->flushUpdate();
+			if (!resized) this->idle();
+			continue;
+		}
+		this->bytesKey = 0;
+		// Only draw the screen once every key typed ahead has been handled
+		bool more = !this->input.empty() || this->waitInput(0);
+		bool running = this->processQueuedKey(c, more);
+
+		// Count what was sent to the screen because of this key
+		this->keys++;
+		this->bytesTotal += this->bytesKey;
+		if (this->bytesKey > this->bytesMax) this->bytesMax = this->bytesKey;
+		this->bytesKey = 0;
+
+		if (!running) break;
+	}
+	return;
+}
+
+void VTConsole::drawChanges()
+{
+	this->applyScroll();
+
+	Cell *back = &this->cells[0];
+	Cell *front = &this->front[0];
+	for (int y = 0; y < this->screenHeight; y++) {
+		// Only cells that have changed can differ from the terminal
+		int x, end;
+		if (!this->dirtyExtent(y, &x, &end)) continue;
+		int row = y * this->screenWidth;
+		while (x < end) {
+			if (back[row + x] == front[row + x]) {
+				x++;
+				continue;
+			}
+
+			// Find the end of the changes, including short gaps that are cheaper
+			// to write out again than to move the cursor past.
+			int last = x;
+			for (int i = x + 1; (i < end) && (i - last <= VT_MAX_GAP); i++) {
+				if (back[row + i] != front[row + i]) last = i;
+			}
+
+			this->moveTo(x, y);
+			for (; x <= last; x++) {
+				const Cell& c = back[row + x];
+				this->setAttr(c.attr);
+				this->output.append(this->glyphs[c.ch], this->glyphLen[c.ch]);
+				front[row + x] = c;
+			}
+			this->termX = x;
+			// Terminals differ on where the cursor is after the last column
+			if (this->termX >= this->screenWidth) this->termX = -1;
+		}
+	}
+	this->clearAllDirty();
+
+	if (this->cursorVisible) {
+		this->moveTo(
+			this->cursorX < this->screenWidth ? this->cursorX : this->screenWidth - 1,
+			this->cursorY);
+		if (!this->termCursorVisible) {
+			this->output += "\x1B[?25h";
+			this->termCursorVisible = true;
+		}
+	} else if (this->termCursorVisible) {
+		this->output += "\x1B[?25l";
+		this->termCursorVisible = false;
+	}
+
+	this->flushOutput();
+	return;
+}
+
+void VTConsole::applyScroll()
+{
+	int iY = this->takeScroll();
+	if (iY == 0) return;
+	int contentHeight = this->screenHeight - 2;
+	int rows = contentHeight - abs(iY);
+	int from = (iY < 0) ? 1 : 1 + iY;
+	int to = (iY < 0) ? 1 - iY : 1;
+	int sw = this->screenWidth;
+	int newRow = (iY < 0) ? 1 : 1 + rows;
+
+	// Move the terminal's copy the same way, so those cells still differ
+	std::copy(this->front.begin() + from * sw, this->front.begin() + (from + rows) * sw,
+		this->front.begin() + to * sw);
+	// Not all terminals fill new lines with the current background colour
+	Cell unknown = {0, VT_UNKNOWN};
+	std::fill(this->front.begin() + newRow * sw,
+		this->front.begin() + (newRow + abs(iY)) * sw, unknown);
+
+	// Have the terminal scroll the lines between the status bars
+	char buf[32];
+	snprintf(buf, sizeof(buf), "\x1B[2;%dr", this->screenHeight - 1);
+	this->output += buf;
+	this->setAttr(ATTR_CONTENT);
+	if (iY > 0) {
+		// Line feeds at the bottom of the region push the text up
+		this->termX = this->termY = -1; // setting the region homes the cursor
+		this->moveTo(0, contentHeight);
+		this->output.append(iY, '\n');
+	} else {
+		// Reverse line feeds at the top push it down
+		this->termX = this->termY = -1;
+		this->moveTo(0, 1);
+		for (int i = 0; i < -iY; i++) this->output += "\x1BM";
+	}
+	this->output += "\x1B[r";
+	this->termX = 0;
+	this->termY = 0;
+	return;
+}
+
+void VTConsole::setColoursFromConfig()
+{
+	const CGAColour *clr[ATTR_COUNT] = {&::cfg.clrContent, &::cfg.clrStatusBar,
+		&::cfg.clrHighlight};
+	for (int i = 0; i < ATTR_COUNT; i++) {
+		int fg = clr[i]->iFG & 15, bg = clr[i]->iBG & 15;
+		char buf[32];
+		snprintf(buf, sizeof(buf), "\x1B[0;%d;%dm",
+			(fg < 8 ? 30 : 90) + ansiColours[fg & 7],
+			(bg < 8 ? 40 : 100) + ansiColours[bg & 7]);
+		this->colours[i] = buf;
+	}
+
+	// Everything on the screen is in the old colours
+	Cell unknown = {0, VT_UNKNOWN};
+	std::fill(this->front.begin(), this->front.end(), unknown);
+	this->markAllDirty();
+	this->termAttr = -1;
+	return;
+}
+
+void VTConsole::getSize()
+{
+	struct winsize ws;
+	int width = 80, height = 25;
+	if ((ioctl(this->fd, TIOCGWINSZ, &ws) == 0) && ws.ws_col && ws.ws_row) {
+		width = ws.ws_col;
+		height = ws.ws_row;
+	}
+	if (height < 3) height = 3;
+	this->resizeGrid(width, height);
+
+	Cell unknown = {0, VT_UNKNOWN};
+	this->front.assign(this->screenWidth * this->screenHeight, unknown);
+	this->termX = this->termY = -1;
+	return;
+}
+
+bool VTConsole::readKey(Key *c)
+{
+	if (this->input.empty() && !this->waitInput(IDLE_INTERVAL)) return false;
+
+	uint8_t b = this->input[0];
+	if (b != 27) {
+		this->input.erase(0, 1);
+		switch (b) {
+			case 8:
+			case 127: *c = Key_Backspace; break;
+			case 9:   *c = Key_Tab; break;
+			case 13:  *c = Key_Enter; break;
+			default:  *c = (Key)b; break;
+		}
+		return true;
+	}
+
+	// An escape sequence, or the Esc key by itself
+	if ((this->input.length() < 2) && !this->waitInput(VT_ESC_TIMEOUT)) {
+		this->input.erase(0, 1);
+		*c = Key_Esc;
+		return true;
+	}
+	uint8_t next = this->input[1];
+	if ((next != '[') && (next != 'O')) {
+		this->input.erase(0, 2);
+		if ((next >= 'a') && (next <= 'z')) *c = (Key)(Key_Alt | next);
+		else if (next == 27) *c = Key_Esc;
+		else *c = Key_None;
+		return true;
+	}
+
+	// CSI or SS3, read up to the final character
+	unsigned int end = 2;
+	for (;;) {
+		while (end < this->input.length()) {
+			uint8_t e = this->input[end];
+			if ((e >= 0x40) && (e <= 0x7E)) break;
+			end++;
+		}
+		if (end < this->input.length()) break;
+		if (!this->waitInput(VT_ESC_TIMEOUT)) {
+			// Incomplete sequence, throw it away
+			this->input.clear();
+			*c = Key_None;
+			return true;
+		}
+	}
+	int param = atoi(this->input.c_str() + 2);
+	switch (this->input[end]) {
+		case 'A': *c = Key_Up; break;
+		case 'B': *c = Key_Down; break;
+		case 'C': *c = Key_Right; break;
+		case 'D': *c = Key_Left; break;
+		case 'H': *c = Key_Home; break;
+		case 'F': *c = Key_End; break;
+		case 'P': *c = Key_F1; break;
+		case '~':
+			switch (param) {
+				case 1: case 7:  *c = Key_Home; break;
+				case 3:          *c = Key_Del; break;
+				case 4: case 8:  *c = Key_End; break;
+				case 5:          *c = Key_PageUp; break;
+				case 6:          *c = Key_PageDown; break;
+				case 11:         *c = Key_F1; break;
+				case 21:         *c = Key_F10; break;
+				default:         *c = Key_None; break;
+			}
+			break;
+		default: *c = Key_None; break;
+	}
+	this->input.erase(0, end + 1);
+	return true;
+}
+
+bool VTConsole::waitInput(int ms)
+{
+	fd_set fds;
+	FD_ZERO(&fds);
+	FD_SET(this->fd, &fds);
+	struct timeval tv;
+	tv.tv_sec = ms / 1000;
+	tv.tv_usec = (ms % 1000) * 1000;
+	if (select(this->fd + 1, &fds, NULL, NULL, &tv) <= 0) return false;
+
+	char buf[256];
+	ssize_t len = read(this->fd, buf, sizeof(buf));
+	if (len <= 0) return false;
+	this->input.append(buf, len);
+	return true;
+}
+
+void VTConsole::moveTo(int x, int y)
+{
+	if ((this->termX == x) && (this->termY == y)) return;
+
+	char buf[32];
+	if ((this->termY == y) && (this->termX >= 0)) {
+		if (x == 0) {
+			snprintf(buf, sizeof(buf), "\r");
+		} else if (x > this->termX) {
+			snprintf(buf, sizeof(buf), "\x1B[%dC", x - this->termX);
+		} else {
+			snprintf(buf, sizeof(buf), "\x1B[%dD", this->termX - x);
+		}
+	} else if ((x == 0) && (this->termX >= 0) && (y == this->termY + 1)) {
+		snprintf(buf, sizeof(buf), "\r\n");
+	} else if (x == 0) {
+		snprintf(buf, sizeof(buf), "\x1B[%dH", y + 1);
+	} else {
+		snprintf(buf, sizeof(buf), "\x1B[%d;%dH", y + 1, x + 1);
+	}
+	this->output += buf;
+	this->termX = x;
+	this->termY = y;
+	return;
+}
+
+void VTConsole::setAttr(uint8_t attr)
+{
+	if (this->termAttr == attr) return;
+	this->output += this->colours[attr];
+	this->termAttr = attr;
+	return;
+}
+
+void VTConsole::flushOutput()
+{
+	const char *p = this->output.data();
+	size_t left = this->output.length();
+	while (left) {
+		ssize_t len = write(this->fd, p, left);
+		if (len < 0) {
+			if (errno == EINTR) continue;
+			break; // terminal has gone away
+		}
+		p += len;
+		left -= len;
+	}
+	this->bytesKey += this->output.length() - left;
+	this->output.clear();
+	return;
+}
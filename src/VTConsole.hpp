@@ -0,0 +1,119 @@
+/**
+ * @file   VTConsole.hpp
+ * @brief  IConsole implementation writing escape codes straight to a terminal.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VTCONSOLE_HPP_
+#define VTCONSOLE_HPP_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "BaseConsole.hpp"
+
+struct termios;
+
+/// Attribute of a cell whose content on the terminal is not known.
+#define VT_UNKNOWN   0xFF
+
+/// Console interface to a VT100/ANSI terminal, without curses.
+/**
+ * Alongside the grid the views draw into, a copy is kept of what the terminal
+ * is showing.  Drawing compares the changed cells against it and only sends
+ * those that differ, moving the cursor with whichever escape code is shortest.  Scrolling
+ * the content area uses a scroll region (DECSTBM), so the terminal moves the
+ * existing text itself.
+ *
+ * This is for slow links, where what gets sent matters more than anything
+ * else.  The number of bytes written for each keypress is counted, and
+ * reported when the console closes.
+ */
+class VTConsole: virtual public BaseConsole
+{
+	public:
+		/// Take over a terminal.
+		/**
+		 * @param fd
+		 *   Terminal to use for both input and output.  It will be closed when
+		 *   the console is destroyed.
+		 */
+		VTConsole(int fd);
+		virtual ~VTConsole();
+
+		void mainLoop();
+		void setColoursFromConfig();
+
+	protected:
+		void drawChanges();
+
+		/// Scroll the terminal to match the grid, using a scroll region.
+		void applyScroll();
+
+		/// Get the size of the terminal and resize the buffers to match.
+		void getSize();
+
+		/// Read the next key from the terminal.
+		/**
+		 * @param c
+		 *   On return, the key pressed.
+		 *
+		 * @return true if a key was read, false if none arrived in time.
+		 */
+		bool readKey(Key *c);
+
+		/// Wait for more input to arrive.
+		/**
+		 * @param ms
+		 *   Maximum time to wait, in milliseconds.
+		 *
+		 * @return true if more bytes are now in this->input.
+		 */
+		bool waitInput(int ms);
+
+		/// Queue the escape code to move the terminal's cursor.
+		void moveTo(int x, int y);
+
+		/// Queue the escape code to change colour, if needed.
+		void setAttr(uint8_t attr);
+
+		/// Write out everything queued in this->output.
+		void flushOutput();
+
+		int fd;                     ///< Terminal
+		struct termios *saved;      ///< Terminal settings to restore on exit
+		std::vector<Cell> front;    ///< What the terminal is showing
+
+		int termX;                  ///< Terminal's cursor position, or -1 if unknown
+		int termY;                  ///< Row of termX
+		int termAttr;               ///< Terminal's current colour, or -1 if unknown
+		bool termCursorVisible;     ///< Is the terminal showing its cursor?
+
+		std::string colours[ATTR_COUNT]; ///< Escape codes to select each attribute
+		char glyphs[256][4];        ///< UTF-8 for each code page 437 character
+		uint8_t glyphLen[256];      ///< Number of bytes used in glyphs
+
+		std::string input;          ///< Bytes read but not yet turned into keys
+		std::string output;         ///< Bytes waiting to be written
+
+		unsigned long keys;         ///< Keys processed
+		unsigned long bytesTotal;   ///< Bytes written in response to keys
+		unsigned long bytesMax;     ///< Most bytes written for a single key
+		unsigned long bytesKey;     ///< Bytes written since the last key
+};
+
+#endif // VTCONSOLE_HPP_
@@ -19,7 +19,9 @@
  */
 
 #include <string.h> // strerror()
+#include <stdlib.h> // malloc()
 #include <errno.h>
+#include <sys/select.h>
 #include <cassert>
 #include <iostream> // for errors before we get to nCurses
 
@@ -29,6 +31,9 @@
 #include "XConsole.hpp"
 #include "font.hpp"
 
+#define min(x, y) (((x) < (y)) ? (x) : (y))
+#define max(x, y) (((x) > (y)) ? (x) : (y))
+
 /// EGA palette
 int pal[] = {
 	0x000000,
@@ -49,18 +54,26 @@ int pal[] = {
 	0xFFFFFF,
 };
 
+/// Foreground entry in XConsole::pixels for each attribute, background is next.
+static const int attrPixels[ATTR_COUNT] = {PX_DOC_FG, PX_SB_FG, PX_HL_FG};
+
 XConsole::XConsole(Display *display)
 	:	display(display),
 		fontWidth(8),
 		fontHeight(14),
-		cursorX(0),
-		cursorY(0),
-		cursorVisible(false),
-		text(NULL),
-		screenWidth(80),
-		screenHeight(25)
+		imageVisible(false),
+		textNative(false),
+		drawnCursorX(-1),
+		drawnCursorY(-1)
 {
+	this->viewImage.image = NULL;
+	this->textImage.image = NULL;
+#ifdef HAVE_XSHM
+	this->viewImage.useShm = false;
+	this->textImage.useShm = false;
+#endif
 	int screen = DefaultScreen(this->display);
+	this->resizeGrid(80, 25);
 
 	// Mark colours as not-yet-allocated, then allocate them
 	this->pixels[0] = -1;
@@ -89,42 +102,17 @@ XConsole::XConsole(Display *display)
 
 	this->gc = XCreateGC(this->display, this->win, 0, 0);
 
-	// Swap the bits in the font as X11 wants them mirrored
-	for (int i = 0; i < sizeof(int10_font_14); i++) {
-		int10_font_14[i] =
-			((int10_font_14[i] & 0x80) >> 7) |
-			((int10_font_14[i] & 0x40) >> 5) |
-			((int10_font_14[i] & 0x20) >> 3) |
-			((int10_font_14[i] & 0x10) >> 1) |
-			((int10_font_14[i] & 0x08) << 1) |
-			((int10_font_14[i] & 0x04) << 3) |
-			((int10_font_14[i] & 0x02) << 5) |
-			((int10_font_14[i] & 0x01) << 7)
-		;
-	}
-	this->font = XCreateBitmapFromData(this->display, this->win,
-		(char *)int10_font_14, this->fontWidth, 256 * this->fontHeight
-	);
-
 	XSelectInput(this->display, this->win, KeyPressMask | ExposureMask | StructureNotifyMask);
 
 	XMapRaised(this->display, this->win);
-
-	int screensize = this->screenWidth * this->screenHeight;
-	this->text    = new uint8_t[screensize];
-	this->changed = new uint8_t[screensize];
-	memset(this->text,    0, screensize);
-	memset(this->changed, 0, screensize);
 }
 
 XConsole::~XConsole()
 {
-	delete[] this->changed;
-	delete[] this->text;
-
+	this->destroyImage(&this->viewImage);
+	this->destroyImage(&this->textImage);
 	XDestroyWindow(this->display, this->win);
 	XFreeGC(this->display, this->gc);
-	XFreePixmap(this->display, this->font);
 
 	int screen = DefaultScreen(this->display);
 	Colormap cmap = XDefaultColormap(this->display, screen);
@@ -136,7 +124,22 @@ void XConsole::mainLoop()
 	XEvent ev;
 	int newWidth = 0, newHeight = 0;
 	bool running = true, redraw = false;
-	while (running && (XNextEvent(this->display, &ev) >= 0)) {
+	while (running) {
+		if (!XPending(this->display)) {
+			// Wait for an event, letting the view do some work if none arrives
+			int xfd = ConnectionNumber(this->display);
+			fd_set fds;
+			FD_ZERO(&fds);
+			FD_SET(xfd, &fds);
+			struct timeval tv;
+			tv.tv_sec = 0;
+			tv.tv_usec = IDLE_INTERVAL * 1000;
+			if (select(xfd + 1, &fds, NULL, NULL, &tv) == 0) {
+				this->idle();
+				continue;
+			}
+		}
+		if (XNextEvent(this->display, &ev) < 0) break;
 		switch (ev.type) {
 			case Expose:
 				if (!(newWidth || newHeight)) {
@@ -147,6 +150,25 @@ void XConsole::mainLoop()
 						(ev.xexpose.y + ev.xexpose.height + this->fontHeight - 1) / this->fontHeight,
 						false // draw all cells, even unchanged ones
 					);
+					if (this->imageVisible) {
+						this->putImage(&this->viewImage,
+							ev.xexpose.x, ev.xexpose.y - this->fontHeight,
+							ev.xexpose.width, ev.xexpose.height, this->fontHeight
+						);
+						this->waitForImages();
+					}
+				}
+				break;
+			case GraphicsExpose:
+				// Part of a scroll that was covered by another window
+				if (!(newWidth || newHeight)) {
+					this->redrawCells(
+						ev.xgraphicsexpose.x / this->fontWidth,
+						ev.xgraphicsexpose.y / this->fontHeight,
+						(ev.xgraphicsexpose.x + ev.xgraphicsexpose.width + this->fontWidth - 1) / this->fontWidth,
+						(ev.xgraphicsexpose.y + ev.xgraphicsexpose.height + this->fontHeight - 1) / this->fontHeight,
+						false // draw all cells, even unchanged ones
+					);
 				}
 				break;
 			case KeymapNotify:
@@ -187,7 +209,9 @@ void XConsole::mainLoop()
 						break;
 				}
 				if (ev.xkey.state & Mod1Mask) c = (Key)(c | Key_Alt);
-				running = this->processKey(c);
+
+				// Only draw the screen once every key waiting has been handled
+				running = this->processQueuedKey(c, XPending(this->display) > 0);
 				break;
 			}
 			case ConfigureNotify: {
@@ -208,18 +232,9 @@ void XConsole::mainLoop()
 
 		if (!XPending(this->display)) {
 			// No more events waiting, do the time consuming things
+			this->flushUpdate();
 			if (newWidth || newHeight) {
-				int screensize = newWidth * newHeight;
-				if (screensize > this->screenWidth * this->screenHeight) {
-					delete[] this->text;
-					delete[] this->changed;
-					this->text    = new uint8_t[screensize];
-					this->changed = new uint8_t[screensize];
-				}
-				memset(this->text,    0, screensize);
-				memset(this->changed, 1, screensize);
-				this->screenWidth = newWidth;
-				this->screenHeight = newHeight;
+				this->resizeGrid(newWidth, newHeight);
 				this->view->init();
 				this->view->redrawScreen();
 
@@ -237,123 +252,64 @@ void XConsole::mainLoop()
 	return;
 }
 
-void XConsole::update(void)
+void XConsole::drawChanges()
 {
 	this->redrawCells(0, 0, this->screenWidth, this->screenHeight, true);
 	return;
 }
 
-void XConsole::clearStatusBar(SB_Y eY)
+void XConsole::applyScroll()
 {
-	int offset = (eY == SB_BOTTOM ? this->screenHeight - 1 : 0) * this->screenWidth;
-	memset(this->text    + offset, 0, this->screenWidth);
-	memset(this->changed + offset, 1, this->screenWidth);
-	return;
-}
+	int iY = this->takeScroll();
+	if (iY == 0) return;
 
-void XConsole::setStatusBar(SB_Y eY, SB_X eX, const std::string& strMessage,
-	int cursor)
-{
-	int x;
-	switch (eX) {
-		case SB_CENTRE: x = (this->screenWidth + strMessage.length()) / 2; break;
-		case SB_RIGHT:  x = this->screenWidth - strMessage.length(); break;
-		default: // SB_LEFT
-			x = 0;
-			break;
-	}
-	int y;
-	switch (eY) {
-		case SB_BOTTOM:
-			y = this->screenHeight - 1;
-			break;
-		default: // SB_TOP
-			y = 0;
-			break;
+	// Screen rows, including the top status bar
+	int rows = this->screenHeight - 2 - abs(iY);
+	int from, to;
+	if (iY < 0) {
+		from = 1;
+		to = 1 - iY;
+	} else {
+		from = 1 + iY;
+		to = 1;
 	}
-	if (x < 0) return; // right-justified long text in a short window
-	if ((cursor >= 0) && (cursor <= strMessage.length())) {
-		if (this->cursorVisible) {
-			// Remove the cursor from its current location
-			this->changed[this->cursorY * this->screenWidth + this->cursorX] = 1;
-		}
-		this->cursorX = x + cursor;
-		this->cursorY = y;
-		if (this->cursorVisible) {
-			this->changed[this->cursorY * this->screenWidth + this->cursorX] = 1;
+
+	int sw = this->screenWidth;
+	XImage *image = this->textImage.image;
+	if (
+		this->imageVisible
+		|| (!image)
+		|| (image->width != sw * this->fontWidth)
+		|| (image->height != this->screenHeight * this->fontHeight)
+	) {
+		// The window doesn't show this text, so it will all be drawn later
+		for (int y = to; y < to + rows; y++) this->markDirty(0, y, sw);
+		if ((this->drawnCursorY > 0) && (this->drawnCursorY < this->screenHeight - 1)) {
+			this->drawnCursorX = this->drawnCursorY = -1;
 		}
+		return;
 	}
-	this->writeText(x, y, strMessage);
-	return;
-}
 
-void XConsole::gotoxy(int x, int y)
-{
-	int oldX = this->cursorX, oldY = this->cursorY;
-	this->cursorX = x;
-	this->cursorY = y + 1; // doesn't count status bar
-	if (this->cursorVisible) {
-		this->redrawCells(oldX, oldY, oldX + 1, oldY + 1, false);
-		this->redrawCells(this->cursorX, this->cursorY,
-			this->cursorX + 1, this->cursorY + 1, false);
-	}
-	return;
-}
-
-void XConsole::putstr(const std::string& strContent)
-{
-	int len = this->writeText(this->cursorX, this->cursorY, strContent);
-	this->cursorX += len; // could put this->cursorX == this->screenWidth
-	return;
-}
-
-void XConsole::getContentDims(int *iWidth, int *iHeight)
-{
-	*iWidth = this->screenWidth;
-	*iHeight = this->screenHeight - 2; // doesn't count status bars
-	return;
-}
+	// Move what has already been drawn, both here and on the server.  Parts
+	// of the window that couldn't be copied because they were covered will
+	// arrive as GraphicsExpose events.
+	int line = this->fontHeight * image->bytes_per_line;
+	memmove(image->data + to * line, image->data + from * line, rows * line);
+	XCopyArea(this->display, this->win, this->win, this->gc,
+		0, from * this->fontHeight,
+		sw * this->fontWidth, rows * this->fontHeight,
+		0, to * this->fontHeight
+	);
 
-void XConsole::scrollContent(int iX, int iY)
-{
-	int scrollSize = (this->screenHeight - 2 - abs(iY)) * this->screenWidth;
-	if (iY < 0) {
-		int start = (-iY + 1) * this->screenWidth;
-		memmove(
-			this->text + start,
-			this->text + 1 * this->screenWidth,
-			scrollSize
-		);
-		memset(this->changed + start, 1, scrollSize);
-	} else if (iY > 0) {
-		int start = 1 * this->screenWidth;
-		memmove(
-			this->text + start,
-			this->text + (iY+1) * this->screenWidth,
-			scrollSize
-		);
-		memset(this->changed + start, 1, scrollSize);
+	// The inverted cell moved along with everything else
+	if ((this->drawnCursorY >= from) && (this->drawnCursorY < from + rows)) {
+		this->drawnCursorY += to - from;
+	} else if ((this->drawnCursorY > 0) && (this->drawnCursorY < this->screenHeight - 1)) {
+		this->drawnCursorX = this->drawnCursorY = -1; // scrolled off
 	}
 	return;
 }
 
-void XConsole::eraseToEOL(void)
-{
-	int offset = this->cursorY * this->screenWidth + this->cursorX;
-	int len = this->screenWidth - this->cursorX;
-	memset(this->text    + offset, 0, len);
-	memset(this->changed + offset, 1, len);
-	return;
-}
-
-void XConsole::cursor(bool visible)
-{
-	this->cursorVisible = visible;
-	this->redrawCells(this->cursorX, this->cursorY,
-		this->cursorX + 1, this->cursorY + 1, false);
-	return;
-}
-
 void XConsole::setColoursFromConfig()
 {
 	int screen = DefaultScreen(this->display);
@@ -379,79 +335,363 @@ void XConsole::setColoursFromConfig()
 		XAllocColor(this->display, cmap, &c);
 		this->pixels[i] = c.pixel;
 	}
+
+	// Everything already drawn is in the old colours
+	this->markAllDirty();
 	return;
 }
 
 void XConsole::redrawCells(int startX, int startY, int endX, int endY,
 	bool changedOnly)
 {
-	int fore = -1;
-	for (int y = startY; y < endY; y++) {
-		if ((y == 0) || (y == this->screenHeight - 1)) {
-			if (fore != PX_SB_FG) {
-				XSetBackground(this->display, this->gc, this->pixels[PX_SB_BG]);
-				XSetForeground(this->display, this->gc, this->pixels[PX_SB_FG]);
-				fore = PX_SB_FG;
-			}
+	// Anything past the last whole cell is just background
+	if ((endX > this->screenWidth) || (endY > this->screenHeight)) {
+		XSetForeground(this->display, this->gc, this->pixels[PX_DOC_BG]);
+		if (endX > this->screenWidth) {
+			XFillRectangle(this->display, this->win, this->gc,
+				this->screenWidth * this->fontWidth, startY * this->fontHeight,
+				(endX - this->screenWidth) * this->fontWidth,
+				(endY - startY) * this->fontHeight
+			);
+		}
+		if (endY > this->screenHeight) {
+			XFillRectangle(this->display, this->win, this->gc,
+				startX * this->fontWidth, this->screenHeight * this->fontHeight,
+				(endX - startX) * this->fontWidth,
+				(endY - this->screenHeight) * this->fontHeight
+			);
+		}
+	}
+	// The image has to match the grid before anything more is drawn into it
+	this->applyScroll();
+
+	// Put the cursor back to normal if it has moved, and draw it in its new
+	// place.
+	bool cursorMoved = (this->drawnCursorX != this->cursorX)
+		|| (this->drawnCursorY != this->cursorY);
+	if ((this->drawnCursorX >= 0) && (cursorMoved || !this->cursorVisible)) {
+		this->markDirty(this->drawnCursorX, this->drawnCursorY, 1);
+	}
+	if (this->cursorVisible && cursorMoved) {
+		this->markDirty(this->cursorX, this->cursorY, 1);
+	}
+
+	startX = max(startX, 0);
+	startY = max(startY, 0);
+	endX = min(endX, this->screenWidth);
+	endY = min(endY, this->screenHeight);
+	if ((startX >= endX) || (startY >= endY)) return;
+
+	int width = this->screenWidth * this->fontWidth;
+	int height = this->screenHeight * this->fontHeight;
+	XImage *image = this->textImage.image;
+	if ((!image) || (image->width != width) || (image->height != height)) {
+		this->destroyImage(&this->textImage);
+		if (!this->createImage(&this->textImage, width, height, false)) return;
+		image = this->textImage.image;
+
+		// Pixels can be written directly if they are the same size and byte
+		// order as an int, otherwise XPutPixel() has to be used.
+		uint16_t one = 1;
+		int hostOrder = (*(uint8_t *)&one == 1) ? LSBFirst : MSBFirst;
+		this->textNative = (image->byte_order == hostOrder)
+			&& ((image->bits_per_pixel == 32) || (image->bits_per_pixel == 16));
+
+		// The new image is blank, so everything has to be drawn into it
+		this->markAllDirty();
+		this->drawnCursorX = this->drawnCursorY = -1;
+		changedOnly = false;
+		startX = startY = 0;
+		endX = this->screenWidth;
+		endY = this->screenHeight;
+	}
+
+	// The framebuffer is drawn over the content rows instead, so only the
+	// status bars are drawn while it is visible.
+	int bands[2][2] = {{startY, endY}, {0, 0}};
+	if (this->imageVisible) {
+		bands[0][1] = min(endY, 1);
+		bands[1][0] = max(startY, this->screenHeight - 1);
+		bands[1][1] = endY;
+	}
+	std::vector<Rect> rects;
+	for (int b = 0; b < 2; b++) {
+		if (bands[b][0] >= bands[b][1]) continue;
+		if (changedOnly) {
+			this->getDamage(bands[b][0], bands[b][1], &rects);
 		} else {
-			if (fore != PX_DOC_FG) {
-				XSetBackground(this->display, this->gc, this->pixels[PX_DOC_BG]);
-				XSetForeground(this->display, this->gc, this->pixels[PX_DOC_FG]);
-				fore = PX_DOC_FG;
-			}
+			rects.push_back({startX, bands[b][0], endX - startX,
+				bands[b][1] - bands[b][0]});
 		}
-		bool swapped = false; // did we swap colours to draw the cursor?
-		for (int x = startX; x < endX; x++) {
-			// If for some reason the drawing is out of range, skip it
-			if ((x < this->screenWidth) && (y < this->screenHeight)) {
+	}
+
+	// Each rectangle is sent to the window in one go.  Unchanged cells within
+	// it are still correct in the image from last time.
+	for (std::vector<Rect>::const_iterator r = rects.begin(); r != rects.end(); r++) {
+		int left = max(r->x, startX);
+		int right = min(r->x + r->width, endX);
+		if (left >= right) continue;
+		for (int y = r->y; y < r->y + r->height; y++) {
+			const Cell *row = &this->cells[y * this->screenWidth];
+			int attr = -1;
+			unsigned long fg = 0, bg = 0;
+			for (int x = left; x < right; x++) {
+				if (changedOnly && !this->isDirty(x, y)) continue;
+				if (row[x].attr != attr) {
+					// Start of a new colour run
+					attr = row[x].attr;
+					int fore = attrPixels[attr < ATTR_COUNT ? attr : ATTR_CONTENT];
+					fg = this->pixels[fore];
+					bg = this->pixels[fore+1];
+				}
 				if (this->cursorVisible && (this->cursorX == x) && (this->cursorY == y)) {
-					XSetBackground(this->display, this->gc, this->pixels[fore]);
-					XSetForeground(this->display, this->gc, this->pixels[fore+1]);
-					swapped = true;
-				} else if (swapped) {
-					XSetBackground(this->display, this->gc, this->pixels[fore+1]);
-					XSetForeground(this->display, this->gc, this->pixels[fore]);
-					swapped = false;
+					this->drawCell(x, y, bg, fg);
+					this->drawnCursorX = x;
+					this->drawnCursorY = y;
+				} else {
+					this->drawCell(x, y, fg, bg);
+					if ((this->drawnCursorX == x) && (this->drawnCursorY == y)) {
+						this->drawnCursorX = this->drawnCursorY = -1;
+					}
 				}
-				// In range, draw the text
-				int off = y * this->screenWidth + x;
-				if (!changedOnly || this->changed[off]) {
-					XCopyPlane(this->display, this->font, this->win, this->gc,
-						0, this->text[off] * this->fontHeight, // source
-						this->fontWidth, this->fontHeight,
-						x * this->fontWidth, y * this->fontHeight, // dest
-						1 // plane
-					);
-					this->changed[off] = 0;
+			}
+			this->clearDirty(left, y, right - left);
+		}
+		this->putImage(&this->textImage,
+			left * this->fontWidth, r->y * this->fontHeight,
+			(right - left) * this->fontWidth, r->height * this->fontHeight, 0);
+	}
+	this->waitForImages();
+	return;
+}
+
+void XConsole::drawCell(int x, int y, unsigned long fg, unsigned long bg)
+{
+	XImage *image = this->textImage.image;
+	const uint8_t *glyph = int10_font_14
+		+ this->cells[y * this->screenWidth + x].ch * this->fontHeight;
+	int px = x * this->fontWidth;
+	int py = y * this->fontHeight;
+
+	if (!this->textNative) {
+		for (int r = 0; r < this->fontHeight; r++) {
+			for (int i = 0; i < this->fontWidth; i++) {
+				XPutPixel(image, px + i, py + r, (glyph[r] & (0x80 >> i)) ? fg : bg);
+			}
+		}
+		return;
+	}
+
+	char *line = image->data + py * image->bytes_per_line;
+	if (image->bits_per_pixel == 32) {
+		for (int r = 0; r < this->fontHeight; r++) {
+			uint32_t *p = (uint32_t *)line + px;
+			for (int i = 0; i < this->fontWidth; i++) {
+				p[i] = (glyph[r] & (0x80 >> i)) ? fg : bg;
+			}
+			line += image->bytes_per_line;
+		}
+	} else {
+		for (int r = 0; r < this->fontHeight; r++) {
+			uint16_t *p = (uint16_t *)line + px;
+			for (int i = 0; i < this->fontWidth; i++) {
+				p[i] = (glyph[r] & (0x80 >> i)) ? fg : bg;
+			}
+			line += image->bytes_per_line;
+		}
+	}
+	return;
+}
+
+uint32_t *XConsole::getFramebuffer(int *iWidth, int *iHeight, int *iStride)
+{
+	int width = this->screenWidth * this->fontWidth;
+	int height = (this->screenHeight - 2) * this->fontHeight;
+	XImage *image = this->viewImage.image;
+	if ((!image) || (image->width != width) || (image->height != height)) {
+		this->destroyImage(&this->viewImage);
+		if (!this->createImage(&this->viewImage, width, height, true)) {
+			this->imageVisible = false;
+			return NULL;
+		}
+		image = this->viewImage.image;
+	}
+	*iWidth = width;
+	*iHeight = height;
+	*iStride = image->bytes_per_line / 4;
+	return (uint32_t *)image->data;
+}
+
+void XConsole::updateFramebuffer()
+{
+	XImage *image = this->viewImage.image;
+	if (!image) return;
+	this->imageVisible = true;
+	this->putImage(&this->viewImage, 0, 0, image->width, image->height,
+		this->fontHeight);
+	this->waitForImages();
+	return;
+}
+
+void XConsole::releaseFramebuffer()
+{
+	if (!this->imageVisible) return;
+	this->imageVisible = false;
+	this->destroyImage(&this->viewImage);
+
+	// Make sure the text gets drawn over the top of the old image
+	for (int y = 1; y < this->screenHeight - 1; y++) {
+		this->markDirty(0, y, this->screenWidth);
+	}
+	return;
+}
+
+#ifdef HAVE_XSHM
+/// Set if an X11 error occurs while attaching to the shared memory.
+static bool shmError;
+
+/// X11 error handler that only records the error.
+static int shmErrorHandler(Display *display, XErrorEvent *ev)
+{
+	shmError = true;
+	return 0;
+}
+#endif
+
+bool XConsole::createImage(Surface *surface, int width, int height, bool rgb)
+{
+	int screen = DefaultScreen(this->display);
+	Visual *visual = DefaultVisual(this->display, screen);
+	int depth = DefaultDepth(this->display, screen);
+
+	// Only 0x00RRGGBB pixels are supported for views, so they don't have to
+	// worry about converting them to suit the display.
+	if (rgb && (
+		(visual->c_class != TrueColor)
+		|| (depth < 24)
+		|| (visual->red_mask != 0xFF0000)
+		|| (visual->green_mask != 0x00FF00)
+		|| (visual->blue_mask != 0x0000FF)
+	)) {
+		return false;
+	}
+
+	surface->image = NULL;
+#ifdef HAVE_XSHM
+	surface->useShm = false;
+	if (XShmQueryExtension(this->display)) {
+		XShmSegmentInfo *shmInfo = &surface->shmInfo;
+		surface->image = XShmCreateImage(this->display, visual, depth, ZPixmap,
+			NULL, shmInfo, width, height);
+		if (surface->image && (!rgb || (surface->image->bits_per_pixel == 32))) {
+			shmInfo->shmid = shmget(IPC_PRIVATE,
+				surface->image->bytes_per_line * surface->image->height,
+				IPC_CREAT | 0600);
+			if (shmInfo->shmid >= 0) {
+				shmInfo->shmaddr = (char *)shmat(shmInfo->shmid, NULL, 0);
+				if (shmInfo->shmaddr != (char *)-1) {
+					surface->image->data = shmInfo->shmaddr;
+					shmInfo->readOnly = False;
+
+					// Attaching fails on a remote display, which is only reported as
+					// an asynchronous error.
+					shmError = false;
+					XErrorHandler oldHandler = XSetErrorHandler(shmErrorHandler);
+					XShmAttach(this->display, shmInfo);
+					XSync(this->display, False);
+					XSetErrorHandler(oldHandler);
+
+					if (!shmError) surface->useShm = true;
+					else shmdt(shmInfo->shmaddr);
 				}
-			} else {
-				XFillRectangle(this->display, this->win, this->gc,
-					x * this->fontWidth, y * this->fontHeight,
-					this->fontWidth, this->fontHeight
-				);
+				// Free the segment once both processes have detached from it
+				shmctl(shmInfo->shmid, IPC_RMID, NULL);
 			}
 		}
+		if (surface->useShm) return true;
+		if (surface->image) {
+			surface->image->data = NULL;
+			XDestroyImage(surface->image);
+			surface->image = NULL;
+		}
+	}
+#endif
+
+	XImage *image = XCreateImage(this->display, visual, depth, ZPixmap, 0, NULL,
+		width, height, 32, 0);
+	if (!image) return false;
+	if (rgb && (image->bits_per_pixel != 32)) {
+		XDestroyImage(image);
+		return false;
+	}
+	// XDestroyImage() will free() this
+	image->data = (char *)malloc(image->bytes_per_line * height);
+	if (!image->data) {
+		XDestroyImage(image);
+		return false;
+	}
+	surface->image = image;
+	return true;
+}
+
+void XConsole::destroyImage(Surface *surface)
+{
+	if (!surface->image) return;
+#ifdef HAVE_XSHM
+	if (surface->useShm) {
+		XShmDetach(this->display, &surface->shmInfo);
+		XSync(this->display, False);
+		shmdt(surface->shmInfo.shmaddr);
+		surface->image->data = NULL;
+		surface->useShm = false;
 	}
+#endif
+	XDestroyImage(surface->image);
+	surface->image = NULL;
 	return;
 }
 
-unsigned int XConsole::writeText(int x, int y, const std::string& strContent)
+void XConsole::putImage(Surface *surface, int x, int y, int width, int height,
+	int offsetY)
 {
-	if (y >= this->screenHeight) return 0;
-	if (x >= this->screenWidth) return 0;
+	XImage *image = surface->image;
+	if (!image) return;
 
-	uint8_t *lineEnd = this->text + (y+1) * this->screenWidth;
+	// Clip to the image, as the caller may pass the whole exposed area
+	if (x < 0) {
+		width += x;
+		x = 0;
+	}
+	if (y < 0) {
+		height += y;
+		y = 0;
+	}
+	if (x + width > image->width) width = image->width - x;
+	if (y + height > image->height) height = image->height - y;
+	if ((width <= 0) || (height <= 0)) return;
+
+#ifdef HAVE_XSHM
+	if (surface->useShm) {
+		XShmPutImage(this->display, this->win, this->gc, image,
+			x, y, x, y + offsetY, width, height, False);
+		return;
+	}
+#endif
+	XPutImage(this->display, this->win, this->gc, image,
+		x, y, x, y + offsetY, width, height);
+	return;
+}
 
-	int offset = y * this->screenWidth + x;
-	uint8_t *start  = this->text    + offset;
-	uint8_t *cstart = this->changed + offset;
-	unsigned int len = 0;
-	for (std::string::const_iterator
-		i = strContent.begin(); (i != strContent.end()) && (start < lineEnd); i++
-	) {
-		*start++ = *i;
-		*cstart++ = 1;
-		len++;
+void XConsole::waitForImages()
+{
+#ifdef HAVE_XSHM
+	if (this->viewImage.useShm || this->textImage.useShm) {
+		// Wait until the server has read the pixels, so the next frame can be
+		// drawn into the same memory.
+		XSync(this->display, False);
+		return;
 	}
-	return len;
+#endif
+	XFlush(this->display);
+	return;
 }
@@ -28,26 +28,33 @@
 
 #include <stdint.h>
 #include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#ifdef HAVE_XSHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+#endif
 #include "BaseConsole.hpp"
 
 /// Console interface to an X-Windows window.
 class XConsole: virtual public BaseConsole
 {
 	private:
+		/// An XImage, possibly in memory shared with the X server.
+		struct Surface {
+			XImage *image;    ///< Pixels, or NULL if not yet created
+#ifdef HAVE_XSHM
+			XShmSegmentInfo shmInfo; ///< Shared memory holding image's pixels
+			bool useShm;      ///< true if image is in shared memory
+#endif
+		};
+
 		Display *display;   ///< X11 display
 		Window win;         ///< Main window
 		GC gc;              ///< GC for drawing on window
-		Pixmap font;        ///< Font glyphs (one line, 256 chars wide)
 
 		int fontWidth;      ///< Width of font char in pixels
 		int fontHeight;     ///< Height of font char in pixels
-		int cursorX;        ///< Current X position of text cursor
-		int cursorY;        ///< Current Y position of text cursor
-		bool cursorVisible; ///< Draw the text cursor on the display?
-		uint8_t *text;      ///< Screen content
-		uint8_t *changed;   ///< 0=unchanged, 1=changed, since last redrawCells()
-		int screenWidth;    ///< Screen width in text cells, used for sizeof(text)
-		int screenHeight;   ///< Screen height in text cells, used for sizeof(text)
 
 #define PX_DOC_FG 0
 #define PX_DOC_BG 1
@@ -58,28 +65,38 @@ class XConsole: virtual public BaseConsole
 #define PX_TOTAL  6
 		unsigned long pixels[PX_TOTAL]; ///< X11 pixel values to use for colours
 
+		Surface viewImage;  ///< Framebuffer for views that draw pixels
+		bool imageVisible;  ///< true if viewImage is covering the content area
+		Surface textImage;  ///< Text as drawn on the window, including status bars
+		bool textNative;    ///< Can textImage pixels be written directly?
+		int drawnCursorX;   ///< Cell drawn inverted as the cursor, or -1 if none
+		int drawnCursorY;   ///< Row of drawnCursorX
+
 	public:
 		XConsole(Display *display);
 		virtual ~XConsole();
 
 		void mainLoop();
-		void update(void);
-		void clearStatusBar(SB_Y eY);
-		void setStatusBar(SB_Y eY, SB_X eX, const std::string& strMessage,
-			int cursor);
-		void gotoxy(int x, int y);
-		void putstr(const std::string& strContent);
-		void getContentDims(int *iWidth, int *iHeight);
-		void scrollContent(int iX, int iY);
-		void eraseToEOL(void);
-		void cursor(bool visible);
 		void setColoursFromConfig();
+		uint32_t *getFramebuffer(int *iWidth, int *iHeight, int *iStride);
+		void updateFramebuffer();
+		void releaseFramebuffer();
 
 	protected:
+		void drawChanges();
+
+		/// Scroll the window to match the grid.
+		/**
+		 * The text already drawn is moved on the server, so only the rows
+		 * scrolled onto the screen need to be drawn.
+		 */
+		void applyScroll();
+
 		/// Redraw the characters at the given text coordinates.
 		/**
-		 * After each cell is drawn, the entry for that cell in this->changed is
-		 * set to zero.
+		 * The glyphs are drawn into this->textImage, then each block of rows
+		 * with changes is sent to the window with one XPutImage() call.  Each
+		 * cell drawn is marked as no longer changed.
 		 *
 		 * @param startX
 		 *   X-coordinate of first cell to draw.
@@ -95,30 +112,69 @@ class XConsole: virtual public BaseConsole
 		 *
 		 * @param changedOnly
 		 *   If true, only draw those cells in the area which have changed since
-		 *   the last redraw (where this->changed != 0 for this cell's entry.)  If
-		 *   false, all cells are redrawn regardless.
+		 *   the last redraw.  If false, all cells are redrawn regardless.
 		 */
 		void redrawCells(int startX, int startY, int endX, int endY, bool changedOnly);
 
-		/// Write text at the given location.
+		/// Draw one character into this->textImage.
 		/**
-		 * This writes anywhere on the screen, including on the status bars.
+		 * @param x
+		 *   X-coordinate of the cell, in characters.
+		 *
+		 * @param y
+		 *   Y-coordinate of the cell, in characters.
 		 *
-		 * @note The text will not overlap onto the next line.
+		 * @param fg
+		 *   X11 pixel value for the glyph.
+		 *
+		 * @param bg
+		 *   X11 pixel value for the rest of the cell.
+		 */
+		void drawCell(int x, int y, unsigned long fg, unsigned long bg);
+
+		/// Create an image to draw into.
+		/**
+		 * MIT-SHM is used if available, so the pixels do not have to be sent
+		 * through the X11 connection on each update.
+		 *
+		 * @param surface
+		 *   Surface to hold the new image.  Any existing image must have been
+		 *   destroyed first.
+		 *
+		 * @param rgb
+		 *   true if the pixels must be 0x00RRGGBB, as for a view's framebuffer.
+		 *   false to accept any format the display uses.
+		 *
+		 * @return true on success, false if the display format is unsuitable,
+		 *   in which case surface->image will be NULL.
+		 */
+		bool createImage(Surface *surface, int width, int height, bool rgb);
+
+		/// Free an image, if it exists.
+		void destroyImage(Surface *surface);
+
+		/// Copy part of an image to the window.
+		/**
+		 * The copy has only been queued on return, call waitForImages() before
+		 * drawing into the image again.
+		 *
+		 * @param surface
+		 *   Image to copy from.
 		 *
 		 * @param x
-		 *   X-coordinate where the first character will appear.
+		 *   X-coordinate in the image, which is the same in the window.
 		 *
 		 * @param y
-		 *   Y-coordinate where the first character will appear.
-		 *
-		 * @param strContent
-		 *   The text to draw.
+		 *   Y-coordinate in the image.
 		 *
-		 * @return The number of characters written, possibly less than the content
-		 *   if it would've run over the line or past the end of the screen.
+		 * @param offsetY
+		 *   Number of pixels down the window where the top of the image is.
 		 */
-		unsigned int writeText(int x, int y, const std::string& strContent);
+		void putImage(Surface *surface, int x, int y, int width, int height,
+			int offsetY);
+
+		/// Wait until the X server has finished with the images just sent.
+		void waitForImages();
 };
 
 #endif // XCONSOLE_HPP_
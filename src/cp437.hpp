@@ -0,0 +1,40 @@
+/**
+ * @file   cp437.hpp
+ * @brief  Unicode equivalents of the IBM PC character set.
+ *
+ * Copyright (C) 2009-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+
+/// Unicode code point for each byte in code page 437.
+/**
+ * Control characters are mapped to the glyphs the EGA font shows for them,
+ * except NULL which is a space.
+ */
+extern const uint16_t cp437_unicode[256];
+
+/// Encode a code page 437 character as UTF-8.
+/**
+ * @param c
+ *   Character to encode.
+ *
+ * @param out
+ *   Receives the UTF-8 bytes, with no terminating null.
+ *
+ * @return Number of bytes written to out, 1 to 3.
+ */
+int cp437_utf8(uint8_t c, char out[4]);
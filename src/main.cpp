@@ -18,9 +18,17 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <getopt.h>
 #include <fstream>
 #include <iostream>
+#include <thread>
 #include <camoto/stream_file.hpp>
 #include <config.h>
 #include "cfg.hpp"
@@ -28,6 +36,14 @@
 /// Path to config file, within home directory
 #define CONFIG_FILE "/.config/ll"
 
+/// Shown when the command line is wrong
+#define USAGE "Usage: ll [--raw] [--read-only] [--cache=<MB>] [--io-depth=<n>] " \
+	"[--console=<x11|ncurses|vt|headless>] [--keys=<file>] [--frames=<file>] " \
+	"[--stats] <filename | ->\n" \
+	"       ll --dump [--bits=<n>] [--big-endian] [--bit-offset=<n>] " \
+	"[--columns=<n>] [--start=<cell>] [--end=<cell>] [--jobs=<n>] [--stats] " \
+	"<filename | ->"
+
 #ifdef HAVE_NCURSESW
 #include "NCursesConsole.hpp"
 #endif
@@ -36,17 +52,23 @@
 #include "XConsole.hpp"
 #endif
 
+#include "VTConsole.hpp"
+#include "HeadlessConsole.hpp"
 #include "HexView.hpp"
 #include "TextView.hpp"
+#include "CompressedStream.hpp"
+#include "MmapStream.hpp"
+#include "CachedStream.hpp"
+#include "SpoolStream.hpp"
+#include "DeviceStream.hpp"
+#include "BulkReader.hpp"
+#include "HexDump.hpp"
+#include "Stats.hpp"
 
 Config cfg;
 
 typedef unsigned char byte;
 
-IConsole::~IConsole()
-{
-}
-
 bool readConfig(std::iostream& config)
 {
 	if (!config.good()) return false;
@@ -57,14 +79,136 @@ bool readConfig(std::iostream& config)
 
 int main(int iArgC, char *cArgV[])
 {
-	if (iArgC != 2) {
-		std::cerr << "Usage: ll <filename>" << std::endl;
+	static const struct option longOpts[] = {
+		{"raw", no_argument, NULL, 'z'},
+		{"read-only", no_argument, NULL, 'r'},
+		{"cache", required_argument, NULL, 'c'},
+		{"io-depth", required_argument, NULL, 'q'},
+		{"console", required_argument, NULL, 'o'},
+		{"keys", required_argument, NULL, 'k'},
+		{"frames", required_argument, NULL, 'f'},
+		{"stats", no_argument, NULL, 's'},
+		{"dump", no_argument, NULL, 'D'},
+		{"bits", required_argument, NULL, 'b'},
+		{"big-endian", no_argument, NULL, 'e'},
+		{"bit-offset", required_argument, NULL, 'i'},
+		{"columns", required_argument, NULL, 'w'},
+		{"start", required_argument, NULL, 'S'},
+		{"end", required_argument, NULL, 'E'},
+		{"jobs", required_argument, NULL, 'j'},
+		{NULL, 0, NULL, 0}
+	};
+	bool decompress = true;
+	bool readOnly = false;
+	camoto::stream::len cacheSize = CACHE_DEFAULT_SIZE;
+	std::string consoleName; // empty to pick the first that works
+	std::string keysFilename, framesFilename;
+	bool dump = false;
+	int dumpBits = 8, dumpBitOffset = 0, dumpColumns = 16;
+	camoto::bitstream::endian dumpEndian = camoto::bitstream::littleEndian;
+	camoto::stream::pos dumpStart = 0, dumpEnd = DUMP_TO_EOF;
+	unsigned int dumpJobs = std::thread::hardware_concurrency();
+	int opt;
+	char *end;
+	while ((opt = getopt_long(iArgC, cArgV, "rc:q:", longOpts, NULL)) != -1) {
+		switch (opt) {
+			case 'z': decompress = false; break;
+			case 'r': readOnly = true; break;
+			case 'c':
+				// strtoul() would quietly wrap a negative number around
+				cacheSize = strtoul(optarg, &end, 10);
+				if ((*end != '\0') || (cacheSize == 0) || strchr(optarg, '-')
+					|| (cacheSize > (SIZE_MAX >> 20))
+				) {
+					std::cerr << "Cache size must be a number of megabytes" << std::endl;
+					return 1;
+				}
+				cacheSize <<= 20;
+				break;
+			case 'q':
+				BulkReader::depth = strtoul(optarg, &end, 10);
+				if ((*end != '\0') || (BulkReader::depth == 0)) {
+					std::cerr << "I/O depth must be a number of reads" << std::endl;
+					return 1;
+				}
+				break;
+			case 'o': consoleName = optarg; break;
+			case 'k': keysFilename = optarg; break;
+			case 'f': framesFilename = optarg; break;
+			case 's': ::stats.startTiming(); break;
+			case 'D': dump = true; break;
+			case 'b':
+				dumpBits = strtol(optarg, &end, 10);
+				if ((*end != '\0') || (dumpBits < 1) || (dumpBits > 32)) {
+					std::cerr << "Cell size must be 1 to 32 bits" << std::endl;
+					return 1;
+				}
+				break;
+			case 'e': dumpEndian = camoto::bitstream::bigEndian; break;
+			case 'i':
+				dumpBitOffset = strtol(optarg, &end, 10);
+				if ((*end != '\0') || (dumpBitOffset < 0)) {
+					std::cerr << "Bit offset must be a number of bits" << std::endl;
+					return 1;
+				}
+				break;
+			case 'w':
+				dumpColumns = strtol(optarg, &end, 10);
+				if ((*end != '\0') || (dumpColumns < 1)) {
+					std::cerr << "Columns must be a number of cells" << std::endl;
+					return 1;
+				}
+				break;
+			case 'S':
+				// Cell number as in the offset column, with 0x for hex
+				dumpStart = strtoull(optarg, &end, 0);
+				if (*end != '\0') {
+					std::cerr << "Start must be a cell number" << std::endl;
+					return 1;
+				}
+				break;
+			case 'E':
+				dumpEnd = strtoull(optarg, &end, 0);
+				if (*end != '\0') {
+					std::cerr << "End must be a cell number" << std::endl;
+					return 1;
+				}
+				break;
+			case 'j':
+				dumpJobs = strtoul(optarg, &end, 10);
+				if ((*end != '\0') || (dumpJobs == 0)) {
+					std::cerr << "Jobs must be a number of threads" << std::endl;
+					return 1;
+				}
+				break;
+			default:
+				std::cerr << USAGE << std::endl;
+				return 1;
+		}
+	}
+	if (optind != iArgC - 1) {
+		std::cerr << USAGE << std::endl;
+		return 1;
+	}
+	if (dump && (dumpBitOffset >= dumpBits)) {
+		std::cerr << "Bit offset must be less than the cell size" << std::endl;
 		return 1;
 	}
+	// Dumping never writes, and mapped files are quicker to read
+	if (dump) readOnly = true;
 
-	// Load config
+	bool headless = (consoleName == "headless");
+	if (headless && keysFilename.empty()) {
+		std::cerr << "The headless console needs a script given with --keys"
+			<< std::endl;
+		return 1;
+	}
+
+	// Load config.  Headless runs always start from the defaults and don't save
+	// anything, so the same script always gives the same result.
 	bool gotConfig = false;
-	std::string configFilename(getenv("HOME"));
+	std::string configFilename;
+	if (!headless) configFilename = getenv("HOME");
 	if (!configFilename.empty()) {
 		configFilename.append(CONFIG_FILE);
 		std::fstream config(configFilename.c_str(), std::ios::in);
@@ -82,19 +226,170 @@ int main(int iArgC, char *cArgV[])
 		::cfg.view = View_Text;
 	}
 
+	std::string strFilename = cArgV[optind];
+
+	// Pipes can't be seeked or mapped, and their size isn't known until they're
+	// closed, so the data is copied somewhere seekable as it arrives.  The same
+	// goes for character devices, and files like those in /proc which report a
+	// size of zero but still have content.  Some devices never end, so those
+	// are only read as far as the user has looked.
+	int streamFd = -1;
+	camoto::stream::len streamAhead = 0;
+	bool device = false;
+	struct stat st;
+	if (strFilename == "-") {
+		streamFd = dup(STDIN_FILENO);
+		strFilename = "stdin";
+	} else if (stat(strFilename.c_str(), &st) == 0) {
+		if (S_ISCHR(st.st_mode)) streamAhead = SPOOL_DEVICE_AHEAD;
+		if (
+			S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode) || S_ISCHR(st.st_mode)
+			|| (S_ISREG(st.st_mode) && (st.st_size == 0))
+		) {
+			streamFd = open(strFilename.c_str(), O_RDONLY);
+			if (streamFd < 0) {
+				std::cerr << "Error opening file: " << strerror(errno) << std::endl;
+				return 2;
+			}
+		}
+		device = S_ISBLK(st.st_mode);
+	}
+
+	std::shared_ptr<camoto::stream::inout> data;
+	if (streamFd >= 0) {
+		try {
+			data = std::make_shared<SpoolStream>(streamFd, streamAhead);
+		} catch (const camoto::stream::open_error& e) {
+			std::cerr << "Error opening file: " << e.get_message() << std::endl;
+			return 2;
+		}
+	} else if (device) {
+		// Block devices are read directly, in whole sectors
+		try {
+			data = std::make_shared<DeviceStream>(strFilename);
+		} catch (const camoto::stream::open_error& e) {
+			std::cerr << "Error opening device: " << e.get_message() << std::endl;
+			return 2;
+		}
+	} else {
+		if (access(strFilename.c_str(), W_OK) != 0) readOnly = true;
+
+		// Files that won't be written to are mapped into memory, so reading them
+		// doesn't need a system call for each access.  This includes compressed
+		// files, which are only ever read.
+		std::shared_ptr<camoto::stream::inout> fsFile;
+		if (readOnly || decompress) {
+			try {
+				fsFile = std::make_shared<MmapStream>(strFilename);
+			} catch (const camoto::stream::open_error&) {
+			}
+		}
+		bool mapped = (bool)fsFile;
+		if (!fsFile) {
+			try {
+				fsFile = std::make_shared<camoto::stream::file>(strFilename, false /* don't create file */);
+			} catch (const camoto::stream::open_error& e) {
+				std::cerr << "Error opening file: " << e.get_message() << std::endl;
+				return 2;
+			}
+		}
+
+		// View the decompressed data if the file is compressed
+		data = fsFile;
+		if (decompress) {
+			try {
+				std::shared_ptr<CompressedStream> zFile =
+					CompressedStream::open(strFilename, fsFile);
+				if (zFile) {
+					data = zFile;
+				} else if (mapped && !readOnly) {
+					// Not compressed, so open it again so it can be edited
+					data = std::make_shared<camoto::stream::file>(strFilename, false);
+				}
+			} catch (const camoto::stream::open_error& e) {
+				std::cerr << "Error opening file: " << e.get_message() << std::endl;
+				return 2;
+			} catch (const camoto::stream::error& e) {
+				std::cerr << "Error reading compressed file: " << e.get_message()
+					<< "\nUse --raw to view the file without decompressing it."
+					<< std::endl;
+				return 2;
+			}
+		}
+	}
+
+	// Keep recently viewed data in memory, so slow storage is only read once and
+	// can be read ahead in the background.  Mapped files are already cached by
+	// the kernel, as are pipes once they've been spooled to a temporary file.
+	// All views share this one cache.
+	if (
+		!dynamic_cast<MmapStream *>(data.get())
+		&& !dynamic_cast<SpoolStream *>(data.get())
+	) {
+		data = std::make_shared<CachedStream>(data, cacheSize);
+	}
+
+	if (dump) {
+		try {
+			HexDump dumper(data, dumpBits, dumpEndian, dumpBitOffset, dumpColumns);
+			dumper.write(STDOUT_FILENO, dumpStart, dumpEnd, dumpJobs);
+		} catch (const camoto::stream::error& e) {
+			std::cerr << "Error dumping data: " << e.get_message() << std::endl;
+			return 2;
+		}
+		if (::stats.timing) ::stats.printReport(std::cerr);
+		return 0;
+	}
+
 	IConsole *pConsole = NULL;
 
+	// Keys come from a script and the screen goes to a file, for tests
+	HeadlessConsole *headlessConsole = NULL;
+	std::ifstream keys;
+	std::ofstream frames;
+	if (headless) {
+		keys.open(keysFilename.c_str());
+		if (!keys.is_open()) {
+			std::cerr << "Error opening key script " << keysFilename << ": "
+				<< strerror(errno) << std::endl;
+			return 1;
+		}
+		if (!framesFilename.empty()) {
+			frames.open(framesFilename.c_str());
+			if (!frames.is_open()) {
+				std::cerr << "Error opening frame output " << framesFilename << ": "
+					<< strerror(errno) << std::endl;
+				return 1;
+			}
+		}
+		pConsole = headlessConsole = new HeadlessConsole(80, 25, keys,
+			framesFilename.empty() ? std::cout : frames);
+	}
+
+	// Plain escape codes are only used when asked for
+	if (consoleName == "vt") {
+		int tty = open("/dev/tty", O_RDWR);
+		if (tty < 0) {
+			std::cerr << "Error opening terminal: " << strerror(errno) << std::endl;
+			return 1;
+		}
+		pConsole = new VTConsole(tty);
+	}
+
 	// Try X11 interface first, if present
 #ifdef USE_X11
-	Display *display = XOpenDisplay("");
-	if (display) {
-		pConsole = new XConsole(display);
+	Display *display = NULL;
+	if (!pConsole && (consoleName.empty() || (consoleName == "x11"))) {
+		display = XOpenDisplay("");
+		if (display) {
+			pConsole = new XConsole(display);
+		}
 	}
 #endif
 
 	// Otherwise fall back to curses
 #ifdef HAVE_NCURSESW
-	if (!pConsole) {
+	if (!pConsole && (consoleName.empty() || (consoleName == "ncurses"))) {
 		pConsole = new NCursesConsole();
 	}
 #endif
@@ -102,40 +397,35 @@ int main(int iArgC, char *cArgV[])
 	if (!pConsole) {
 		std::cerr << "Unable to find a usable display method from one of [ "
 #ifdef USE_X11
-			"X11 "
+			"x11 "
 #endif
 #ifdef HAVE_NCURSESW
-			"NCurses "
+			"ncurses "
 #endif
-			"]"
+			"vt headless ]"
 			<< std::endl;
 		return 1;
 	}
 
-	std::string strFilename = cArgV[1];
-	std::shared_ptr<camoto::stream::file> fsFile;
-	try {
-		fsFile = std::make_shared<camoto::stream::file>(strFilename, false /* don't create file */);
-	} catch (const camoto::stream::open_error& e) {
-		std::cerr << "Error opening file: " << e.get_message() << std::endl;
-		return 2;
-	}
-
 	IViewPtr pView;
 	switch (::cfg.view) {
 		case View_Hex:
-			pView.reset(new HexView(strFilename, fsFile, pConsole));
+			pView.reset(new HexView(strFilename, data, pConsole));
 			break;
 		default: // View_Text
-			pView.reset(new TextView(strFilename, fsFile, pConsole));
+			pView.reset(new TextView(strFilename, data, pConsole));
 			break;
 	}
 
 	pConsole->setView(pView);
 	pConsole->mainLoop();
 
+	if (headlessConsole) headlessConsole->printCounters(std::cerr);
 	delete pConsole;
 
+	// Now the terminal is back to normal
+	if (::stats.timing) ::stats.printReport(std::cerr);
+
 	// Save config file
 	if (!configFilename.empty()) {
 		std::fstream config(configFilename.c_str(), std::ios::out);